@@ -0,0 +1,318 @@
+#include "BVH4.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <Empty/math/funcs.h>
+
+namespace
+{
+    // Spreads the 8 low bits of x so that bit i lands on bit 4i
+    uint32_t spreadBits(uint32_t x)
+    {
+        x = (x | (x << 12)) & 0x000F000F;
+        x = (x | (x << 6)) & 0x03030303;
+        x = (x | (x << 3)) & 0x11111111;
+        return x;
+    }
+
+    uint32_t morton(const Empty::math::vec4 &p)
+    {
+        uint32_t code = 0;
+        for(int i = 0; i < 4; ++i)
+        {
+            float q = std::min(std::max(p(i) * 256.f, 0.f), 255.f);
+            code |= spreadBits(static_cast<uint32_t>(q)) << i;
+        }
+        return code;
+    }
+
+    int highestBit(uint32_t x)
+    {
+        int bit = -1;
+        while(x)
+        {
+            x >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+}
+
+void BVH4::build(const std::vector<AABB4> &boxes)
+{
+    nodes.clear();
+    items.clear();
+
+    // Morton codes of the box centers, normalized to the bounds of the centers
+    AABB4 centroids;
+    for(const AABB4 &b : boxes)
+        if(!b.empty())
+            centroids.expand(b.center());
+    Empty::math::vec4 scale;
+    for(int i = 0; i < 4; ++i)
+    {
+        float extent = centroids.max(i) - centroids.min(i);
+        scale(i) = extent > 0 ? 1 / extent : 0;
+    }
+
+    std::vector<std::pair<uint32_t, int>> sorted;
+    sorted.reserve(boxes.size());
+    for(size_t k = 0; k < boxes.size(); ++k)
+        if(!boxes[k].empty())
+            sorted.emplace_back(morton((boxes[k].center() - centroids.min) * scale), static_cast<int>(k));
+    std::sort(sorted.begin(), sorted.end());
+
+    if(sorted.empty())
+    {
+        _builtCost = 0;
+        return;
+    }
+
+    std::vector<uint32_t> codes(sorted.size());
+    items.resize(sorted.size());
+    for(size_t k = 0; k < sorted.size(); ++k)
+    {
+        codes[k] = sorted[k].first;
+        items[k] = sorted[k].second;
+    }
+
+    nodes.reserve(2 * items.size() / std::max(leafSize, 1) + 1);
+    buildRange(codes, 0, static_cast<int>(items.size()));
+    refitNodes(boxes);
+    _builtCost = cost();
+}
+
+void BVH4::build(const SceneGraph4 &graph)
+{
+    _graphBuild = graph.buildCount();
+    build(graphBoxes(graph));
+}
+
+int BVH4::buildRange(const std::vector<uint32_t> &codes, int first, int last)
+{
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(Node{ AABB4(), first, last - first });
+    if(last - first <= leafSize)
+        return index;
+
+    // Split where the highest bit that differs in the range flips. Codes are
+    // sorted, so the range is split into two contiguous halves.
+    int split = (first + last) / 2;
+    int bit = highestBit(codes[first] ^ codes[last - 1]);
+    if(bit >= 0)
+        split = static_cast<int>(std::partition_point(codes.begin() + first, codes.begin() + last,
+            [bit](uint32_t c) { return !((c >> bit) & 1); }) - codes.begin());
+
+    buildRange(codes, first, split);
+    int right = buildRange(codes, split, last);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void BVH4::refit(const std::vector<AABB4> &boxes)
+{
+    refitNodes(boxes);
+}
+
+void BVH4::refit(const SceneGraph4 &graph)
+{
+    refitNodes(graphBoxes(graph));
+}
+
+void BVH4::refitNodes(const std::vector<AABB4> &boxes)
+{
+    // Item boxes are kept to test them individually during queries
+    if(&boxes != &_boxes)
+        _boxes.assign(boxes.begin(), boxes.end());
+
+    // Children always come after their parent
+    for(size_t k = nodes.size(); k-- > 0;)
+    {
+        Node &node = nodes[k];
+        node.bounds = AABB4();
+        if(node.isLeaf())
+        {
+            for(int i = node.offset; i < node.offset + node.count; ++i)
+                node.bounds.expand(boxes[items[i]]);
+        }
+        else
+            node.bounds.expand(nodes[k + 1].bounds).expand(nodes[node.offset].bounds);
+    }
+}
+
+bool BVH4::update(const SceneGraph4 &graph)
+{
+    if(graph.buildCount() != _graphBuild)
+    {
+        build(graph);
+        return true;
+    }
+    refit(graph);
+    if(cost() > rebuildRatio * _builtCost)
+    {
+        build(graph);
+        return true;
+    }
+    return false;
+}
+
+const std::vector<AABB4> &BVH4::graphBoxes(const SceneGraph4 &graph)
+{
+    _boxes.resize(graph.size());
+    for(size_t k = 0; k < graph.size(); ++k)
+        _boxes[k] = AABB4(graph.worldBounds[k].center, graph.worldBounds[k].radius);
+    return _boxes;
+}
+
+float BVH4::cost() const
+{
+    float c = 0;
+    for(const Node &node : nodes)
+        c += node.bounds.boundary();
+    return c;
+}
+
+bool BVH4::intersectRay(const AABB4 &box, const Empty::math::vec4 &o, const Empty::math::vec4 &invd,
+    float tmax, float &tnear)
+{
+    return box.intersectRay(o, invd, tmax, tnear);
+}
+
+namespace
+{
+    // Walks the hierarchy, descending into the nodes that pass a test, and
+    // collects the items that pass it
+    template <typename F>
+    void traverse(const std::vector<BVH4::Node> &nodes, const std::vector<int> &items, const std::vector<AABB4> &boxes,
+        F &&test, std::vector<int> &out)
+    {
+        if(nodes.empty())
+            return;
+        int stack[64], top = 0;
+        stack[top++] = 0;
+        while(top > 0)
+        {
+            int k = stack[--top];
+            const BVH4::Node &node = nodes[k];
+            if(!test(node.bounds))
+                continue;
+            if(node.isLeaf())
+            {
+                for(int i = node.offset; i < node.offset + node.count; ++i)
+                    if(node.count == 1 || test(boxes[items[i]]))
+                        out.push_back(items[i]);
+            }
+            else
+            {
+                stack[top++] = node.offset;
+                stack[top++] = k + 1;
+            }
+        }
+    }
+
+    // Inverse of a ray direction, with infinities along the axes it is parallel to
+    Empty::math::vec4 inverseDirection(const Empty::math::vec4 &d)
+    {
+        Empty::math::vec4 inv;
+        for(int i = 0; i < 4; ++i)
+            inv(i) = d(i) != 0 ? 1 / d(i) : 1e30f;
+        return inv;
+    }
+}
+
+void BVH4::queryHyperplane(const Empty::math::vec4 &n, float d, std::vector<int> &out) const
+{
+    traverse(nodes, items, _boxes, [&](const AABB4 &b)
+    {
+        Empty::math::vec4 c = b.center(), e = b.extent();
+        float r = std::abs(n.x) * e.x + std::abs(n.y) * e.y + std::abs(n.z) * e.z + std::abs(n.w) * e.w;
+        return std::abs(Empty::math::dot(n, c) - d) <= r;
+    }, out);
+}
+
+void BVH4::queryFrustum(const Transform4 &vt, const Frustum3 &frustum, std::vector<int> &out) const
+{
+    traverse(nodes, items, _boxes, [&](const AABB4 &b)
+    {
+        AABB4 v = b.transformed(vt);
+        return v.min.w <= 0 && v.max.w >= 0 && frustum.intersectsBox(v.min, v.max);
+    }, out);
+}
+
+void BVH4::querySphere(const Empty::math::vec4 &center, float radius, std::vector<int> &out) const
+{
+    traverse(nodes, items, _boxes, [&](const AABB4 &b)
+    {
+        Empty::math::vec4 d = center - Empty::math::min(Empty::math::max(center, b.min), b.max);
+        return Empty::math::dot(d, d) <= radius * radius;
+    }, out);
+}
+
+void BVH4::queryRay(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float tmax, std::vector<int> &out) const
+{
+    const Empty::math::vec4 invd = inverseDirection(d);
+    float tnear;
+    traverse(nodes, items, _boxes, [&](const AABB4 &b) { return intersectRay(b, o, invd, tmax, tnear); }, out);
+}
+
+int BVH4::raycast(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float &tmax,
+    const std::function<float(int item)> &hit) const
+{
+    if(nodes.empty())
+        return -1;
+    const Empty::math::vec4 invd = inverseDirection(d);
+    int closest = -1;
+
+    std::pair<int, float> stack[64];
+    int top = 0;
+    float t;
+    if(!intersectRay(nodes[0].bounds, o, invd, tmax, t))
+        return -1;
+    stack[top++] = { 0, t };
+    while(top > 0)
+    {
+        auto [k, tnear] = stack[--top];
+        if(tnear > tmax)
+            continue;
+        const Node &node = nodes[k];
+        if(node.isLeaf())
+        {
+            for(int i = node.offset; i < node.offset + node.count; ++i)
+            {
+                float th = hit(items[i]);
+                if(th >= 0 && th <= tmax)
+                {
+                    tmax = th;
+                    closest = items[i];
+                }
+            }
+            continue;
+        }
+
+        // Push the further child first so that the nearer one is visited first
+        float tl, tr;
+        bool hl = intersectRay(nodes[k + 1].bounds, o, invd, tmax, tl),
+            hr = intersectRay(nodes[node.offset].bounds, o, invd, tmax, tr);
+        if(hl && hr)
+        {
+            if(tl < tr)
+            {
+                stack[top++] = { node.offset, tr };
+                stack[top++] = { k + 1, tl };
+            }
+            else
+            {
+                stack[top++] = { k + 1, tl };
+                stack[top++] = { node.offset, tr };
+            }
+        }
+        else if(hl)
+            stack[top++] = { k + 1, tl };
+        else if(hr)
+            stack[top++] = { node.offset, tr };
+    }
+    return closest;
+}
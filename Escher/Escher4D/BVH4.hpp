@@ -0,0 +1,149 @@
+#ifndef INC_BVH4
+#define INC_BVH4
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Bounds4.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Bounding volume hierarchy over 4D boxes, meant to index the objects of a scene
+ * for culling, picking and collision queries.
+ *
+ * The tree is built as a linear BVH : items are sorted along a 4D Morton curve
+ * of their centers and the sorted range is split recursively on the highest
+ * differing bit of the codes. Nodes are stored in depth-first order, the left
+ * child of an internal node directly following it, so that a refit is a single
+ * backward pass over the nodes.
+ */
+class BVH4
+{
+public:
+    struct Node
+    {
+        AABB4 bounds;
+        /**
+         * For leaves, index of the first item in `items`. For internal nodes,
+         * index of the right child.
+         */
+        int offset;
+        /**
+         * Amount of items under a leaf, 0 for internal nodes.
+         */
+        int count;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    BVH4() { }
+
+    /**
+     * Builds the hierarchy over a set of boxes. Empty boxes are left out.
+     * Items are referred to by their index in the array.
+     */
+    void build(const std::vector<AABB4> &boxes);
+    /**
+     * Builds the hierarchy over the world bounds of a scene graph's nodes. Items
+     * are the indices of the nodes in the graph.
+     */
+    void build(const SceneGraph4 &graph);
+
+    /**
+     * Recomputes the bounds of every node after boxes moved, keeping the tree
+     * topology. Boxes must be given in the same order as during the build.
+     */
+    void refit(const std::vector<AABB4> &boxes);
+    void refit(const SceneGraph4 &graph);
+
+    /**
+     * Keeps the hierarchy in sync with a scene graph : rebuilds it when the
+     * graph was rebuilt or when refitting degraded the tree too much (see
+     * `rebuildRatio`), and refits it otherwise. Should be called after
+     * `SceneGraph4::updateWorldTransforms`.
+     * @return  whether the hierarchy was rebuilt
+     */
+    bool update(const SceneGraph4 &graph);
+
+    /**
+     * Finds the items whose box crosses the hyperplane n.x = d.
+     */
+    void queryHyperplane(const Empty::math::vec4 &n, float d, std::vector<int> &out) const;
+    /**
+     * Finds the items whose box can show up in a view, ie crosses the w = 0
+     * hyperplane of view space with its slice at least partially inside the
+     * frustum.
+     * @param   vt  view transform
+     */
+    void queryFrustum(const Transform4 &vt, const Frustum3 &frustum, std::vector<int> &out) const;
+    /**
+     * Finds the items whose box overlaps a ball.
+     */
+    void querySphere(const Empty::math::vec4 &center, float radius, std::vector<int> &out) const;
+    /**
+     * Finds the items whose box is hit by the ray o + t d for t in [0, tmax].
+     */
+    void queryRay(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float tmax, std::vector<int> &out) const;
+
+    /**
+     * Casts a ray and looks for the closest hit. Nodes are visited front to back
+     * and `hit` is called for every item whose box the ray enters before the
+     * closest hit found so far. It should return the distance to the item along
+     * the ray, or a negative value if the ray misses it.
+     * @return  the closest item hit, or -1
+     */
+    int raycast(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float &tmax,
+        const std::function<float(int item)> &hit) const;
+
+    /**
+     * Sum of the boundary measures of the nodes, the 4D analog of the surface
+     * area heuristic. Lower is better.
+     */
+    float cost() const;
+
+    /**
+     * Tests whether the ray o + t d, with precomputed inverse direction, enters a
+     * box for t in [0, tmax].
+     * @param   tnear   receives the entry distance
+     */
+    static bool intersectRay(const AABB4 &box, const Empty::math::vec4 &o, const Empty::math::vec4 &invd,
+        float tmax, float &tnear);
+
+    /**
+     * Maximum amount of items per leaf.
+     */
+    int leafSize = 4;
+    /**
+     * Ratio of the cost after a refit to the cost right after the last build
+     * beyond which `update` rebuilds the tree.
+     */
+    float rebuildRatio = 2;
+
+    /**
+     * Nodes in depth-first order, the root being the first node.
+     */
+    std::vector<Node> nodes;
+    /**
+     * Items sorted such that each leaf refers to a contiguous range.
+     */
+    std::vector<int> items;
+
+private:
+    // Builds the node for the sorted range [first, last) and returns its index
+    int buildRange(const std::vector<uint32_t> &codes, int first, int last);
+    // Recomputes every node's bounds from the item boxes
+    void refitNodes(const std::vector<AABB4> &boxes);
+    // Converts the world bounds of a graph to boxes
+    const std::vector<AABB4> &graphBoxes(const SceneGraph4 &graph);
+
+    // Box of each item as of the last build or refit
+    std::vector<AABB4> _boxes;
+    float _builtCost = 0;
+    unsigned int _graphBuild = 0;
+};
+
+#endif
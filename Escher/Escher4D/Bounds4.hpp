@@ -0,0 +1,219 @@
+#ifndef INC_BOUNDS4
+#define INC_BOUNDS4
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <Empty/math/funcs.h>
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Axis-aligned box in 4-space. A default-constructed box is empty.
+ */
+struct AABB4
+{
+    AABB4() : min(1e30f, 1e30f, 1e30f, 1e30f), max(-1e30f, -1e30f, -1e30f, -1e30f) { }
+    AABB4(const Empty::math::vec4 &lo, const Empty::math::vec4 &hi) : min(lo), max(hi) { }
+    /**
+     * Constructs the box of a ball.
+     */
+    AABB4(const Empty::math::vec4 &c, float r) : AABB4()
+    {
+        if(r >= 0)
+        {
+            min = c - Empty::math::vec4(r, r, r, r);
+            max = c + Empty::math::vec4(r, r, r, r);
+        }
+    }
+
+    bool empty() const { return min.x > max.x; }
+    Empty::math::vec4 center() const { return (min + max) / 2.f; }
+    Empty::math::vec4 extent() const { return (max - min) / 2.f; }
+    /**
+     * Measure of the boundary of the box, the 4D analog of its surface area.
+     */
+    float boundary() const
+    {
+        if(empty())
+            return 0;
+        Empty::math::vec4 d = max - min;
+        return 2 * (d.x * d.y * d.z + d.x * d.y * d.w + d.x * d.z * d.w + d.y * d.z * d.w);
+    }
+
+    /**
+     * Grows the box to contain a point.
+     */
+    AABB4 &expand(const Empty::math::vec4 &v)
+    {
+        min = Empty::math::min(min, v);
+        max = Empty::math::max(max, v);
+        return *this;
+    }
+    /**
+     * Grows the box to contain another box.
+     */
+    AABB4 &expand(const AABB4 &b)
+    {
+        min = Empty::math::min(min, b.min);
+        max = Empty::math::max(max, b.max);
+        return *this;
+    }
+
+    /**
+     * Tests whether the ray o + t d enters the box for t in [0, tmax], given the
+     * inverse of the ray direction.
+     * @param   tnear   receives the entry distance
+     */
+    bool intersectRay(const Empty::math::vec4 &o, const Empty::math::vec4 &invd, float tmax, float &tnear) const
+    {
+        float t0 = 0, t1 = tmax;
+        for(int i = 0; i < 4; ++i)
+        {
+            float a = (min(i) - o(i)) * invd(i), b = (max(i) - o(i)) * invd(i);
+            if(a > b)
+                std::swap(a, b);
+            t0 = std::max(t0, a);
+            t1 = std::min(t1, b);
+        }
+        tnear = t0;
+        return t0 <= t1;
+    }
+
+    /**
+     * Returns the smallest box containing this box after a transform.
+     */
+    AABB4 transformed(const Transform4 &t) const
+    {
+        if(empty())
+            return *this;
+        Empty::math::vec4 c = t.apply(center()), e = extent(), r;
+        for(int i = 0; i < 4; ++i)
+            r(i) = std::abs(t.mat(i, 0)) * e.x + std::abs(t.mat(i, 1)) * e.y
+                + std::abs(t.mat(i, 2)) * e.z + std::abs(t.mat(i, 3)) * e.w;
+        return AABB4(c - r, c + r);
+    }
+
+    Empty::math::vec4 min, max;
+};
+
+/**
+ * Ball in 4-space. A negative radius denotes an empty sphere.
+ */
+struct BoundingSphere4
+{
+    BoundingSphere4() : center(0, 0, 0, 0), radius(-1) { }
+    BoundingSphere4(const Empty::math::vec4 &c, float r) : center(c), radius(r) { }
+    /**
+     * Constructs the sphere circumscribed to a box.
+     */
+    explicit BoundingSphere4(const AABB4 &b) : BoundingSphere4()
+    {
+        if(!b.empty())
+        {
+            center = b.center();
+            radius = Empty::math::length(b.extent());
+        }
+    }
+
+    bool empty() const { return radius < 0; }
+
+    /**
+     * Returns a sphere containing this sphere after a transform.
+     * @param   kind    class of the transform, as returned by `Transform4::classify`
+     */
+    BoundingSphere4 transformed(const Transform4 &t, Transform4::Kind kind) const
+    {
+        if(empty())
+            return *this;
+        return BoundingSphere4(t.apply(center), radius * t.maxScale(kind));
+    }
+
+    /**
+     * Grows the sphere to contain another sphere.
+     */
+    BoundingSphere4 &merge(const BoundingSphere4 &s)
+    {
+        if(s.empty())
+            return *this;
+        if(empty())
+            return *this = s;
+        Empty::math::vec4 d = s.center - center;
+        float dist = Empty::math::length(d);
+        if(dist + s.radius <= radius)
+            return *this;
+        if(dist + radius <= s.radius)
+            return *this = s;
+        float r = (dist + radius + s.radius) / 2;
+        center += d * ((r - radius) / dist);
+        radius = r;
+        return *this;
+    }
+
+    Empty::math::vec4 center;
+    float radius;
+};
+
+/**
+ * 3D view frustum, as 6 planes extracted from a projection matrix. Planes are
+ * stored as (n, d) with n.p + d >= 0 for points inside the frustum.
+ */
+struct Frustum3
+{
+    Frustum3() { }
+    /**
+     * Extracts the frustum planes from a projection matrix such as the one built
+     * by `perspective`.
+     */
+    explicit Frustum3(const Empty::math::mat4 &p)
+    {
+        for(int k = 0; k < 3; ++k)
+            for(int j = 0; j < 4; ++j)
+            {
+                planes[2 * k](j) = p(3, j) + p(k, j);
+                planes[2 * k + 1](j) = p(3, j) - p(k, j);
+            }
+        for(Empty::math::vec4 &plane : planes)
+        {
+            float l = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+            plane /= l;
+        }
+    }
+
+    /**
+     * Tests whether a 3D sphere is at least partially inside the frustum. The
+     * w coordinate of the center is ignored.
+     */
+    bool intersectsSphere(const Empty::math::vec4 &center, float radius) const
+    {
+        for(const Empty::math::vec4 &plane : planes)
+            if(plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+                return false;
+        return true;
+    }
+    /**
+     * Tests whether a 3D box is at least partially inside the frustum. The w
+     * coordinates are ignored. This is conservative : boxes close to a corner
+     * of the frustum may be reported as intersecting.
+     */
+    bool intersectsBox(const Empty::math::vec4 &min, const Empty::math::vec4 &max) const
+    {
+        for(const Empty::math::vec4 &plane : planes)
+        {
+            // Corner of the box furthest along the plane normal
+            float x = plane.x >= 0 ? max.x : min.x,
+                y = plane.y >= 0 ? max.y : min.y,
+                z = plane.z >= 0 ? max.z : min.z;
+            if(plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+                return false;
+        }
+        return true;
+    }
+
+    Empty::math::vec4 planes[6];
+};
+
+#endif
@@ -2,34 +2,29 @@
 #define INC_CAMERA4
 
 #include <Empty/math/mat.h>
-#include <glad/glad.h>
-#include <GLFW/glfw3.h>
 
+#include "Escher4D/CollisionWorld4.hpp"
+#include "Escher4D/InputSource.hpp"
 #include "Escher4D/Transform4.hpp"
 
 struct Camera4 : private Transform4
 {
-    Camera4(GLFWwindow *window) : Transform4(), _window(window)
-    {
-        glfwGetCursorPos(_window, &_prevMouseX, &_prevMouseY);
-    }
+    Camera4() : Transform4() { }
     /**
      * Computes the view transform of the scene.
      */
     Transform4 computeViewTransform() const
     {
-        Empty::math::mat4 m = Empty::math::inverse(mat);
-        return Transform4(m, -(m * pos));
+        return inverse();
     }
     /**
      * Processes input for camera movement.
      * @param   dt  time step for this frame
      */
-    void update(float dt)
+    void update(const InputFrame &input, float dt)
     {
         // Movement
-        Empty::math::vec4 dr(glfwGetKey(_window, GLFW_KEY_D) - glfwGetKey(_window, GLFW_KEY_A),
-            0, glfwGetKey(_window, GLFW_KEY_S) - glfwGetKey(_window, GLFW_KEY_W), 0);
+        Empty::math::vec4 dr(input.axis(InputFrame::D, InputFrame::A), 0, input.axis(InputFrame::S, InputFrame::W), 0);
         if (dot(dr, dr) > 0.5) // will always be 1 or 2
         {
             dr = Empty::math::normalize(dr);
@@ -37,25 +32,34 @@ struct Camera4 : private Transform4
 
             dr = mat * dr;
             dr(1) = 0; // let's not fly off
-            pos += dr;
+            if(collider)
+                pos = collider->move(pos, radius, dr).position;
+            else
+                pos += dr;
         }
         
         // Field of view rotation
-        double mouseX, mouseY;
-        glfwGetCursorPos(_window, &mouseX, &mouseY);
-        _xz += (float)(mouseX - _prevMouseX) / rotationDivisorX;
-        _yz += (float)(mouseY - _prevMouseY) / rotationDivisorY;
-        // Cap _yz rotation at head and feet
-        _yz = Empty::math::clamp(_yz, -(float)M_PI / 2 + 0.01f, (float)M_PI / 2 - 0.01f);
-        
-        Empty::math::vec4 dir = Empty::math::vec4(-sin(_xz) * cos(_yz), sin(_yz), cos(_xz) * cos(_yz), 0.f);
-        lookAt(dir, Empty::math::vec4(0, 1, 0, 0), Empty::math::vec4(0, 0, 0, 1));
-        _prevMouseX = mouseX; _prevMouseY = mouseY;
+        _xz += input.dx / rotationDivisorX;
+        _yz += input.dy / rotationDivisorY;
         
         // XW + ZW rotation
-        _xwzw += xwzwSpeed * dt * (glfwGetKey(_window, GLFW_KEY_E) - glfwGetKey(_window, GLFW_KEY_Q));
-        rotate(XW, _xwzw);
-        rotate(ZW, _xwzw);
+        _xwzw += xwzwSpeed * dt * input.axis(InputFrame::E, InputFrame::Q);
+        orient();
+    }
+    /**
+     * Moves the camera to a given position and orientation, such as a keyframe
+     * of a scripted path.
+     * @param   xz      heading in radians
+     * @param   yz      pitch in radians
+     * @param   xwzw    rotation in the XW and ZW planes in radians
+     */
+    void setPose(const Empty::math::vec4 &position, float xz, float yz, float xwzw)
+    {
+        pos = position;
+        _xz = xz;
+        _yz = yz;
+        _xwzw = xwzw;
+        orient();
     }
     
     /**
@@ -76,13 +80,30 @@ struct Camera4 : private Transform4
      * Rotation speed on the XW+ZW planes in rad/s.
      */
     float xwzwSpeed = 1.;
+    /**
+     * Cells the camera collides with and slides along when moving, or `nullptr`
+     * to move freely.
+     */
+    const CollisionWorld4 *collider = nullptr;
+    /**
+     * Radius of the sphere used for collisions.
+     */
+    float radius = 0.25f;
     
 private:
+    // Recomputes the rotation from the camera angles
+    void orient()
+    {
+        // Cap _yz rotation at head and feet
+        _yz = Empty::math::clamp(_yz, -(float)M_PI / 2 + 0.01f, (float)M_PI / 2 - 0.01f);
+        
+        Empty::math::vec4 dir = Empty::math::vec4(-sin(_xz) * cos(_yz), sin(_yz), cos(_xz) * cos(_yz), 0.f);
+        lookAt(dir, Empty::math::vec4(0, 1, 0, 0), Empty::math::vec4(0, 0, 0, 1));
+        rotate(XW, _xwzw);
+        rotate(ZW, _xwzw);
+    }
+    
     friend int _main(int argc, char *argv[]);
-    // window that the camera is attached to
-    GLFWwindow *_window;
-    // Mouse position on the previous frame
-    double _prevMouseX, _prevMouseY;
     float _xz = 0, _yz = 0, _xwzw = 0;
 };
 
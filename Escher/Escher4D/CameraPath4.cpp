@@ -0,0 +1,72 @@
+#include "CameraPath4.hpp"
+
+#include <algorithm>
+#include <exception>
+
+#include "Escher4D/utils.hpp"
+
+namespace
+{
+    // Uniform Catmull-Rom spline through b and c
+    template <typename T>
+    T catmullRom(const T &a, const T &b, const T &c, const T &d, float t)
+    {
+        const float t2 = t * t, t3 = t2 * t;
+        return (b * 2.f + (c - a) * t + (a * 2.f - b * 5.f + c * 4.f - d) * t2 + (b * 3.f - a - c * 3.f + d) * t3) * 0.5f;
+    }
+}
+
+bool CameraPath4::load(const std::string &path)
+{
+    try
+    {
+        std::vector<Key> loaded;
+        for(const std::string &line : split(getFileContents(path), "\r\n"))
+        {
+            std::vector<std::string> fields = tokenize(line);
+            if(fields.empty() || fields[0][0] == '#')
+                continue;
+            if(fields.size() < 8)
+                return false;
+            Key k;
+            k.time = std::stof(fields[0]);
+            for(int i = 0; i < 4; ++i)
+                k.position(i) = std::stof(fields[i + 1]);
+            k.xz = std::stof(fields[5]);
+            k.yz = std::stof(fields[6]);
+            k.xwzw = std::stof(fields[7]);
+            loaded.push_back(k);
+        }
+        std::stable_sort(loaded.begin(), loaded.end(), [](const Key &a, const Key &b) { return a.time < b.time; });
+        keys = std::move(loaded);
+        return true;
+    }
+    catch(std::exception&)
+    {
+        return false;
+    }
+}
+
+CameraPath4::Key CameraPath4::sample(float t) const
+{
+    if(keys.empty())
+        return Key();
+    if(t <= keys.front().time)
+        return keys.front();
+    if(t >= keys.back().time)
+        return keys.back();
+
+    // Segment [k1, k2] containing t, with its neighbours repeated at the ends
+    const size_t k2 = std::upper_bound(keys.begin(), keys.end(), t, [](float t, const Key &k) { return t < k.time; })
+        - keys.begin(), k1 = k2 - 1;
+    const Key &a = keys[k1 > 0 ? k1 - 1 : k1], &b = keys[k1], &c = keys[k2], &d = keys[std::min(k2 + 1, keys.size() - 1)];
+    const float span = c.time - b.time, u = span > 0 ? (t - b.time) / span : 1.f;
+
+    Key k;
+    k.time = t;
+    k.position = catmullRom(a.position, b.position, c.position, d.position, u);
+    k.xz = catmullRom(a.xz, b.xz, c.xz, d.xz, u);
+    k.yz = catmullRom(a.yz, b.yz, c.yz, d.yz, u);
+    k.xwzw = catmullRom(a.xwzw, b.xwzw, c.xwzw, d.xwzw, u);
+    return k;
+}
@@ -0,0 +1,53 @@
+#ifndef INC_CAMERA_PATH4
+#define INC_CAMERA_PATH4
+
+#include <string>
+#include <vector>
+
+#include <Empty/math/vec.h>
+
+/**
+ * Scripted camera motion : keyframes of `Camera4` poses, interpolated with
+ * Catmull-Rom splines so that the camera moves smoothly through them.
+ */
+class CameraPath4
+{
+public:
+    struct Key
+    {
+        /**
+         * Time of the keyframe in seconds.
+         */
+        float time = 0;
+        Empty::math::vec4 position;
+        /**
+         * Camera angles in radians, as given to `Camera4::setPose`.
+         */
+        float xz = 0, yz = 0, xwzw = 0;
+    };
+
+    /**
+     * Reads keyframes from a text file, one per line as
+     * "time x y z w xz yz xwzw". Empty lines and lines starting with '#' are
+     * ignored. Keyframes are sorted by time.
+     * @return  whether or not the operation succeeded
+     */
+    bool load(const std::string &path);
+
+    /**
+     * Pose at a given time, clamped to the first and last keyframes.
+     */
+    Key sample(float t) const;
+
+    /**
+     * Time of the last keyframe, 0 for an empty path.
+     */
+    float duration() const { return keys.empty() ? 0 : keys.back().time; }
+
+    /**
+     * Keyframes sorted by time.
+     */
+    std::vector<Key> keys;
+};
+
+#endif
@@ -0,0 +1,304 @@
+#include "CollisionWorld4.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/MathUtil.hpp"
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    // Closest point of a triangle to p, from Real-Time Collision Detection,
+    // Ericson, 5.1.5. Only dot products are involved, so this holds in 4D.
+    vec4 closestPointTriangle(const vec4 &p, const vec4 &a, const vec4 &b, const vec4 &c)
+    {
+        vec4 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if(d1 <= 0 && d2 <= 0)
+            return a;
+
+        vec4 bp = p - b;
+        float d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if(d3 >= 0 && d4 <= d3)
+            return b;
+
+        float vc = d1 * d4 - d3 * d2;
+        if(vc <= 0 && d1 >= 0 && d3 <= 0)
+            return a + ab * (d1 / (d1 - d3));
+
+        vec4 cp = p - c;
+        float d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if(d6 >= 0 && d5 <= d6)
+            return c;
+
+        float vb = d5 * d2 - d1 * d6;
+        if(vb <= 0 && d2 >= 0 && d6 <= 0)
+            return a + ac * (d2 / (d2 - d6));
+
+        float va = d3 * d6 - d5 * d4;
+        if(va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denom = 1 / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    float sqDistance(const AABB4 &b, const vec4 &p)
+    {
+        vec4 d = p - min(max(p, b.min), b.max);
+        return dot(d, d);
+    }
+}
+
+void CollisionWorld4::clear()
+{
+    _cells.clear();
+    _bounds.clear();
+    _bucketStart.clear();
+    _entries.clear();
+}
+
+void CollisionWorld4::addGeometry(const Geometry4 &geometry, const Transform4 &t)
+{
+    const size_t n = geometry.isIndexed() ? geometry.cells.size() : geometry.vertices.size() / 4;
+    for(size_t k = 0; k < n; ++k)
+    {
+        Cell c;
+        AABB4 box;
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            c.v[i] = t.apply(geometry.vertices[geometry.isIndexed() ? geometry.cells[k][i] : 4 * k + i]);
+            box.expand(c.v[i]);
+        }
+
+        vec4 e1 = c.v[1] - c.v[0], e2 = c.v[2] - c.v[0], e3 = c.v[3] - c.v[0];
+        c.n = MathUtil::cross4(e1, e2, e3);
+        float l = length(c.n);
+        if(l > 0)
+        {
+            c.n /= l;
+            // Each dual vector is orthogonal to the normal and the two other edges
+            vec4 c1 = MathUtil::cross4(c.n, e2, e3), c2 = MathUtil::cross4(e1, c.n, e3), c3 = MathUtil::cross4(e1, e2, c.n);
+            c.a1 = c1 / dot(c1, e1);
+            c.a2 = c2 / dot(c2, e2);
+            c.a3 = c3 / dot(c3, e3);
+        }
+        else
+            c.n = c.a1 = c.a2 = c.a3 = vec4::zero;
+
+        _cells.push_back(c);
+        _bounds.push_back(box);
+    }
+}
+
+void CollisionWorld4::build(const SceneGraph4 &graph, float cellSize)
+{
+    clear();
+    for(size_t k = 0; k < graph.size(); ++k)
+    {
+        const Model4RenderContext *rc = graph.objects[k]->getRenderContext();
+        if(rc)
+            addGeometry(rc->geometry, Transform4(graph.worldMats[k], graph.worldPos[k]));
+    }
+    build(cellSize);
+}
+
+void CollisionWorld4::build(float cellSize)
+{
+    _bucketStart.clear();
+    _entries.clear();
+    if(_cells.empty())
+        return;
+
+    if(cellSize <= 0)
+    {
+        float sum = 0;
+        for(const AABB4 &b : _bounds)
+        {
+            vec4 e = b.max - b.min;
+            sum += std::max(std::max(e.x, e.y), std::max(e.z, e.w));
+        }
+        cellSize = std::max(sum / _bounds.size(), 1e-3f);
+    }
+    _cellSize = cellSize;
+
+    // Visits the grid cells overlapped by the box of each cell
+    auto forEachGridCell = [this](const AABB4 &b, auto &&f)
+    {
+        int lo[4], hi[4], c[4];
+        gridCoords(b.min, lo);
+        gridCoords(b.max, hi);
+        for(c[0] = lo[0]; c[0] <= hi[0]; ++c[0])
+            for(c[1] = lo[1]; c[1] <= hi[1]; ++c[1])
+                for(c[2] = lo[2]; c[2] <= hi[2]; ++c[2])
+                    for(c[3] = lo[3]; c[3] <= hi[3]; ++c[3])
+                        f(c);
+    };
+
+    size_t total = 0;
+    for(const AABB4 &b : _bounds)
+        forEachGridCell(b, [&total](const int*) { ++total; });
+    uint32_t buckets = 1;
+    while(buckets < 2 * total)
+        buckets <<= 1;
+    _bucketMask = buckets - 1;
+
+    // Counting sort of the (bucket, cell) pairs
+    _bucketStart.assign(buckets + 1, 0);
+    for(const AABB4 &b : _bounds)
+        forEachGridCell(b, [this](const int *c) { _bucketStart[bucket(c) + 1]++; });
+    for(uint32_t k = 0; k < buckets; ++k)
+        _bucketStart[k + 1] += _bucketStart[k];
+    _entries.resize(total);
+    std::vector<uint32_t> fill(_bucketStart.begin(), _bucketStart.end() - 1);
+    for(uint32_t k = 0; k < _bounds.size(); ++k)
+        forEachGridCell(_bounds[k], [&](const int *c) { _entries[fill[bucket(c)]++] = k; });
+}
+
+void CollisionWorld4::gridCoords(const vec4 &p, int c[4]) const
+{
+    for(int i = 0; i < 4; ++i)
+        c[i] = static_cast<int>(std::floor(p(i) / _cellSize));
+}
+
+uint32_t CollisionWorld4::bucket(const int c[4]) const
+{
+    uint32_t h = static_cast<uint32_t>(c[0]) * 73856093u ^ static_cast<uint32_t>(c[1]) * 19349663u
+        ^ static_cast<uint32_t>(c[2]) * 83492791u ^ static_cast<uint32_t>(c[3]) * 50331653u;
+    return h & _bucketMask;
+}
+
+vec4 CollisionWorld4::closestPoint(const Cell &cell, const vec4 &p)
+{
+    // Project onto the hyperplane of the cell ; if the projection falls inside
+    // the cell it is the closest point, otherwise the closest point lies on one
+    // of the faces
+    if(dot(cell.n, cell.n) > 0)
+    {
+        vec4 q = p - cell.n * dot(cell.n, p - cell.v[0]), r = q - cell.v[0];
+        float u = dot(r, cell.a1), v = dot(r, cell.a2), w = dot(r, cell.a3);
+        if(u >= 0 && v >= 0 && w >= 0 && u + v + w <= 1)
+            return q;
+    }
+
+    static const int faces[4][3] = { { 0, 1, 2 }, { 0, 1, 3 }, { 0, 2, 3 }, { 1, 2, 3 } };
+    vec4 best;
+    float bestDist = 1e30f;
+    for(const auto &f : faces)
+    {
+        vec4 x = closestPointTriangle(p, cell.v[f[0]], cell.v[f[1]], cell.v[f[2]]), d = p - x;
+        float dist = dot(d, d);
+        if(dist < bestDist)
+        {
+            bestDist = dist;
+            best = x;
+        }
+    }
+    return best;
+}
+
+size_t CollisionWorld4::overlap(const vec4 &center, float radius, std::vector<Contact> &contacts) const
+{
+    contacts.clear();
+    if(_entries.empty())
+        return 0;
+
+    // Broadphase : gather the cells listed in the buckets of the grid cells
+    // overlapped by the sphere
+    std::vector<uint32_t> candidates;
+    const vec4 r(radius, radius, radius, radius);
+    int lo[4], hi[4], c[4];
+    gridCoords(center - r, lo);
+    gridCoords(center + r, hi);
+    double gridCells = 1;
+    for(int i = 0; i < 4; ++i)
+        gridCells *= static_cast<double>(hi[i]) - lo[i] + 1;
+    if(gridCells > static_cast<double>(_bucketMask))
+    {
+        // Spheres covering more grid cells than there are buckets test everything
+        candidates.resize(_cells.size());
+        for(uint32_t k = 0; k < candidates.size(); ++k)
+            candidates[k] = k;
+    }
+    else
+    {
+        for(c[0] = lo[0]; c[0] <= hi[0]; ++c[0])
+            for(c[1] = lo[1]; c[1] <= hi[1]; ++c[1])
+                for(c[2] = lo[2]; c[2] <= hi[2]; ++c[2])
+                    for(c[3] = lo[3]; c[3] <= hi[3]; ++c[3])
+                    {
+                        uint32_t b = bucket(c);
+                        candidates.insert(candidates.end(), _entries.begin() + _bucketStart[b],
+                            _entries.begin() + _bucketStart[b + 1]);
+                    }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+
+    // Narrowphase
+    const float sqRadius = radius * radius;
+    for(uint32_t k : candidates)
+    {
+        if(sqDistance(_bounds[k], center) >= sqRadius)
+            continue;
+        const Cell &cell = _cells[k];
+        vec4 x = closestPoint(cell, center), d = center - x;
+        float sqDist = dot(d, d);
+        if(sqDist >= sqRadius)
+            continue;
+
+        Contact contact;
+        contact.cell = static_cast<int>(k);
+        contact.point = x;
+        contact.distance = std::sqrt(sqDist);
+        if(contact.distance > 0)
+            contact.normal = d / contact.distance;
+        else
+            contact.normal = dot(cell.n, cell.n) > 0 ? cell.n : vec4(0, 1, 0, 0);
+        contacts.push_back(contact);
+    }
+    return contacts.size();
+}
+
+CollisionWorld4::MoveResult CollisionWorld4::move(const vec4 &center, float radius, const vec4 &displacement) const
+{
+    MoveResult result;
+    result.position = center;
+    result.normal = vec4::zero;
+
+    // Points collide with nothing
+    if(!(radius > 0))
+    {
+        result.position += displacement;
+        return result;
+    }
+
+    // Clamped before conversion, so that tiny radii cannot overflow it
+    const float l = length(displacement);
+    const int steps = static_cast<int>(std::min(std::max(1.f, std::ceil(l / (radius / 2))), static_cast<float>(maxSteps)));
+    const vec4 step = displacement / static_cast<float>(steps);
+    std::vector<Contact> contacts;
+    for(int s = 0; s < steps; ++s)
+    {
+        result.position += step;
+        for(int it = 0; it < iterations; ++it)
+        {
+            if(!overlap(result.position, radius, contacts))
+                break;
+            // Resolve the deepest contact first ; the others are usually
+            // resolved along with it or by the next iteration
+            const Contact &deepest = *std::min_element(contacts.begin(), contacts.end(),
+                [](const Contact &a, const Contact &b) { return a.distance < b.distance; });
+            result.position += deepest.normal * (radius - deepest.distance + skin);
+            result.normal = deepest.normal;
+            result.collided = true;
+        }
+    }
+    return result;
+}
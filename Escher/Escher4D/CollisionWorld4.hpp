@@ -0,0 +1,141 @@
+#ifndef INC_COLLISION_WORLD4
+#define INC_COLLISION_WORLD4
+
+#include <cstdint>
+#include <vector>
+
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Bounds4.hpp"
+#include "Escher4D/Transform4.hpp"
+
+struct Geometry4;
+class SceneGraph4;
+
+/**
+ * Collision queries of 4D spheres against world-space tetrahedral cells.
+ *
+ * Cells are registered in a uniform 4D grid, stored as a spatial hash with
+ * compact buckets, which serves as the broadphase. The narrowphase computes the
+ * exact closest point of each candidate cell to the sphere center.
+ */
+class CollisionWorld4
+{
+public:
+    struct Contact
+    {
+        /**
+         * Index of the cell in contact, in the order they were added.
+         */
+        int cell = -1;
+        /**
+         * Closest point of the cell to the sphere center.
+         */
+        Empty::math::vec4 point;
+        /**
+         * Unit vector from the cell to the sphere center.
+         */
+        Empty::math::vec4 normal;
+        /**
+         * Distance from the sphere center to the cell.
+         */
+        float distance = 0;
+    };
+
+    struct MoveResult
+    {
+        /**
+         * Final position of the sphere center.
+         */
+        Empty::math::vec4 position;
+        /**
+         * Normal of the last contact that deflected the movement, if any.
+         */
+        Empty::math::vec4 normal;
+        bool collided = false;
+    };
+
+    CollisionWorld4() { }
+
+    /**
+     * Removes every cell.
+     */
+    void clear();
+    /**
+     * Adds the cells of a geometry placed in the world by a transform. Call
+     * `build` once every geometry has been added.
+     */
+    void addGeometry(const Geometry4 &geometry, const Transform4 &t);
+    /**
+     * Adds the cells of every node of a scene graph that has a render context,
+     * using its current world transforms, and builds the grid.
+     * @param   cellSize    see `build`
+     */
+    void build(const SceneGraph4 &graph, float cellSize = 0);
+    /**
+     * Builds the grid over the cells added so far.
+     * @param   cellSize    edge length of the grid cells ; the default picks the
+     *                      average extent of the tetrahedra
+     */
+    void build(float cellSize = 0);
+
+    /**
+     * Finds every cell closer than a given radius to a point.
+     * @return  the amount of contacts found
+     */
+    size_t overlap(const Empty::math::vec4 &center, float radius, std::vector<Contact> &contacts) const;
+    /**
+     * Moves a sphere by a displacement, sliding along the cells it bumps into.
+     * The movement is split into steps no longer than half the radius so that
+     * the sphere cannot tunnel through thin cells, and after each step the
+     * sphere is pushed out of the cells it penetrates along their normal, which
+     * only cancels the part of the movement going into them. Spheres whose
+     * radius is not positive move freely.
+     */
+    MoveResult move(const Empty::math::vec4 &center, float radius, const Empty::math::vec4 &displacement) const;
+
+    /**
+     * Amount of cells registered.
+     */
+    size_t size() const { return _cells.size(); }
+
+    /**
+     * Distance kept between the sphere and the cells after a push out.
+     */
+    float skin = 1e-4f;
+    /**
+     * Maximum amount of push outs per movement step.
+     */
+    int iterations = 4;
+    /**
+     * Maximum amount of steps per movement, for displacements that dwarf the
+     * radius.
+     */
+    int maxSteps = 1024;
+
+    /**
+     * Cell data laid out for the closest point computation : the vertices, the
+     * unit normal of the cell's hyperplane and the dual basis of its edges.
+     */
+    struct Cell
+    {
+        Empty::math::vec4 v[4], n, a1, a2, a3;
+    };
+
+private:
+    // Grid coordinates of a point
+    void gridCoords(const Empty::math::vec4 &p, int c[4]) const;
+    // Bucket a grid cell hashes to
+    uint32_t bucket(const int c[4]) const;
+    // Closest point of a cell to p
+    static Empty::math::vec4 closestPoint(const Cell &cell, const Empty::math::vec4 &p);
+
+    std::vector<Cell> _cells;
+    std::vector<AABB4> _bounds;
+    float _cellSize = 1;
+    uint32_t _bucketMask = 0;
+    // Bucket b lists the cells _entries[_bucketStart[b]] to _entries[_bucketStart[b + 1] - 1]
+    std::vector<uint32_t> _bucketStart, _entries;
+};
+
+#endif
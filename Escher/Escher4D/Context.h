@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstring>
+
 #include <Empty/Context.hpp>
 #include <Empty/gl/Framebuffer.h>
 #include <Empty/gl/Texture.h>
@@ -11,6 +13,10 @@
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#ifdef ESCHER_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 struct Context : public Empty::Context, Empty::utils::noncopyable
 {
@@ -64,16 +70,90 @@ struct Context : public Empty::Context, Empty::utils::noncopyable
         frameWidth = w;
         frameHeight = h;
 
-        /// Create context resources
-        gBuffer = std::make_unique<Empty::gl::Framebuffer>();
-        dBuffer = std::make_unique<Empty::gl::Renderbuffer>();
-        texPos = std::make_unique<decltype(texPos)::element_type>();
-        texNorm = std::make_unique<decltype(texNorm)::element_type>();
-        texColor = std::make_unique<decltype(texColor)::element_type>();
+        createResources();
+        _init = true;
+        return true;
+    }
 
+#ifdef ESCHER_HEADLESS
+    /**
+     * Initializes an offscreen context of given dimensions, without any window
+     * nor display. Uses EGL with a surfaceless context, so it runs on Mesa's
+     * llvmpipe on machines without a GPU (set `LIBGL_ALWAYS_SOFTWARE=1` to force
+     * it). There is no default framebuffer : draw the final image to `output()`.
+     * ImGui calls keep working but nothing is drawn from them, and `time()`
+     * advances by a fixed step every frame so that runs are reproducible.
+     */
+    bool initHeadless(int w, int h)
+    {
+        ASSERT(!_init);
+        /// Setup display, preferring Mesa's surfaceless platform
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        _display = EGL_NO_DISPLAY;
+        if(clientExtensions && std::strstr(clientExtensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+            _display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if(_display == EGL_NO_DISPLAY)
+            _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major, minor;
+        if(_display == EGL_NO_DISPLAY || !eglInitialize(_display, &major, &minor))
+        {
+            TRACE("Couldn't initialize EGL");
+            return false;
+        }
+        const char *extensions = eglQueryString(_display, EGL_EXTENSIONS);
+        if(!extensions || !std::strstr(extensions, "EGL_KHR_surfaceless_context"))
+        {
+            TRACE("EGL " << major << "." << minor << " doesn't support surfaceless contexts");
+            eglTerminate(_display);
+            return false;
+        }
+
+        /// Setup context
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 5,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if(!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(_display, configAttribs, &config, 1, &configs) || !configs
+            || (_eglContext = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttribs)) == EGL_NO_CONTEXT)
+        {
+            TRACE("Couldn't create OpenGL 4.5 context, EGL error " << eglGetError());
+            eglTerminate(_display);
+            return false;
+        }
+        eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, _eglContext);
+        gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+        TRACE("Headless context on " << glGetString(GL_RENDERER));
+
+        /// Setup ImGui without platform backend
+        ImGui::CreateContext();
+        ImGui::GetIO().DisplaySize = ImVec2(static_cast<float>(w), static_cast<float>(h));
+        ImGui_ImplOpenGL3_Init("#version 450");
+        ImGui::StyleColorsDark();
+
+        setViewport(w, h);
+        frameWidth = w;
+        frameHeight = h;
+
+        createResources();
+        outBuffer = std::make_unique<Empty::gl::Framebuffer>();
+        outDepth = std::make_unique<Empty::gl::Renderbuffer>();
+        texOutput = std::make_unique<decltype(texOutput)::element_type>();
+        _headless = true;
         _init = true;
         return true;
     }
+#endif
 
     /**
      * Sets up internals (framebuffer and textures) for deferred rendering given
@@ -81,6 +161,8 @@ struct Context : public Empty::Context, Empty::utils::noncopyable
      */
     void setupDeferred(int w, int h)
     {
+        frameWidth = w;
+        frameHeight = h;
         texPos->setStorage(1, w, h);
         texPos->setParameter<Empty::gl::TextureParam::MinFilter>(Empty::gl::TextureParamValue::FilterNearest);
         texPos->setParameter<Empty::gl::TextureParam::MagFilter>(Empty::gl::TextureParamValue::FilterNearest);
@@ -102,19 +184,83 @@ struct Context : public Empty::Context, Empty::utils::noncopyable
         gBuffer->attachRenderbuffer<Empty::gl::FramebufferAttachment::Depth>(*dBuffer);
 
         TRACE("Framebuffer status : " << Empty::utils::name(gBuffer->checkStatus(Empty::gl::FramebufferTarget::DrawRead)));
+
+        if(_headless)
+        {
+            texOutput->setStorage(1, w, h);
+            outBuffer->attachTexture<Empty::gl::FramebufferAttachment::Color>(0, *texOutput, 0);
+            outDepth->setStorage(Empty::gl::RenderbufferFormat::Depth, w, h);
+            outBuffer->attachRenderbuffer<Empty::gl::FramebufferAttachment::Depth>(*outDepth);
+            TRACE("Output framebuffer status : " << Empty::utils::name(outBuffer->checkStatus(Empty::gl::FramebufferTarget::DrawRead)));
+        }
+    }
+
+    /**
+     * Framebuffer to draw the final image to : the window's, or an offscreen
+     * one backed by `texOutput` in headless mode.
+     */
+    Empty::gl::Framebuffer &output() const
+    {
+        return _headless ? *outBuffer : Empty::gl::Framebuffer::dflt;
+    }
+
+    bool headless() const { return _headless; }
+
+    /**
+     * Whether the user asked to close the window ; never in headless mode.
+     */
+    bool shouldClose() const
+    {
+        return !_headless && glfwWindowShouldClose(window);
+    }
+
+    /**
+     * Time in seconds since initialization, or since the first frame at a fixed
+     * step per frame in headless mode.
+     */
+    double time() const
+    {
+        return _headless ? _frame * headlessTimeStep : glfwGetTime();
+    }
+
+    /**
+     * Whether the current context exposes an OpenGL extension.
+     */
+    bool hasExtension(const char *name) const
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for(GLint k = 0; k < count; ++k)
+            if(!std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, k)), name))
+                return true;
+        return false;
     }
 
 
     void newFrame() const
     {
         ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
+        if(_headless)
+        {
+            ImGuiIO &io = ImGui::GetIO();
+            io.DisplaySize = ImVec2(static_cast<float>(frameWidth), static_cast<float>(frameHeight));
+            io.DeltaTime = static_cast<float>(headlessTimeStep);
+        }
+        else
+            ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
     }
 
     void swap() const override
     {
         ImGui::Render();
+        if(_headless)
+        {
+            // Nothing to present, but let the frame's commands go through
+            glFlush();
+            _frame++;
+            return;
+        }
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwPollEvents();
         glfwSwapBuffers(window);
@@ -124,9 +270,27 @@ struct Context : public Empty::Context, Empty::utils::noncopyable
     {
         if (_init)
         {
-            ImGui_ImplGlfw_Shutdown();
+            if(!_headless)
+                ImGui_ImplGlfw_Shutdown();
             ImGui_ImplOpenGL3_Shutdown();
             ImGui::DestroyContext();
+            gBuffer.reset();
+            dBuffer.reset();
+            texPos.reset();
+            texNorm.reset();
+            texColor.reset();
+            outBuffer.reset();
+            outDepth.reset();
+            texOutput.reset();
+#ifdef ESCHER_HEADLESS
+            if(_headless)
+            {
+                eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                eglDestroyContext(_display, _eglContext);
+                eglTerminate(_display);
+            }
+            else
+#endif
             glfwTerminate();
             _init = false;
         }
@@ -141,10 +305,35 @@ struct Context : public Empty::Context, Empty::utils::noncopyable
     std::unique_ptr<Empty::gl::Texture<Empty::gl::TextureTarget::Texture2D, Empty::gl::TextureFormat::RGBA16f>> texPos;
     std::unique_ptr<Empty::gl::Texture<Empty::gl::TextureTarget::Texture2D, Empty::gl::TextureFormat::RGBA8s>> texNorm;
     std::unique_ptr<Empty::gl::Texture<Empty::gl::TextureTarget::Texture2D, Empty::gl::TextureFormat::RGBA8>> texColor;
+    // Offscreen output in headless mode
+    std::unique_ptr<Empty::gl::Framebuffer> outBuffer;
+    std::unique_ptr<Empty::gl::Renderbuffer> outDepth;
+    std::unique_ptr<Empty::gl::Texture<Empty::gl::TextureTarget::Texture2D, Empty::gl::TextureFormat::RGBA8>> texOutput;
+    /**
+     * Seconds between frames in headless mode.
+     */
+    double headlessTimeStep = 1. / 60.;
 
 private:
     Context() : Empty::Context(), Empty::utils::noncopyable(), frameWidth(0), frameHeight(0), window(nullptr), _init(false) { }
+
+    void createResources()
+    {
+        gBuffer = std::make_unique<Empty::gl::Framebuffer>();
+        dBuffer = std::make_unique<Empty::gl::Renderbuffer>();
+        texPos = std::make_unique<decltype(texPos)::element_type>();
+        texNorm = std::make_unique<decltype(texNorm)::element_type>();
+        texColor = std::make_unique<decltype(texColor)::element_type>();
+    }
+
     bool _init;
+    bool _headless = false;
+    // Frames swapped, which drive time in headless mode
+    mutable unsigned int _frame = 0;
+#ifdef ESCHER_HEADLESS
+    EGLDisplay _display = EGL_NO_DISPLAY;
+    EGLContext _eglContext = EGL_NO_CONTEXT;
+#endif
     static Context _instance;
 
     // Callbacks
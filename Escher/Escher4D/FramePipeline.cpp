@@ -0,0 +1,100 @@
+#include "FramePipeline.hpp"
+
+#include "Escher4D/Profiler.hpp"
+
+FramePipeline::FramePipeline(Simulate simulate, bool pipelined) : _simulate(std::move(simulate))
+{
+    if(pipelined)
+        _thread = std::thread(&FramePipeline::run, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+    if(!_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _start.notify_one();
+    _thread.join();
+}
+
+const FrameSnapshot &FramePipeline::advance(const InputFrame &input, float time, float dt, const std::function<void()> &sync)
+{
+    if(!pipelined())
+    {
+        if(sync)
+            sync();
+        FrameSnapshot &snapshot = _snapshots[0];
+        prepare(snapshot, time, dt);
+        _simulate(input, snapshot);
+        return snapshot;
+    }
+
+    if(!_frames)
+    {
+        prepare(_snapshots[0], time, 0);
+        _simulate(InputFrame(), _snapshots[0]);
+    }
+    else
+        idle();
+    if(sync)
+        sync();
+
+    // Frame n goes to snapshot n % 2, the previous one is ready
+    FrameSnapshot &next = _snapshots[_frames % 2], &ready = _snapshots[(_frames + 1) % 2];
+
+    prepare(next, time, dt);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _input = input;
+        _target = &next;
+        _busy = true;
+    }
+    _start.notify_one();
+    return ready;
+}
+
+void FramePipeline::run()
+{
+    Profiler::get().setThreadName("simulation");
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [this]() { return _busy || _quit; });
+            // The frame in flight, if any, is simulated before quitting
+            if(!_busy)
+                return;
+        }
+        {
+            PROFILE_ZONE("Simulation");
+            _simulate(_input, *_target);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busy = false;
+        }
+        _done.notify_one();
+    }
+}
+
+void FramePipeline::idle()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        PROFILE_ZONE("Simulation wait");
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return !_busy; });
+    }
+    stats.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void FramePipeline::prepare(FrameSnapshot &snapshot, float time, float dt)
+{
+    snapshot.frame = _frames++;
+    snapshot.time = time;
+    snapshot.dt = dt;
+    snapshot.inputTime = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,151 @@
+#ifndef INC_FRAME_PIPELINE
+#define INC_FRAME_PIPELINE
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Camera4.hpp"
+#include "Escher4D/InputSource.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+
+/**
+ * State of a simulated frame that rendering needs, copied out of the
+ * simulation so that the next frame can be simulated meanwhile.
+ */
+struct FrameSnapshot
+{
+    /**
+     * Number of the frame among the simulated ones, counting from 0.
+     */
+    size_t frame = 0;
+    /**
+     * Simulation time and time step of the frame, in seconds.
+     */
+    float time = 0, dt = 0;
+    /**
+     * When the input of the frame was sampled.
+     */
+    std::chrono::steady_clock::time_point inputTime;
+
+    Camera4 camera;
+    /**
+     * Local transforms of the objects of a scene graph and their versions, in
+     * node order, see `SceneGraph4::updateWorldTransforms`.
+     */
+    std::vector<Empty::math::mat4> localMats;
+    std::vector<Empty::math::vec4> localPos;
+    std::vector<unsigned int> versions;
+
+    /**
+     * Copies the local transforms of the objects of a graph.
+     */
+    void capture(const SceneGraph4 &graph)
+    {
+        const size_t n = graph.size();
+        localMats.resize(n);
+        localPos.resize(n);
+        versions.resize(n);
+        for(size_t k = 0; k < n; ++k)
+        {
+            const Object4 &obj = *graph.objects[k];
+            localMats[k] = obj.mat;
+            localPos[k] = obj.pos;
+            versions[k] = obj.version();
+        }
+    }
+};
+
+/**
+ * Splits frames into a simulation stage, which turns input into a
+ * `FrameSnapshot`, and a render stage, which draws snapshots.
+ *
+ * Pipelined, the simulation runs on a thread of its own, one frame ahead :
+ * while the calling thread renders a snapshot, the next one is simulated into
+ * the other of two buffers. Frames then take about as long as the slower
+ * stage rather than both, and input is shown at most two frames after it was
+ * sampled. Otherwise, frames are simulated in turn by the calling thread.
+ *
+ * The calling thread, which owns the window and the GL context, samples the
+ * input. Only the simulation touches the camera and the object transforms
+ * between calls to `advance` ; rendering reads them from snapshots, and may
+ * still read anything else about the objects. Objects must not be added or
+ * removed.
+ */
+class FramePipeline
+{
+public:
+    /**
+     * Simulates a frame, filling the snapshot from the simulation state. Its
+     * frame number, times and input time are filled already.
+     */
+    using Simulate = std::function<void(const InputFrame &input, FrameSnapshot &snapshot)>;
+
+    struct Stats
+    {
+        /**
+         * Seconds the calling thread spent waiting for the simulation.
+         */
+        double waitSeconds = 0;
+    };
+
+    /**
+     * @param   pipelined   whether to simulate on a thread of its own
+     */
+    FramePipeline(Simulate simulate, bool pipelined);
+    /**
+     * Waits for the frame being simulated, if any.
+     */
+    ~FramePipeline();
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline &operator=(const FramePipeline&) = delete;
+
+    /**
+     * Starts simulating a frame from new input and returns the snapshot to
+     * render, which stays valid until the next call.
+     *
+     * Pipelined, the snapshot is that of the frame started by the previous
+     * call, waited for if needed ; the first call simulates an extra frame
+     * without input to have something to render. Otherwise, the snapshot is
+     * that of the new frame.
+     * @param   time    simulation time of the new frame
+     * @param   dt      time step of the new frame
+     * @param   sync    called while the simulation is idle, before the new
+     *                  frame starts : the only time the calling thread may
+     *                  touch the simulation state, eg to apply UI changes
+     */
+    const FrameSnapshot &advance(const InputFrame &input, float time, float dt, const std::function<void()> &sync = nullptr);
+
+    bool pipelined() const { return _thread.joinable(); }
+
+    Stats stats;
+
+private:
+    // Body of the simulation thread
+    void run();
+    // Waits for the simulation thread to be done with its frame
+    void idle();
+    // Fills the bookkeeping of a snapshot before simulating it
+    void prepare(FrameSnapshot &snapshot, float time, float dt);
+
+    Simulate _simulate;
+    FrameSnapshot _snapshots[2];
+    // Frames simulated or being simulated
+    size_t _frames = 0;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _start, _done;
+    // Frame handed to the simulation thread, if busy
+    InputFrame _input;
+    FrameSnapshot *_target = nullptr;
+    bool _busy = false, _quit = false;
+};
+
+#endif
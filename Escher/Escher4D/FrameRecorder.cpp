@@ -0,0 +1,100 @@
+#include "FrameRecorder.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Escher4D/Profiler.hpp"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    double seconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+}
+
+FrameRecorder::FrameRecorder(ThreadPool &pool, int w, int h, Encoder encoder) : _pool(pool), _w(w), _h(h),
+    _encoder(std::move(encoder)), _frameSize(static_cast<size_t>(w) * h * 3), _batchSize(std::max(pool.size(), 1u)),
+    _fences(2 * _batchSize, nullptr), _workerSeconds(pool.size(), 0)
+{
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr size = static_cast<GLsizeiptr>(_frameSize * _fences.size());
+    glCreateBuffers(1, &_buffer);
+    glNamedBufferStorage(_buffer, size, nullptr, flags);
+    _mapping = static_cast<const unsigned char*>(glMapNamedBufferRange(_buffer, 0, size, flags));
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    for(GLsync &f : _fences)
+        if(f)
+            glDeleteSync(f);
+    glDeleteBuffers(1, &_buffer);
+}
+
+void FrameRecorder::capture()
+{
+    PROFILE_ZONE("Readback");
+    Clock::time_point start = Clock::now();
+    const size_t slot = _captured % _fences.size();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _buffer);
+    glReadPixels(0, 0, _w, _h, GL_RGB, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(slot * _frameSize));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Get the copy going while the CPU encodes
+    glFlush();
+    _captured++;
+    stats.readSeconds += seconds(start);
+
+    // The previous batch has to be encoded before the next one reuses its slots
+    if(_captured % _batchSize == 0 && _captured > _batchSize)
+        encodeBatch(_captured / _batchSize - 2);
+}
+
+void FrameRecorder::finish()
+{
+    for(size_t batch = _encoded / _batchSize; _encoded < _captured; ++batch)
+        encodeBatch(batch);
+}
+
+void FrameRecorder::encodeBatch(size_t batch)
+{
+    const unsigned int first = static_cast<unsigned int>(batch * _batchSize),
+        count = static_cast<unsigned int>(std::min(_batchSize, static_cast<size_t>(_captured - first)));
+
+    Clock::time_point start = Clock::now();
+    for(unsigned int k = 0; k < count; ++k)
+    {
+        GLsync &fence = _fences[(first + k) % _fences.size()];
+        GLenum status;
+        do
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        while(status == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    stats.waitSeconds += seconds(start);
+
+    start = Clock::now();
+    std::vector<char> ok(count, 0);
+    _pool.parallelFor(count, [&](size_t k, unsigned int worker)
+    {
+        PROFILE_ZONE("Encoding");
+        Clock::time_point frameStart = Clock::now();
+        const unsigned int frame = first + static_cast<unsigned int>(k);
+        ok[k] = _encoder(_mapping + (frame % _fences.size()) * _frameSize, _w, _h, frame);
+        _workerSeconds[worker] += seconds(frameStart);
+    });
+    stats.encodeWallSeconds += seconds(start);
+
+    stats.encodeSeconds = 0;
+    for(double s : _workerSeconds)
+        stats.encodeSeconds += s;
+    for(char b : ok)
+        stats.failures += !b;
+    stats.frames += count;
+    _encoded = first + count;
+}
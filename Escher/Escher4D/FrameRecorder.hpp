@@ -0,0 +1,98 @@
+#ifndef INC_FRAME_RECORDER
+#define INC_FRAME_RECORDER
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "Escher4D/ThreadPool.hpp"
+
+/**
+ * Captures rendered frames and hands them to an encoder, pipelining the GPU
+ * and the CPU.
+ *
+ * Frames are read back in batches of one frame per worker of a thread pool,
+ * asynchronously into a persistently mapped pixel pack buffer holding two
+ * batches. Once a batch is complete, the previous one, which the GPU is most
+ * likely done with, is encoded in parallel, one frame per worker, while the
+ * GPU renders and copies the current batch. Frames are independent, so the
+ * encoder must only depend on its arguments.
+ *
+ * Pixels are RGB8 with rows going from the bottom of the image up, as OpenGL
+ * reads them.
+ *
+ * Needs OpenGL 4.5, as the pixel pack buffer is created and mapped through
+ * direct state access.
+ */
+class FrameRecorder
+{
+public:
+    /**
+     * Writes out a frame, returning whether it succeeded. Called from the
+     * workers of the pool.
+     */
+    using Encoder = std::function<bool(const unsigned char *pixels, int w, int h, unsigned int frame)>;
+
+    struct Stats
+    {
+        unsigned int frames = 0;
+        /**
+         * Frames the encoder failed on.
+         */
+        unsigned int failures = 0;
+        /**
+         * Seconds spent issuing readbacks.
+         */
+        double readSeconds = 0;
+        /**
+         * Seconds spent waiting for the GPU to finish readbacks.
+         */
+        double waitSeconds = 0;
+        /**
+         * Seconds spent encoding, both summed over the workers and as measured
+         * on the calling thread.
+         */
+        double encodeSeconds = 0, encodeWallSeconds = 0;
+    };
+
+    /**
+     * @param   w, h    dimensions of the frames
+     */
+    FrameRecorder(ThreadPool &pool, int w, int h, Encoder encoder);
+    ~FrameRecorder();
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder &operator=(const FrameRecorder&) = delete;
+
+    /**
+     * Reads back color attachment 0 of the framebuffer bound for reading as the
+     * next frame. Encodes the previous batch when this completes one.
+     */
+    void capture();
+    /**
+     * Encodes all captured frames.
+     */
+    void finish();
+
+    Stats stats;
+
+private:
+    // Waits for the readbacks of a batch and encodes its frames
+    void encodeBatch(size_t batch);
+
+    ThreadPool &_pool;
+    int _w, _h;
+    Encoder _encoder;
+    size_t _frameSize, _batchSize;
+    GLuint _buffer = 0;
+    const unsigned char *_mapping = nullptr;
+    // Fence of the readback of each slot
+    std::vector<GLsync> _fences;
+    // Frames captured so far, and frames already encoded
+    unsigned int _captured = 0, _encoded = 0;
+    // Time spent encoding by each worker
+    std::vector<double> _workerSeconds;
+};
+
+#endif
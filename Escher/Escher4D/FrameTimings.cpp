@@ -0,0 +1,101 @@
+#include "FrameTimings.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glad/glad.h>
+
+#include "Escher4D/utils.hpp"
+
+namespace
+{
+    double milliseconds(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+}
+
+void FrameTimings::beginFrame()
+{
+    if(synchronize)
+        glFinish();
+    _frameStart = _stageStart = Clock::now();
+}
+
+void FrameTimings::mark(const char *stage)
+{
+    if(synchronize)
+        glFinish();
+    Clock::time_point now = Clock::now();
+    samples(stage).push_back(milliseconds(now - _stageStart));
+    _stageStart = now;
+}
+
+void FrameTimings::endFrame()
+{
+    if(synchronize)
+        glFinish();
+    samples("frame").push_back(milliseconds(Clock::now() - _frameStart));
+}
+
+void FrameTimings::record(const std::string &stage, double milliseconds)
+{
+    samples(stage).push_back(milliseconds);
+}
+
+void FrameTimings::reset()
+{
+    _stages.clear();
+    _samples.clear();
+}
+
+std::vector<double> &FrameTimings::samples(const std::string &stage)
+{
+    auto it = std::find(_stages.begin(), _stages.end(), stage);
+    if(it != _stages.end())
+        return _samples[it - _stages.begin()];
+    _stages.push_back(stage);
+    _samples.emplace_back();
+    return _samples.back();
+}
+
+std::vector<FrameTimings::Summary> FrameTimings::summarize() const
+{
+    std::vector<Summary> summaries;
+    for(size_t k = 0; k < _stages.size(); ++k)
+    {
+        std::vector<double> sorted = _samples[k];
+        if(sorted.empty())
+            continue;
+        std::sort(sorted.begin(), sorted.end());
+        Summary s;
+        s.stage = _stages[k];
+        s.samples = sorted.size();
+        s.min = sorted.front();
+        s.max = sorted.back();
+        for(double t : sorted)
+            s.avg += t;
+        s.avg /= sorted.size();
+        // Nearest rank
+        s.p99 = sorted[static_cast<size_t>(std::ceil(0.99 * sorted.size())) - 1];
+        summaries.push_back(s);
+    }
+    // The whole frame goes last
+    std::stable_partition(summaries.begin(), summaries.end(), [](const Summary &s) { return s.stage != "frame"; });
+    return summaries;
+}
+
+void FrameTimings::writeJSON(std::ostream &out) const
+{
+    std::vector<Summary> summaries = summarize();
+    out << "{";
+    for(size_t k = 0; k < summaries.size(); ++k)
+    {
+        const Summary &s = summaries[k];
+        out << (k ? ",\n" : "\n") << "    \"";
+        writeJSONEscaped(out, s.stage.c_str());
+        out << "\": { \"samples\": " << s.samples << ", \"min\": " << s.min
+            << ", \"avg\": " << s.avg << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << " }";
+    }
+    out << "\n}";
+}
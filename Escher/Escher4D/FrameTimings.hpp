@@ -0,0 +1,74 @@
+#ifndef INC_FRAME_TIMINGS
+#define INC_FRAME_TIMINGS
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Wall-clock time of the stages of every frame, summarized as min, average,
+ * 99th percentile and max in milliseconds. Stages are the spans between
+ * consecutive calls to `mark`, and the whole frame is recorded as "frame".
+ *
+ * GL calls return before the GPU is done with them, so the GPU time of a stage
+ * would normally show up in whichever later stage waits for it. With
+ * `synchronize`, every mark waits for the GPU first, which attributes GPU time
+ * to the right stage at the cost of overlap between the CPU and the GPU.
+ */
+class FrameTimings
+{
+public:
+    struct Summary
+    {
+        std::string stage;
+        size_t samples = 0;
+        double min = 0, avg = 0, p99 = 0, max = 0;
+    };
+
+    void beginFrame();
+    /**
+     * Ends a stage that started at the previous mark or at the start of the
+     * frame.
+     */
+    void mark(const char *stage);
+    void endFrame();
+
+    /**
+     * Adds a sample measured elsewhere, eg on the GPU, to a stage.
+     */
+    void record(const std::string &stage, double milliseconds);
+
+    /**
+     * Forgets every sample, eg after warming up.
+     */
+    void reset();
+
+    /**
+     * Summaries of the stages in the order they were first marked, then of the
+     * whole frame.
+     */
+    std::vector<Summary> summarize() const;
+    /**
+     * Writes the summaries as a JSON object mapping stage names to objects with
+     * "samples", "min", "avg", "p99" and "max" fields.
+     */
+    void writeJSON(std::ostream &out) const;
+
+    /**
+     * Whether to wait for the GPU at every mark.
+     */
+    bool synchronize = false;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Samples of a stage, in milliseconds
+    std::vector<double> &samples(const std::string &stage);
+
+    std::vector<std::string> _stages;
+    std::vector<std::vector<double>> _samples;
+    Clock::time_point _frameStart, _stageStart;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "GPUTimer.hpp"
+
+#include "Escher4D/Profiler.hpp"
+#include "Escher4D/RenderStats.hpp"
+
+GPUTimer::GPUTimer(size_t framesInFlight) : _frames(framesInFlight > 0 ? framesInFlight : 1)
+{
+    _track = Profiler::get().createTrack("GPU");
+}
+
+GPUTimer::~GPUTimer()
+{
+    for(Frame &f : _frames)
+        for(Queries &q : f.queries)
+        {
+            GLuint ids[3] = { q.start, q.elapsed, q.primitives };
+            glDeleteQueries(3, ids);
+        }
+}
+
+void GPUTimer::beginFrame()
+{
+    if(_current)
+    {
+        close();
+        _frame++;
+    }
+
+    // Frames complete in order, so stop at the first one still running
+    for(size_t k = 0; k < _frames.size(); ++k)
+        if(!read(_frames[(_frame + k) % _frames.size()], false))
+            break;
+
+    Frame &f = _frames[_frame % _frames.size()];
+    if(f.pending)
+    {
+        stats.dropped++;
+        f.pending = false;
+    }
+    f.number = _frame;
+    f.passes.clear();
+    _current = &f;
+    calibrate();
+}
+
+void GPUTimer::begin(const char *name)
+{
+    if(!_current)
+        return;
+    end();
+
+    const size_t k = _current->passes.size();
+    if(k == _current->queries.size())
+    {
+        GLuint ids[3];
+        glGenQueries(3, ids);
+        _current->queries.push_back({ ids[0], ids[1], ids[2] });
+    }
+    const Queries &q = _current->queries[k];
+    glQueryCounter(q.start, GL_TIMESTAMP);
+    glBeginQuery(GL_TIME_ELAPSED, q.elapsed);
+    glBeginQuery(GL_PRIMITIVES_GENERATED, q.primitives);
+
+    // Counters are turned into deltas by end
+    const RenderStats &rs = RenderStats::get();
+    Pass p;
+    p.name = name;
+    p.drawCalls = rs.drawCalls;
+    p.dispatches = rs.dispatches;
+    p.workGroups = rs.workGroups;
+    _current->passes.push_back(p);
+    _open = true;
+}
+
+void GPUTimer::end()
+{
+    if(!_open)
+        return;
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    const RenderStats &rs = RenderStats::get();
+    Pass &p = _current->passes.back();
+    p.drawCalls = rs.drawCalls - p.drawCalls;
+    p.dispatches = rs.dispatches - p.dispatches;
+    p.workGroups = rs.workGroups - p.workGroups;
+    _open = false;
+}
+
+void GPUTimer::finish()
+{
+    if(_current)
+    {
+        close();
+        _frame++;
+        _current = nullptr;
+    }
+    for(size_t k = 0; k < _frames.size(); ++k)
+        read(_frames[(_frame + k) % _frames.size()], true);
+}
+
+void GPUTimer::close()
+{
+    end();
+    _current->pending = !_current->passes.empty();
+}
+
+bool GPUTimer::read(Frame &frame, bool wait)
+{
+    if(!frame.pending)
+        return true;
+    if(!wait)
+        for(size_t k = 0; k < frame.passes.size(); ++k)
+        {
+            const Queries &q = frame.queries[k];
+            for(GLuint id : { q.start, q.elapsed, q.primitives })
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+                if(!available)
+                    return false;
+            }
+        }
+
+    frame.pending = false;
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    _starts.resize(frame.passes.size());
+    for(size_t k = 0; k < frame.passes.size(); ++k)
+    {
+        const Queries &q = frame.queries[k];
+        GLuint64 elapsed = 0, primitives = 0;
+        glGetQueryObjectui64v(q.start, GL_QUERY_RESULT, &_starts[k]);
+        glGetQueryObjectui64v(q.elapsed, GL_QUERY_RESULT, &elapsed);
+        glGetQueryObjectui64v(q.primitives, GL_QUERY_RESULT, &primitives);
+        // Some drivers, llvmpipe among them, report nonsense for the very
+        // first pass of a context : a pass cannot outlast the time since it
+        // started
+        if(static_cast<GLint64>(_starts[k] + elapsed) > gpuNow)
+        {
+            stats.invalid++;
+            return true;
+        }
+        Pass &p = frame.passes[k];
+        p.milliseconds = elapsed * 1e-6;
+        p.primitives = primitives;
+    }
+
+    Profiler &profiler = Profiler::get();
+    if(profiler.enabled.load(std::memory_order_relaxed))
+        for(size_t k = 0; k < frame.passes.size(); ++k)
+        {
+            const int64_t s = static_cast<int64_t>(_starts[k]) + _offset;
+            const uint64_t start = s > 0 ? static_cast<uint64_t>(s) : 0;
+            profiler.record(_track, { frame.passes[k].name, start,
+                start + static_cast<uint64_t>(frame.passes[k].milliseconds * 1e6), 0 });
+        }
+    _results = frame.passes;
+    _resultsFrame = frame.number;
+    stats.frames++;
+    if(onResults)
+        onResults(frame.number, _results);
+    return true;
+}
+
+void GPUTimer::calibrate()
+{
+    GLint64 gpu = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu);
+    _offset = static_cast<int64_t>(Profiler::now()) - gpu;
+}
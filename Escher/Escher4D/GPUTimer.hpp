@@ -0,0 +1,141 @@
+#ifndef INC_GPU_TIMER
+#define INC_GPU_TIMER
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glad/glad.h>
+
+/**
+ * GPU time of the passes of a frame, measured with `GL_TIME_ELAPSED` queries.
+ *
+ * Queries come from a pool split into one set per frame in flight. Results
+ * are only read once the GPU says they are available, typically a few frames
+ * later, so measuring never stalls the pipeline ; when a set comes up again
+ * before its results arrived, they are dropped instead of waited for. Each
+ * pass also counts the primitives it generated, and the draw calls and
+ * compute dispatches issued according to `RenderStats`.
+ *
+ * Passes also show up on a "GPU" track of the `Profiler`, placed on the CPU
+ * timeline thanks to a timestamp query at their start.
+ *
+ * Passes cannot nest, as time elapsed queries cannot. Needs OpenGL 3.3 or
+ * `ARB_timer_query`, which software renderers such as llvmpipe also provide.
+ */
+class GPUTimer
+{
+public:
+    struct Pass
+    {
+        // Static string
+        const char *name = nullptr;
+        double milliseconds = 0;
+        uint64_t primitives = 0;
+        unsigned int drawCalls = 0, dispatches = 0;
+        unsigned long long workGroups = 0;
+    };
+
+    struct Stats
+    {
+        /**
+         * Frames whose results were read.
+         */
+        size_t frames = 0;
+        /**
+         * Frames whose results were not there yet when their queries were
+         * needed again.
+         */
+        size_t dropped = 0;
+        /**
+         * Frames whose results were impossible, and ignored.
+         */
+        size_t invalid = 0;
+    };
+
+    /**
+     * @param   framesInFlight  frames that can be measured before reading back
+     *                          the results of the oldest one
+     */
+    GPUTimer(size_t framesInFlight = 4);
+    ~GPUTimer();
+    GPUTimer(const GPUTimer&) = delete;
+    GPUTimer &operator=(const GPUTimer&) = delete;
+
+    /**
+     * Reads the results that arrived, then starts measuring a new frame.
+     */
+    void beginFrame();
+    /**
+     * Starts a pass, ending the current one if any.
+     */
+    void begin(const char *name);
+    /**
+     * Ends the current pass.
+     */
+    void end();
+
+    /**
+     * Waits for every pending result.
+     */
+    void finish();
+
+    /**
+     * Passes of the latest frame whose results were read, in order.
+     */
+    const std::vector<Pass> &results() const { return _results; }
+    /**
+     * Number of that frame, counting from 0 ; meaningless as long as `results`
+     * is empty.
+     */
+    size_t resultsFrame() const { return _resultsFrame; }
+
+    /**
+     * Called with every frame whose results were read, in order, eg to keep
+     * all of them rather than only the latest.
+     */
+    std::function<void(size_t frame, const std::vector<Pass> &passes)> onResults;
+
+    Stats stats;
+
+private:
+    // Queries of a pass
+    struct Queries
+    {
+        GLuint start, elapsed, primitives;
+    };
+    // Measurements of a frame in flight
+    struct Frame
+    {
+        size_t number = 0;
+        // Whether passes were measured but not read yet
+        bool pending = false;
+        // Grows to the most passes ever measured in a frame
+        std::vector<Queries> queries;
+        std::vector<Pass> passes;
+    };
+
+    // Ends the current frame, leaving its results pending
+    void close();
+    // Reads the results of a frame, waiting for them or not ; false if they
+    // are not available yet
+    bool read(Frame &frame, bool wait);
+    // Maps GPU timestamps to the profiler's clock
+    void calibrate();
+
+    std::vector<Frame> _frames;
+    size_t _frame = 0;
+    // Frame being measured, and whether one of its passes is open
+    Frame *_current = nullptr;
+    bool _open = false;
+    std::vector<Pass> _results;
+    // Timestamps of the starts of the passes being read
+    std::vector<GLuint64> _starts;
+    size_t _resultsFrame = 0;
+    uint32_t _track;
+    // Profiler time minus GPU time, in nanoseconds
+    int64_t _offset = 0;
+};
+
+#endif
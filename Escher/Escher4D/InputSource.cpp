@@ -0,0 +1,146 @@
+#include "InputSource.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <limits>
+
+#include "Escher4D/utils.hpp"
+
+namespace
+{
+    // Key bits, their letter in scripts and their GLFW binding
+    struct KeyBinding
+    {
+        InputFrame::Key key;
+        char letter;
+        int glfwKey;
+    };
+    const KeyBinding bindings[] =
+    {
+        { InputFrame::W, 'W', GLFW_KEY_W },
+        { InputFrame::A, 'A', GLFW_KEY_A },
+        { InputFrame::S, 'S', GLFW_KEY_S },
+        { InputFrame::D, 'D', GLFW_KEY_D },
+        { InputFrame::Q, 'Q', GLFW_KEY_Q },
+        { InputFrame::E, 'E', GLFW_KEY_E }
+    };
+}
+
+GLFWInputSource::GLFWInputSource(GLFWwindow *window) : _window(window)
+{
+    if(_window)
+        glfwGetCursorPos(_window, &_prevX, &_prevY);
+}
+
+bool GLFWInputSource::next(InputFrame &frame)
+{
+    frame = InputFrame();
+    if(!_window)
+        return true;
+    for(const KeyBinding &b : bindings)
+        if(glfwGetKey(_window, b.glfwKey) == GLFW_PRESS)
+            frame.keys |= b.key;
+    double x, y;
+    glfwGetCursorPos(_window, &x, &y);
+    frame.dx = static_cast<float>(x - _prevX);
+    frame.dy = static_cast<float>(y - _prevY);
+    _prevX = x;
+    _prevY = y;
+    return true;
+}
+
+bool InputScript::load(const std::string &path)
+{
+    try
+    {
+        std::vector<Run> loaded;
+        for(const std::string &line : split(getFileContents(path), "\r\n"))
+        {
+            std::vector<std::string> fields = tokenize(line);
+            if(fields.empty() || fields[0][0] == '#')
+                continue;
+            if(fields.size() < 4)
+                return false;
+            Run run;
+            run.count = static_cast<unsigned int>(std::stoul(fields[0]));
+            if(fields[1] != "-")
+                for(char c : fields[1])
+                {
+                    auto b = std::find_if(std::begin(bindings), std::end(bindings),
+                        [c](const KeyBinding &b) { return b.letter == c; });
+                    if(b == std::end(bindings))
+                        return false;
+                    run.frame.keys |= b->key;
+                }
+            run.frame.dx = std::stof(fields[2]);
+            run.frame.dy = std::stof(fields[3]);
+            loaded.push_back(run);
+        }
+        runs = std::move(loaded);
+        rewind();
+        return true;
+    }
+    catch(std::exception&)
+    {
+        return false;
+    }
+}
+
+bool InputScript::save(const std::string &path) const
+{
+    std::ofstream out(path);
+    // Replays have to see the very same motion
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << "# count keys dx dy\n";
+    for(const Run &run : runs)
+    {
+        std::string keys;
+        for(const KeyBinding &b : bindings)
+            if(run.frame.held(b.key))
+                keys += b.letter;
+        out << run.count << ' ' << (keys.empty() ? "-" : keys) << ' ' << run.frame.dx << ' ' << run.frame.dy << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+void InputScript::append(const InputFrame &frame)
+{
+    if(!runs.empty() && runs.back().frame == frame)
+        runs.back().count++;
+    else
+        runs.push_back({ 1, frame });
+}
+
+bool InputScript::next(InputFrame &frame)
+{
+    while(_run < runs.size() && _frame >= runs[_run].count)
+    {
+        _run++;
+        _frame = 0;
+    }
+    if(_run == runs.size())
+    {
+        frame = InputFrame();
+        return false;
+    }
+    frame = runs[_run].frame;
+    _frame++;
+    return true;
+}
+
+unsigned int InputScript::frames() const
+{
+    unsigned int count = 0;
+    for(const Run &run : runs)
+        count += run.count;
+    return count;
+}
+
+bool InputRecorder::next(InputFrame &frame)
+{
+    bool more = _source.next(frame);
+    if(more)
+        _script.append(frame);
+    return more;
+}
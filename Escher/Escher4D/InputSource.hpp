@@ -0,0 +1,152 @@
+#ifndef INC_INPUT_SOURCE
+#define INC_INPUT_SOURCE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+/**
+ * Input driving the camera during one frame.
+ */
+struct InputFrame
+{
+    /**
+     * Bits of the held keys, named after their default binding.
+     */
+    enum Key : uint32_t
+    {
+        W = 1 << 0,
+        A = 1 << 1,
+        S = 1 << 2,
+        D = 1 << 3,
+        Q = 1 << 4,
+        E = 1 << 5
+    };
+
+    bool held(Key k) const { return (keys & k) != 0; }
+    /**
+     * 1 if only the first key is held, -1 if only the second one is, 0
+     * otherwise.
+     */
+    float axis(Key positive, Key negative) const
+    {
+        return static_cast<float>(held(positive)) - static_cast<float>(held(negative));
+    }
+
+    bool operator==(const InputFrame &f) const { return keys == f.keys && dx == f.dx && dy == f.dy; }
+    bool operator!=(const InputFrame &f) const { return !(*this == f); }
+
+    uint32_t keys = 0;
+    /**
+     * Cursor motion since the previous frame in pixels.
+     */
+    float dx = 0, dy = 0;
+};
+
+/**
+ * Where the input of each frame comes from : the keyboard and mouse, a
+ * recording or a script. Input that does not depend on the machine makes runs
+ * reproducible.
+ */
+class InputSource
+{
+public:
+    virtual ~InputSource() { }
+    /**
+     * Reads the input of the next frame.
+     * @return  false once the source has no more input to give, in which case
+     *          the frame is left empty
+     */
+    virtual bool next(InputFrame &frame) = 0;
+};
+
+/**
+ * Live input from a GLFW window. A null window gives no input, forever.
+ */
+class GLFWInputSource : public InputSource
+{
+public:
+    GLFWInputSource(GLFWwindow *window);
+    bool next(InputFrame &frame) override;
+
+private:
+    GLFWwindow *_window;
+    // Cursor position on the previous frame
+    double _prevX = 0, _prevY = 0;
+};
+
+/**
+ * Sequence of input frames, as recorded or written by hand.
+ *
+ * Scripts are text files with one line per run of identical frames :
+ * "count keys dx dy", where keys are the letters of `InputFrame::Key` that are
+ * held, or "-" for none. For instance "120 WD 2 0" walks forward and right for
+ * 120 frames while turning right. Empty lines and lines starting with '#' are
+ * ignored.
+ */
+class InputScript : public InputSource
+{
+public:
+    struct Run
+    {
+        unsigned int count = 0;
+        InputFrame frame;
+    };
+
+    /**
+     * Reads a script from a file.
+     * @return  whether or not the operation succeeded
+     */
+    bool load(const std::string &path);
+    /**
+     * Writes the script to a file.
+     * @return  whether or not the operation succeeded
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * Appends a frame, extending the last run if it is the same.
+     */
+    void append(const InputFrame &frame);
+
+    bool next(InputFrame &frame) override;
+
+    /**
+     * Goes back to the first frame.
+     */
+    void rewind() { _run = _frame = 0; }
+
+    /**
+     * Total amount of frames.
+     */
+    unsigned int frames() const;
+
+    std::vector<Run> runs;
+
+private:
+    // Position of the next frame
+    size_t _run = 0;
+    unsigned int _frame = 0;
+};
+
+/**
+ * Passes the input of another source through while recording it to a script,
+ * which is saved on destruction.
+ */
+class InputRecorder : public InputSource
+{
+public:
+    InputRecorder(InputSource &source, const std::string &path) : _source(source), _path(path) { }
+    ~InputRecorder() { _script.save(_path); }
+    bool next(InputFrame &frame) override;
+
+private:
+    InputSource &_source;
+    std::string _path;
+    InputScript _script;
+};
+
+#endif
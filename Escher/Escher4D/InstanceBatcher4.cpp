@@ -0,0 +1,82 @@
+#include "InstanceBatcher4.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "Escher4D/Context.h"
+#include "Escher4D/Profiler.hpp"
+
+void InstanceBatcher4::gather(SceneGraph4 &graph, const Transform4 &vt, const Empty::math::mat4 &p)
+{
+    PROFILE_ZONE("Instance gather");
+    graph.collectVisible(vt, p, _visible);
+    const Empty::math::mat4 tinvv = vt.normalMatrix();
+
+    // Count instances per render context
+    std::unordered_map<const Model4RenderContext*, unsigned int> batchIndex;
+    batches.clear();
+    _batchOf.resize(_visible.size());
+    for(size_t i = 0; i < _visible.size(); ++i)
+    {
+        Model4RenderContext *rc = graph.objects[_visible[i]]->_rc;
+        auto it = batchIndex.find(rc);
+        if(it == batchIndex.end())
+        {
+            it = batchIndex.emplace(rc, static_cast<unsigned int>(batches.size())).first;
+            batches.push_back({ rc, 0, 0 });
+        }
+        _batchOf[i] = it->second;
+        batches[it->second].count++;
+    }
+
+    unsigned int first = 0;
+    for(Batch &b : batches)
+    {
+        b.first = first;
+        first += b.count;
+    }
+
+    // Scatter instances to their batch's range, using the counts as cursors
+    instances.resize(_visible.size());
+    for(Batch &b : batches)
+        b.count = 0;
+    for(size_t i = 0; i < _visible.size(); ++i)
+    {
+        unsigned int k = _visible[i];
+        Batch &b = batches[_batchOf[i]];
+        Instance &inst = instances[b.first + b.count++];
+        const Object4 &obj = *graph.objects[k];
+        Transform4 mv = Transform4(graph.worldMats[k], graph.worldPos[k]).chain(vt);
+        inst.mv = mv.mat;
+        inst.tinvMV = graph.viewNormalMatrix(k, tinvv);
+        inst.mvt = mv.pos;
+        inst.color = obj.color;
+        inst.insideOut = obj.insideOut;
+    }
+}
+
+void InstanceBatcher4::render(Empty::gl::ShaderProgram &program)
+{
+    if(instances.empty())
+        return;
+
+    PROFILE_ZONE("Instance upload and draw");
+    Context &context = Context::get();
+    size_t size = instances.size() * sizeof(Instance);
+    if(!_buffer)
+        _buffer = std::make_unique<Empty::gl::Buffer>();
+    if(size > _capacity)
+    {
+        // Grow geometrically to avoid reallocating as the view changes
+        _capacity = std::max(size, _capacity * 2);
+        _buffer->setStorage(_capacity, Empty::gl::BufferUsage::StreamDraw);
+    }
+    _buffer->uploadData(0, size, instances[0]);
+    context.bind(*_buffer, Empty::gl::IndexedBufferTarget::ShaderStorage, binding);
+
+    for(const Batch &b : batches)
+    {
+        program.uniform("uInstanceBase", static_cast<int>(b.first));
+        b.rc->renderInstanced(program, b.count);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef INC_INSTANCE_BATCHER4
+#define INC_INSTANCE_BATCHER4
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Empty/gl/Buffer.h>
+#include <Empty/gl/ShaderProgram.hpp>
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Draws the visible nodes of a scene graph with one instanced draw call per
+ * render context instead of one draw call per node.
+ *
+ * Gathering is done on the CPU : visible nodes are grouped by render context
+ * and their view-space transforms and materials are written to a single
+ * array, each group being a contiguous range of it. Rendering then uploads
+ * that array to a shader storage buffer and issues the draws, the shader
+ * reading its instance at `uInstanceBase + gl_InstanceID` (see
+ * `shaders/vertex_instanced.glsl` in the eightrooms example). Gathering does
+ * not need a GL context.
+ */
+class InstanceBatcher4
+{
+public:
+    /**
+     * Per-instance data, laid out to match the std430 instance buffer.
+     */
+    struct Instance
+    {
+        Empty::math::mat4 mv;
+        Empty::math::mat4 tinvMV;
+        Empty::math::vec4 mvt;
+        Empty::math::vec4 color;
+        int32_t insideOut;
+        int32_t padding[3];
+    };
+
+    /**
+     * Range of instances drawn by one render context.
+     */
+    struct Batch
+    {
+        Model4RenderContext *rc;
+        unsigned int first, count;
+    };
+
+    /**
+     * Collects the visible nodes of a graph whose world transforms are up to
+     * date and groups them by render context. Batches are ordered by first
+     * appearance in the graph, and instances keep the graph order within them.
+     */
+    void gather(SceneGraph4 &graph, const Transform4 &vt, const Empty::math::mat4 &p);
+
+    /**
+     * Uploads the gathered instances and draws every batch through a program
+     * reading them from the instance buffer.
+     */
+    void render(Empty::gl::ShaderProgram &program);
+
+    /**
+     * Shader storage binding point of the instance buffer.
+     */
+    unsigned int binding = 7;
+
+    std::vector<Instance> instances;
+    std::vector<Batch> batches;
+
+private:
+    // Created on first use so that gathering works without a GL context
+    std::unique_ptr<Empty::gl::Buffer> _buffer;
+    // Size in bytes of the buffer's storage
+    size_t _capacity = 0;
+    std::vector<unsigned int> _visible;
+    // Batch of each visible node
+    std::vector<unsigned int> _batchOf;
+};
+
+#endif
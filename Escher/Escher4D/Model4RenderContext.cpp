@@ -5,16 +5,34 @@
 #include <Empty/gl/ShaderProgram.hpp>
 
 #include "Escher4D/Context.h"
+#include "Escher4D/RenderStats.hpp"
 
 Model4RenderContext::Model4RenderContext(Geometry4 &geom, Empty::gl::ShaderProgram &program)
     : RenderContext(program), geometry(geom) { }
 
 void Model4RenderContext::render()
 {
-    Context& context = Context::get();
     geometry.exposeGPU(_program);
+    draw();
+}
+
+void Model4RenderContext::draw()
+{
+    Context& context = Context::get();
     if (geometry.isIndexed())
         context.drawElements(Empty::gl::PrimitiveType::LinesAdjacency, Empty::gl::ElementType::Int, 0, static_cast<int>(geometry.cells.size() * 4));
     else
         context.drawArrays(Empty::gl::PrimitiveType::LinesAdjacency, 0, static_cast<int>(geometry.vertices.size()));
+    RenderStats::get().drawCalls++;
+}
+
+void Model4RenderContext::renderInstanced(Empty::gl::ShaderProgram &program, unsigned int instances)
+{
+    geometry.exposeGPU(program);
+    // Instanced draws go straight to GL, the context having no wrapper for them
+    if (geometry.isIndexed())
+        glDrawElementsInstanced(GL_LINES_ADJACENCY, static_cast<GLsizei>(geometry.cells.size() * 4), GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(instances));
+    else
+        glDrawArraysInstanced(GL_LINES_ADJACENCY, 0, static_cast<GLsizei>(geometry.vertices.size()), static_cast<GLsizei>(instances));
+    RenderStats::get().drawCalls++;
 }
@@ -13,6 +13,15 @@ public:
     Model4RenderContext(Geometry4 &geom, Empty::gl::ShaderProgram &program);
     virtual ~Model4RenderContext() { }
     virtual void render() override;
+    /**
+     * Draws the geometry, assuming its vertex data is already bound.
+     */
+    void draw();
+    /**
+     * Draws several instances of the geometry through a given program, which
+     * is expected to fetch per-instance data by itself.
+     */
+    void renderInstanced(Empty::gl::ShaderProgram &program, unsigned int instances);
     
     Geometry4 &geometry;
 };
@@ -7,13 +7,31 @@
 
 #include "Escher4D/Camera4.hpp"
 #include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/Pool.hpp"
 #include "Escher4D/Transform4.hpp"
 
 /**
  * Represents any object in a 4D space. Used to help chain transforms and create
  * object hierarchies.
+ *
+ * Children are allocated along with their reference count from a shared pool
+ * of fixed-size blocks, so that building and tearing down hierarchies recycles
+ * memory instead of going through the global allocator.
+ *
+ * Copies of an object share their subtrees copy-on-write : a child shared with
+ * another hierarchy is cloned when it is accessed through the non-const
+ * `operator[]`, and only the nodes along that access path get cloned. Tiled
+ * layouts made of many copies of a few rooms therefore only store the rooms
+ * once. Reading through a const reference never clones anything.
+ *
+ * A node cannot tell which of the hierarchies sharing it a reference was taken
+ * from, so every write must go through a chain of non-const `operator[]` taken
+ * after the last copy : references taken before copying a hierarchy refer to
+ * nodes that the copy shares, much like iterators are invalidated. In debug
+ * builds, the transform and hierarchy mutators of this class assert that the
+ * node is not shared ; direct writes to fields such as `color` are not checked.
  */
-struct Object4 : public Transform4
+struct Object4 : public Transform4, public std::enable_shared_from_this<Object4>
 {
     static Object4 scene;
     
@@ -25,6 +43,7 @@ struct Object4 : public Transform4
      */
     Object4 &setRenderContext(Model4RenderContext *rc)
     {
+        assertExclusive();
         _rc = rc;
         return *this;
     }
@@ -38,19 +57,91 @@ struct Object4 : public Transform4
     }
     
     /**
-     * Return references to children object.
+     * Returns a reference to a child object for modification. If the child is
+     * shared with another hierarchy, it is replaced with a copy of its own
+     * first, its children remaining shared.
      */
     Object4 &operator[](unsigned int k)
+    {
+        Object4Ptr &c = _children[k];
+        if(c.use_count() > 1)
+        {
+            c = make(*c);
+            ++_structureVersion;
+        }
+        return *c;
+    }
+    /**
+     * Returns a reference to a child object for reading, without unsharing it.
+     */
+    const Object4 &operator[](unsigned int k) const
     {
         return *_children[k];
     }
     
+    /**
+     * Tells whether a child is shared with another hierarchy.
+     */
+    bool isShared(unsigned int k) const
+    {
+        return _children[k].use_count() > 1;
+    }
+    
+    /// Transform mutators, which check that the node is not shared
+    
+    Object4 &touch()
+    {
+        assertExclusive();
+        Transform4::touch();
+        return *this;
+    }
+    Object4 &scale(const Empty::math::vec4 &factor)
+    {
+        assertExclusive();
+        Transform4::scale(factor);
+        return *this;
+    }
+    Object4 &scale(float factor)
+    {
+        assertExclusive();
+        Transform4::scale(factor);
+        return *this;
+    }
+    Object4 &rotate(Planes4 p, float angle)
+    {
+        assertExclusive();
+        Transform4::rotate(p, angle);
+        return *this;
+    }
+    Object4 &rotate(const Rotor4 &r)
+    {
+        assertExclusive();
+        Transform4::rotate(r);
+        return *this;
+    }
+    Object4 &lookAt(const Empty::math::vec4 &at, const Empty::math::vec4 &up, const Empty::math::vec4 &duth)
+    {
+        assertExclusive();
+        Transform4::lookAt(at, up, duth);
+        return *this;
+    }
+    
+    /**
+     * Returns the amount of children.
+     */
+    unsigned int childCount() const
+    {
+        return static_cast<unsigned int>(_children.size());
+    }
+    
     /**
      * Creates a new object as a child to this object and returns a reference to it.
      */
     Object4 &addChild()
     {
-        _children.push_back(Object4Ptr(new Object4));
+        assertExclusive();
+        _children.push_back(make());
+        ++_structureVersion;
         return *_children.back();
     }
     /**
@@ -58,15 +149,20 @@ struct Object4 : public Transform4
      */
     Object4 &addChild(Object4 *c)
     {
+        assertExclusive();
         _children.push_back(Object4Ptr(c));
+        ++_structureVersion;
         return *_children.back();
     }
     /**
      * Adds the copy of an object as a child to this object and returns a reference to it.
+     * The copy shares the children of the original until either modifies them.
      */
     Object4 &addChild(const Object4 &obj)
     {
-        _children.push_back(Object4Ptr(new Object4(obj)));
+        assertExclusive();
+        _children.push_back(make(obj));
+        ++_structureVersion;
         return *_children.back();
     }
     /**
@@ -74,7 +170,27 @@ struct Object4 : public Transform4
      */
     Object4 &addChild(Model4RenderContext &rc)
     {
-        _children.push_back(Object4Ptr(new Object4(rc)));
+        assertExclusive();
+        _children.push_back(make(rc));
+        ++_structureVersion;
+        return *_children.back();
+    }
+    /**
+     * Adds a deep copy of an object as a child to this object and returns a
+     * reference to it. All the nodes of the copy are laid out in a single
+     * block of memory in depth-first order, which makes walking the subtree
+     * cache friendly. The block is released once every node in it is gone.
+     */
+    Object4 &addSubtree(const Object4 &obj)
+    {
+        assertExclusive();
+        size_t nodes = 0;
+        obj.visit([&nodes](const Object4&) { ++nodes; });
+        // Nodes are allocated along with a control block of unknown size, so the
+        // arena sizes its chunk from the first node
+        auto arena = Arena::forAllocations(nodes);
+        _children.push_back(copySubtree(obj, ArenaAllocator<Object4>(arena)));
+        ++_structureVersion;
         return *_children.back();
     }
     
@@ -83,7 +199,9 @@ struct Object4 : public Transform4
      */
     void removeChild(unsigned int k)
     {
+        assertExclusive();
         _children.erase(_children.begin() + k);
+        ++_structureVersion;
     }
     
     /**
@@ -95,6 +213,24 @@ struct Object4 : public Transform4
         removeChild(k);
         removeChild((args - 1)...);
     }
+    /**
+     * Removes a child using its index in constant time, by moving the last
+     * child in its place. This changes the index of the last child.
+     */
+    void removeChildUnordered(unsigned int k)
+    {
+        assertExclusive();
+        if(k + 1 < _children.size())
+            _children[k] = std::move(_children.back());
+        _children.pop_back();
+        ++_structureVersion;
+    }
+    
+    /**
+     * Returns a counter that changes every time an object is added to or removed
+     * from any hierarchy.
+     */
+    static unsigned int structureVersion() { return _structureVersion; }
     
     /**
      * Executes a function on an object and all its children recursively.
@@ -153,14 +289,52 @@ struct Object4 : public Transform4
     bool insideOut = false;
     
 protected:
+    friend class InstanceBatcher4;
+    friend class RenderQueue4;
+    friend class SceneGraph4;
+    
     Object4() : Transform4() { }
-    Object4(const Object4 &obj) : Transform4(obj.mat, obj.pos)
+    Object4(const Object4 &obj) : Transform4(obj.mat, obj.pos), std::enable_shared_from_this<Object4>()
     {
         _rc = obj._rc;
         _children.assign(obj._children.begin(), obj._children.end());
         color = obj.color;
+        castShadows = obj.castShadows;
+        insideOut = obj.insideOut;
     }
     Object4(Model4RenderContext &rc) : Transform4() { _rc = &rc; }
+    
+    template <typename> friend struct PoolAllocator;
+    template <typename> friend struct ArenaAllocator;
+    
+    /**
+     * Creates an object in the shared node pool.
+     */
+    template <typename ... Args>
+    static Object4Ptr make(Args&& ... args)
+    {
+        return std::allocate_shared<Object4>(PoolAllocator<Object4>(), std::forward<Args>(args)...);
+    }
+    /**
+     * Deep copies a hierarchy using a given allocator for every node.
+     */
+    template <typename Alloc>
+    static Object4Ptr copySubtree(const Object4 &obj, const Alloc &alloc)
+    {
+        Object4Ptr copy = std::allocate_shared<Object4>(alloc, obj);
+        copy->_children.clear();
+        for(const Object4Ptr &c : obj._children)
+            copy->_children.push_back(copySubtree(*c, alloc));
+        return copy;
+    }
+    
+    // Writing to a node shared by several hierarchies would modify all of
+    // them ; the static scene is not owned by any
+    void assertExclusive() const
+    {
+        assert(weak_from_this().use_count() <= 1 && "shared Object4 written through a stale reference");
+    }
+    
     void render(const Transform4 &vt)
     {
         Transform4 mv = chain(vt);
@@ -168,8 +342,7 @@ protected:
         if(_rc)
         {
             _rc->_program.uniform("MV", mv.mat);
-            Empty::math::mat4 tinvmv = Empty::math::transpose(Empty::math::inverse(mv.mat));
-            _rc->_program.uniform("tinvMV", tinvmv);
+            _rc->_program.uniform("tinvMV", mv.normalMatrix());
             _rc->_program.uniform("MVt", mv.pos);
             _rc->_program.uniform("uColor", color);
             _rc->_program.uniform("uInsideOut", (int)insideOut);
@@ -182,6 +355,8 @@ protected:
     }
     Model4RenderContext *_rc = nullptr;
     std::vector<Object4Ptr> _children;
+    
+    inline static unsigned int _structureVersion = 0;
 };
 
 #endif
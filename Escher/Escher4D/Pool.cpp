@@ -0,0 +1,95 @@
+#include "Pool.hpp"
+
+#include <algorithm>
+
+SlabPool::SlabPool(size_t blockSize, size_t alignment, size_t blocksPerSlab)
+    : _blockSize(blockSize), _alignment(std::max(alignment, alignof(Slot))), _blocksPerSlab(blocksPerSlab)
+{
+    // The header is padded so that the block that follows it keeps its alignment
+    _headerSize = (sizeof(Slot) + _alignment - 1) / _alignment * _alignment;
+    _stride = (_headerSize + _blockSize + _alignment - 1) / _alignment * _alignment;
+}
+
+void SlabPool::grow()
+{
+    // Over-allocate to align the first slot by hand
+    const uint32_t first = static_cast<uint32_t>(capacity());
+    _slabs.emplace_back(new unsigned char[_blocksPerSlab * _stride + _alignment]);
+    uintptr_t raw = reinterpret_cast<uintptr_t>(_slabs.back().get());
+    _bases.push_back(reinterpret_cast<unsigned char*>((raw + _alignment - 1) / _alignment * _alignment));
+
+    // Free blocks are popped from the back, so push them in reverse to hand out
+    // increasing addresses
+    for(uint32_t k = static_cast<uint32_t>(_blocksPerSlab); k-- > 0;)
+    {
+        Slot *s = slot(first + k);
+        s->index = first + k;
+        s->generation = 0;
+        s->live = false;
+        _free.push_back(first + k);
+    }
+}
+
+void *SlabPool::allocate(Handle *handle)
+{
+    if(_free.empty())
+        grow();
+    Slot *s = slot(_free.back());
+    _free.pop_back();
+    s->live = true;
+    ++_live;
+    if(handle)
+    {
+        handle->index = s->index;
+        handle->generation = s->generation;
+    }
+    return reinterpret_cast<unsigned char*>(s) + _headerSize;
+}
+
+void SlabPool::free(void *p)
+{
+    if(!p)
+        return;
+    Slot *s = slotOf(p);
+    s->live = false;
+    ++s->generation;
+    --_live;
+    _free.push_back(s->index);
+}
+
+void *SlabPool::get(Handle h) const
+{
+    if(h.index >= capacity())
+        return nullptr;
+    Slot *s = slot(h.index);
+    if(!s->live || s->generation != h.generation)
+        return nullptr;
+    return reinterpret_cast<unsigned char*>(s) + _headerSize;
+}
+
+SlabPool::Handle SlabPool::handle(const void *p) const
+{
+    const Slot *s = slotOf(p);
+    Handle h;
+    h.index = s->index;
+    h.generation = s->generation;
+    return h;
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    uintptr_t base = _chunks.empty() ? 0 : reinterpret_cast<uintptr_t>(_chunks.back().get());
+    size_t offset = (base + _used + alignment - 1) / alignment * alignment - base;
+    if(_chunks.empty() || offset + size > _capacity)
+    {
+        // Allocations of a single type follow each other without padding
+        if(_chunks.empty() && _chunkAllocations)
+            _chunkSize = _chunkAllocations * ((size + alignment - 1) / alignment * alignment) + alignment;
+        _capacity = std::max(_chunkSize, size + alignment);
+        _chunks.emplace_back(new unsigned char[_capacity]);
+        base = reinterpret_cast<uintptr_t>(_chunks.back().get());
+        offset = (base + alignment - 1) / alignment * alignment - base;
+    }
+    _used = offset + size;
+    return reinterpret_cast<void*>(base + offset);
+}
@@ -0,0 +1,294 @@
+#ifndef INC_POOL
+#define INC_POOL
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocator of fixed-size blocks carved out of large slabs. Freed blocks go to a
+ * free list and are handed out again before any new slab is allocated, and
+ * blocks never move, so pointers to them remain valid until they are freed.
+ *
+ * Blocks can also be referred to by handles, made of the block's index and of a
+ * generation counter bumped every time the block is freed, so that stale handles
+ * are detected instead of aliasing a reused block.
+ *
+ * Pools are not thread-safe.
+ */
+class SlabPool
+{
+public:
+    struct Handle
+    {
+        uint32_t index = ~0u;
+        uint32_t generation = 0;
+
+        bool operator==(const Handle &h) const { return index == h.index && generation == h.generation; }
+        bool operator!=(const Handle &h) const { return !(*this == h); }
+    };
+
+    /**
+     * @param   blockSize       size of the blocks in bytes
+     * @param   alignment       alignment of the blocks
+     * @param   blocksPerSlab   amount of blocks allocated at once when the pool runs out
+     */
+    SlabPool(size_t blockSize, size_t alignment = alignof(std::max_align_t), size_t blocksPerSlab = 1024);
+    SlabPool(const SlabPool&) = delete;
+    SlabPool &operator=(const SlabPool&) = delete;
+
+    /**
+     * Returns an uninitialized block.
+     * @param   handle  optionally receives the handle of the block
+     */
+    void *allocate(Handle *handle = nullptr);
+    /**
+     * Returns a block to the pool.
+     */
+    void free(void *p);
+    /**
+     * Returns a block given its handle, or `nullptr` if it was freed since.
+     */
+    void *get(Handle h) const;
+    /**
+     * Returns the handle of an allocated block.
+     */
+    Handle handle(const void *p) const;
+
+    /**
+     * Amount of blocks currently allocated.
+     */
+    size_t size() const { return _live; }
+    /**
+     * Amount of blocks the slabs can hold.
+     */
+    size_t capacity() const { return _slabs.size() * _blocksPerSlab; }
+    size_t blockSize() const { return _blockSize; }
+
+    /**
+     * Returns a process-wide pool of blocks of a given size and alignment. It is
+     * never destroyed, so that objects with static storage duration can still
+     * release their blocks at exit.
+     */
+    template <size_t Size, size_t Alignment>
+    static SlabPool &shared()
+    {
+        static SlabPool *pool = new SlabPool(Size, Alignment);
+        return *pool;
+    }
+
+private:
+    // Header stored in front of each block
+    struct Slot
+    {
+        uint32_t index;
+        uint32_t generation;
+        bool live;
+    };
+
+    Slot *slot(uint32_t index) const
+    {
+        return reinterpret_cast<Slot*>(_bases[index / _blocksPerSlab] + (index % _blocksPerSlab) * _stride);
+    }
+    Slot *slotOf(const void *p) const
+    {
+        return reinterpret_cast<Slot*>(const_cast<unsigned char*>(static_cast<const unsigned char*>(p)) - _headerSize);
+    }
+    void grow();
+
+    size_t _blockSize, _alignment, _blocksPerSlab, _headerSize, _stride;
+    size_t _live = 0;
+    std::vector<std::unique_ptr<unsigned char[]>> _slabs;
+    // First slot of each slab, aligned
+    std::vector<unsigned char*> _bases;
+    // Indices of the free blocks, the most recently freed last
+    std::vector<uint32_t> _free;
+};
+
+/**
+ * Standard allocator serving single objects from a shared `SlabPool`, meant for
+ * node-based containers and `std::allocate_shared`. Arrays fall back to the
+ * global allocator.
+ */
+template <typename T>
+struct PoolAllocator
+{
+    typedef T value_type;
+
+    PoolAllocator() { }
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) { }
+
+    T *allocate(size_t n)
+    {
+        if(n == 1)
+            return static_cast<T*>(SlabPool::shared<sizeof(T), alignof(T)>().allocate());
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n)
+    {
+        if(n == 1)
+            SlabPool::shared<sizeof(T), alignof(T)>().free(p);
+        else
+            ::operator delete(p);
+    }
+
+    // Constructs objects from within the allocator, so that classes with
+    // restricted constructors can befriend it
+    template <typename U, typename ... Args>
+    void construct(U *p, Args&& ... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+    template <typename U>
+    void destroy(U *p)
+    {
+        p->~U();
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+/**
+ * Monotonic allocator handing out consecutive memory from large chunks. Memory
+ * is only released when the arena is destroyed.
+ */
+class Arena
+{
+public:
+    /**
+     * @param   chunkSize   size in bytes of the first chunk ; further chunks
+     *                      are as large as needed
+     */
+    Arena(size_t chunkSize) : _chunkSize(chunkSize) { }
+    Arena(const Arena&) = delete;
+    Arena &operator=(const Arena&) = delete;
+
+    /**
+     * Creates an arena whose first chunk holds exactly a given amount of
+     * allocations as large as the first one, for objects of a single type whose
+     * actual allocation size is not known up front, such as those made with
+     * `std::allocate_shared`.
+     */
+    static std::shared_ptr<Arena> forAllocations(size_t count)
+    {
+        auto arena = std::make_shared<Arena>(0);
+        arena->_chunkAllocations = count;
+        return arena;
+    }
+
+    void *allocate(size_t size, size_t alignment);
+
+private:
+    size_t _chunkSize;
+    // Allocations the first chunk is sized for, 0 to use `_chunkSize`
+    size_t _chunkAllocations = 0;
+    size_t _used = 0, _capacity = 0;
+    std::vector<std::unique_ptr<unsigned char[]>> _chunks;
+};
+
+/**
+ * Standard allocator serving objects from a shared arena. Each allocator holds
+ * a reference to the arena, which therefore lives as long as the objects it
+ * allocated, eg as long as the `std::shared_ptr`s made with `std::allocate_shared`
+ * and this allocator.
+ */
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    ArenaAllocator(std::shared_ptr<Arena> arena) : arena(std::move(arena)) { }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &a) : arena(a.arena) { }
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) { }
+
+    template <typename U, typename ... Args>
+    void construct(U *p, Args&& ... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+    template <typename U>
+    void destroy(U *p)
+    {
+        p->~U();
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &a) const { return arena == a.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &a) const { return arena != a.arena; }
+
+    std::shared_ptr<Arena> arena;
+};
+
+/**
+ * Pool of objects of a given type referred to by handles.
+ */
+template <typename T>
+class Pool
+{
+public:
+    typedef SlabPool::Handle Handle;
+
+    Pool(size_t blocksPerSlab = 1024) : _pool(sizeof(T), alignof(T), blocksPerSlab) { }
+    ~Pool()
+    {
+        for(T *p : _objects)
+            if(p)
+                p->~T();
+    }
+
+    /**
+     * Constructs an object in the pool and returns its handle.
+     */
+    template <typename ... Args>
+    Handle create(Args&& ... args)
+    {
+        Handle h;
+        T *p = ::new(_pool.allocate(&h)) T(std::forward<Args>(args)...);
+        if(h.index >= _objects.size())
+            _objects.resize(h.index + 1, nullptr);
+        _objects[h.index] = p;
+        return h;
+    }
+    /**
+     * Destroys an object. Does nothing if the handle is stale.
+     */
+    void destroy(Handle h)
+    {
+        T *p = get(h);
+        if(!p)
+            return;
+        p->~T();
+        _objects[h.index] = nullptr;
+        _pool.free(p);
+    }
+    /**
+     * Returns an object given its handle, or `nullptr` if it was destroyed.
+     */
+    T *get(Handle h) const
+    {
+        return static_cast<T*>(_pool.get(h));
+    }
+
+    size_t size() const { return _pool.size(); }
+
+private:
+    SlabPool _pool;
+    // Live object of each block, to destroy them along with the pool
+    std::vector<T*> _objects;
+};
+
+#endif
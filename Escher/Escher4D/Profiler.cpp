@@ -0,0 +1,268 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include <imgui.h>
+
+#include "Escher4D/utils.hpp"
+
+namespace
+{
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // Stable color for a zone name
+    ImU32 zoneColor(const char *name)
+    {
+        uint32_t h = 2166136261u;
+        for(const char *c = name; *c; ++c)
+            h = (h ^ static_cast<unsigned char>(*c)) * 16777619u;
+        return IM_COL32(96 + (h & 0x7f), 96 + ((h >> 8) & 0x7f), 96 + ((h >> 16) & 0x7f), 255);
+    }
+}
+
+Profiler &Profiler::get()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+uint64_t Profiler::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count());
+}
+
+Profiler::Buffer &Profiler::threadBuffer()
+{
+    // Gives the buffer back when the thread exits
+    struct Owner
+    {
+        Buffer *buffer = nullptr;
+        ~Owner()
+        {
+            if(buffer)
+                Profiler::get().release(buffer);
+        }
+    };
+    thread_local Owner owner;
+    if(owner.buffer)
+        return *owner.buffer;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(std::unique_ptr<Buffer> &b : _buffers)
+        if(!b->owned)
+        {
+            // Keep the id, which tracks index buffers by, but drop the zones of
+            // the previous thread so that they do not show under the new one
+            b->owned = true;
+            b->depth = 0;
+            b->head.store(0, std::memory_order_relaxed);
+            b->name = "thread " + std::to_string(b->id);
+            owner.buffer = b.get();
+            return *b;
+        }
+    _buffers.push_back(std::make_unique<Buffer>());
+    Buffer &b = *_buffers.back();
+    b.id = _nextId++;
+    b.name = "thread " + std::to_string(b.id);
+    owner.buffer = &b;
+    return b;
+}
+
+void Profiler::release(Buffer *buffer)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    buffer->owned = false;
+}
+
+void Profiler::setThreadName(const std::string &name)
+{
+    Buffer &b = threadBuffer();
+    std::lock_guard<std::mutex> lock(_mutex);
+    b.name = name;
+}
+
+uint32_t Profiler::createTrack(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers.push_back(std::make_unique<Buffer>());
+    Buffer &b = *_buffers.back();
+    b.id = _nextId++;
+    b.name = name;
+    return b.id;
+}
+
+void Profiler::record(uint32_t track, const Event &e)
+{
+    // Ids follow the order of creation, and buffers are never removed
+    Buffer *b;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        b = _buffers[track - 1].get();
+    }
+    b->write(e);
+}
+
+void Profiler::markFrame()
+{
+    uint64_t h = _frameHead.load(std::memory_order_relaxed);
+    _frames[h % frameHistory].store(now(), std::memory_order_relaxed);
+    _frameHead.store(h + 1, std::memory_order_release);
+}
+
+std::vector<uint64_t> Profiler::frames() const
+{
+    const uint64_t h = _frameHead.load(std::memory_order_acquire), first = h > frameHistory ? h - frameHistory : 0;
+    std::vector<uint64_t> starts;
+    for(uint64_t k = first; k < h; ++k)
+        starts.push_back(_frames[k % frameHistory].load(std::memory_order_relaxed));
+    return starts;
+}
+
+std::vector<Profiler::Thread> Profiler::collect() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Thread> threads;
+    for(const std::unique_ptr<Buffer> &b : _buffers)
+    {
+        Thread t;
+        t.name = b->name;
+        t.id = b->id;
+        const uint64_t h = b->head.load(std::memory_order_acquire), first = h > bufferSize ? h - bufferSize : 0;
+        t.events.reserve(static_cast<size_t>(h - first));
+        for(uint64_t k = first; k < h; ++k)
+            t.events.push_back(b->events[k % bufferSize]);
+        // Events the owner wrote over while we were copying are garbage, and so
+        // may be the one it was writing, at index `after`, before publishing it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t after = b->head.load(std::memory_order_relaxed);
+        if(after + 1 > first + bufferSize)
+            t.events.erase(t.events.begin(), t.events.begin() + static_cast<ptrdiff_t>(
+                std::min<uint64_t>(after + 1 - bufferSize - first, t.events.size())));
+        if(!t.events.empty())
+            threads.push_back(std::move(t));
+    }
+    return threads;
+}
+
+bool Profiler::writeChromeTrace(const std::string &path) const
+{
+    std::ofstream out(path);
+    if(!out)
+        return false;
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool first = true;
+    auto separate = [&]() -> std::ostream&
+    {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        return out;
+    };
+    char number[32];
+    // Timestamps are in microseconds
+    auto us = [&](uint64_t ns) -> const char*
+    {
+        std::snprintf(number, sizeof(number), "%.3f", ns / 1000.);
+        return number;
+    };
+    for(const Thread &t : collect())
+    {
+        separate() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t.id
+            << ", \"args\": {\"name\": \"";
+        writeJSONEscaped(out, t.name.c_str());
+        out << "\"}}";
+        for(const Event &e : t.events)
+        {
+            separate() << "{\"name\": \"";
+            writeJSONEscaped(out, e.name);
+            out << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t.id << ", \"ts\": " << us(e.start);
+            out << ", \"dur\": " << us(e.end - e.start) << "}";
+        }
+    }
+    for(uint64_t start : frames())
+        separate() << "{\"name\": \"frame\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 0, \"ts\": " << us(start) << "}";
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void Profiler::drawWindow()
+{
+    if(!ImGui::Begin("Profiler"))
+    {
+        ImGui::End();
+        return;
+    }
+
+    bool on = enabled;
+    if(ImGui::Checkbox("Record", &on))
+        enabled = on;
+    ImGui::SameLine();
+    ImGui::Checkbox("Pause", &_paused);
+    ImGui::SameLine();
+    if(ImGui::Button("Export"))
+        writeChromeTrace(_tracePath);
+    ImGui::SameLine();
+    ImGui::InputText("##trace", _tracePath, sizeof(_tracePath));
+
+    // Recent complete frame
+    if(!_paused)
+    {
+        std::vector<uint64_t> starts = frames();
+        if(starts.size() >= 2)
+        {
+            const size_t end = starts.size() - 1 - std::min(viewDelay, starts.size() - 2);
+            _shownStart = starts[end - 1];
+            _shownEnd = starts[end];
+            _shown = collect();
+            for(Thread &t : _shown)
+                t.events.erase(std::remove_if(t.events.begin(), t.events.end(), [this](const Event &e)
+                {
+                    return e.end < _shownStart || e.start > _shownEnd;
+                }), t.events.end());
+            _shown.erase(std::remove_if(_shown.begin(), _shown.end(), [](const Thread &t) { return t.events.empty(); }),
+                _shown.end());
+        }
+    }
+    if(_shownEnd <= _shownStart)
+    {
+        ImGui::Text("Waiting for frames");
+        ImGui::End();
+        return;
+    }
+    const double frameNs = static_cast<double>(_shownEnd - _shownStart);
+    ImGui::Text("Frame : %.3f ms", frameNs * 1e-6);
+
+    ImDrawList *draw = ImGui::GetWindowDrawList();
+    const float rowHeight = ImGui::GetTextLineHeightWithSpacing(), width = std::max(ImGui::GetContentRegionAvail().x, 100.f);
+    for(const Thread &t : _shown)
+    {
+        ImGui::Text("%s", t.name.c_str());
+        uint32_t depth = 0;
+        for(const Event &e : t.events)
+            depth = std::max(depth, e.depth + 1);
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        draw->PushClipRect(origin, ImVec2(origin.x + width, origin.y + depth * rowHeight), true);
+        for(const Event &e : t.events)
+        {
+            const float x0 = origin.x + static_cast<float>((static_cast<double>(e.start) - _shownStart) / frameNs * width),
+                x1 = origin.x + static_cast<float>((static_cast<double>(e.end) - _shownStart) / frameNs * width),
+                y0 = origin.y + e.depth * rowHeight;
+            const ImVec2 min(x0, y0), max(std::max(x1, x0 + 1), y0 + rowHeight - 1);
+            draw->AddRectFilled(min, max, zoneColor(e.name));
+            if(x1 - x0 > 20)
+            {
+                draw->PushClipRect(min, max, true);
+                draw->AddText(ImVec2(x0 + 2, y0), IM_COL32(0, 0, 0, 255), e.name);
+                draw->PopClipRect();
+            }
+            if(ImGui::IsMouseHoveringRect(min, max))
+                ImGui::SetTooltip("%s : %.3f ms", e.name, (e.end - e.start) * 1e-6);
+        }
+        draw->PopClipRect();
+        ImGui::Dummy(ImVec2(width, depth * rowHeight));
+    }
+    ImGui::End();
+}
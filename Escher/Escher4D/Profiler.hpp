@@ -0,0 +1,210 @@
+#ifndef INC_PROFILER
+#define INC_PROFILER
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Low-overhead CPU instrumentation. Scoped zones, see `PROFILE_ZONE`, record
+ * their name, start and end in nanoseconds into a ring buffer owned by the
+ * calling thread : recording takes no lock and allocates nothing once the
+ * thread has a buffer. Buffers keep the latest `bufferSize` zones of their
+ * thread and can be read from any thread at any time ; zones overwritten while
+ * being read are dropped.
+ *
+ * Zones only measure the CPU side : for GL calls, that is the time taken to
+ * submit commands, not to execute them.
+ *
+ * The main thread calls `markFrame` once per frame. `drawWindow` then shows
+ * the zones of a recent frame as a flame graph, and
+ * `writeChromeTrace` exports everything recorded for chrome://tracing or
+ * Perfetto.
+ */
+class Profiler
+{
+public:
+    /**
+     * Zones kept per thread.
+     */
+    static const size_t bufferSize = 1 << 14;
+    /**
+     * Frame starts kept.
+     */
+    static const size_t frameHistory = 256;
+    /**
+     * Frames between the last complete one and the one shown by `drawWindow`.
+     */
+    static constexpr size_t viewDelay = 4;
+
+    struct Event
+    {
+        // Static string
+        const char *name;
+        uint64_t start, end;
+        // Amount of zones enclosing this one
+        uint32_t depth;
+    };
+
+    struct Thread
+    {
+        std::string name;
+        uint32_t id;
+        /**
+         * Zones sorted by end time.
+         */
+        std::vector<Event> events;
+    };
+
+    static Profiler &get();
+
+    /**
+     * Nanoseconds since the profiler was created.
+     */
+    static uint64_t now();
+
+    /**
+     * Names the calling thread in views and traces.
+     */
+    void setThreadName(const std::string &name);
+
+    /**
+     * Creates a timeline for work that does not run on a CPU thread, such as
+     * GPU passes, shown and exported like the threads.
+     * @return  identifier of the track
+     */
+    uint32_t createTrack(const std::string &name);
+    /**
+     * Records an event on a track, with timestamps on the profiler's clock.
+     * Only one thread at a time may write to a given track.
+     */
+    void record(uint32_t track, const Event &e);
+
+    /**
+     * Marks the start of a frame.
+     */
+    void markFrame();
+
+    /**
+     * Starts of the latest frames, oldest first.
+     */
+    std::vector<uint64_t> frames() const;
+
+    /**
+     * Copies the zones currently held by every thread.
+     */
+    std::vector<Thread> collect() const;
+
+    /**
+     * Writes the zones currently held to a file in Chrome's trace event format.
+     * @return  whether or not the operation succeeded
+     */
+    bool writeChromeTrace(const std::string &path) const;
+
+    /**
+     * Draws an ImGui window with the flame graph of a recent frame. The frame
+     * shown lags `viewDelay` frames behind, so that tracks fed late such as GPU
+     * timings are complete.
+     */
+    void drawWindow();
+
+    /**
+     * Whether zones opened from now on are recorded.
+     */
+    std::atomic<bool> enabled{true};
+
+private:
+    friend class ProfileZone;
+
+    struct Buffer
+    {
+        std::string name;
+        uint32_t id = 0;
+        // Amount of events ever written ; the last bufferSize of them are kept
+        std::atomic<uint64_t> head{0};
+        // Zones currently open on the thread
+        uint32_t depth = 0;
+        // Whether a running thread or a track owns the buffer, otherwise it can
+        // be reused
+        bool owned = true;
+        Event events[bufferSize];
+
+        void write(const Event &e)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            events[h % bufferSize] = e;
+            head.store(h + 1, std::memory_order_release);
+        }
+    };
+
+    Profiler() = default;
+
+    // Buffer of the calling thread, created or recycled on first use
+    Buffer &threadBuffer();
+    // Hands a buffer back when its thread exits
+    void release(Buffer *buffer);
+
+    // Only guards the list of buffers and their names, not recording
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<Buffer>> _buffers;
+    uint32_t _nextId = 1;
+
+    std::atomic<uint64_t> _frameHead{0};
+    std::atomic<uint64_t> _frames[frameHistory] = {};
+
+    // Flame graph state
+    bool _paused = false;
+    std::vector<Thread> _shown;
+    uint64_t _shownStart = 0, _shownEnd = 0;
+    char _tracePath[256] = "trace.json";
+};
+
+/**
+ * Records the time between its construction and its destruction as a zone of
+ * the calling thread.
+ */
+class ProfileZone
+{
+public:
+    /**
+     * @param   name    static string naming the zone
+     */
+    explicit ProfileZone(const char *name) : _name(name)
+    {
+        Profiler &profiler = Profiler::get();
+        if(!profiler.enabled.load(std::memory_order_relaxed))
+            return;
+        _buffer = &profiler.threadBuffer();
+        _depth = _buffer->depth++;
+        _start = Profiler::now();
+    }
+
+    ~ProfileZone()
+    {
+        if(!_buffer)
+            return;
+        _buffer->write({ _name, _start, Profiler::now(), _depth });
+        _buffer->depth--;
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone &operator=(const ProfileZone&) = delete;
+
+private:
+    const char *_name;
+    Profiler::Buffer *_buffer = nullptr;
+    uint64_t _start = 0;
+    uint32_t _depth = 0;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+/**
+ * Profiles the rest of the enclosing scope under a given static name.
+ */
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(_profileZone, __LINE__)(name)
+
+#endif
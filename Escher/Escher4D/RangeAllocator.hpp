@@ -0,0 +1,111 @@
+#ifndef INC_RANGE_ALLOCATOR
+#define INC_RANGE_ALLOCATOR
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+
+/**
+ * Sub-allocator of ranges within an array of a given capacity, eg a GPU
+ * buffer. Free ranges are kept sorted by offset and merged with their
+ * neighbours when released, and allocation takes the first free range that
+ * fits.
+ */
+class RangeAllocator
+{
+public:
+    static constexpr size_t npos = ~size_t(0);
+
+    RangeAllocator(size_t capacity = 0) { reset(capacity); }
+
+    /**
+     * Frees everything and changes the capacity.
+     */
+    void reset(size_t capacity)
+    {
+        _free.clear();
+        _capacity = capacity;
+        _used = 0;
+        if(capacity)
+            _free.emplace(0, capacity);
+    }
+
+    /**
+     * Raises the capacity, the new space being free.
+     */
+    void grow(size_t capacity)
+    {
+        if(capacity > _capacity)
+        {
+            // Released right away, so count it as used first
+            _used += capacity - _capacity;
+            release(_capacity, capacity - _capacity);
+            _capacity = capacity;
+        }
+    }
+
+    /**
+     * Reserves a range of a given size.
+     * @return  offset of the range, or `npos` if no free range is large enough
+     */
+    size_t allocate(size_t size)
+    {
+        if(!size)
+            return 0;
+        for(auto it = _free.begin(); it != _free.end(); ++it)
+            if(it->second >= size)
+            {
+                size_t offset = it->first, left = it->second - size;
+                _free.erase(it);
+                if(left)
+                    _free.emplace(offset + size, left);
+                _used += size;
+                return offset;
+            }
+        return npos;
+    }
+
+    /**
+     * Frees a range returned by `allocate`.
+     */
+    void release(size_t offset, size_t size)
+    {
+        if(!size)
+            return;
+        _used -= size;
+        auto next = _free.lower_bound(offset);
+        if(next != _free.begin())
+        {
+            auto prev = std::prev(next);
+            if(prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                size += prev->second;
+                _free.erase(prev);
+            }
+        }
+        if(next != _free.end() && offset + size == next->first)
+        {
+            size += next->second;
+            _free.erase(next);
+        }
+        _free.emplace(offset, size);
+    }
+
+    size_t capacity() const { return _capacity; }
+    /**
+     * Amount of allocated elements.
+     */
+    size_t used() const { return _used; }
+    /**
+     * Amount of separate free ranges.
+     */
+    size_t holes() const { return _free.size(); }
+
+private:
+    size_t _capacity = 0, _used = 0;
+    // Size of each free range, by offset
+    std::map<size_t, size_t> _free;
+};
+
+#endif
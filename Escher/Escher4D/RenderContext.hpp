@@ -10,6 +10,8 @@ public:
     virtual void render() = 0;
 protected:
     friend struct Object4;
+    friend class RenderQueue4;
+    friend class SceneGraph4;
     Empty::gl::ShaderProgram &_program;
 };
 
@@ -0,0 +1,171 @@
+#include "RenderQueue4.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "Escher4D/Context.h"
+#include "Escher4D/Profiler.hpp"
+
+void GLRenderBackend4::setProgram(Empty::gl::ShaderProgram &program)
+{
+    _program = &program;
+    Context::get().setShaderProgram(program);
+}
+
+void GLRenderBackend4::setGeometry(Model4RenderContext &rc)
+{
+    rc.geometry.exposeGPU(*_program);
+}
+
+void GLRenderBackend4::setTransform(const Empty::math::mat4 &mv, const Empty::math::mat4 &tinvMV, const Empty::math::vec4 &mvt)
+{
+    _program->uniform("MV", mv);
+    _program->uniform("tinvMV", tinvMV);
+    _program->uniform("MVt", mvt);
+}
+
+void GLRenderBackend4::setColor(const Empty::math::vec4 &color)
+{
+    _program->uniform("uColor", color);
+}
+
+void GLRenderBackend4::setInsideOut(bool insideOut)
+{
+    _program->uniform("uInsideOut", (int)insideOut);
+}
+
+void GLRenderBackend4::draw(Model4RenderContext &rc)
+{
+    rc.draw();
+}
+
+void RenderQueue4::gather(SceneGraph4 &graph, const Transform4 &vt, const Empty::math::mat4 &p)
+{
+    PROFILE_ZONE("Queue gather");
+    graph.collectVisible(vt, p, _visible);
+    const Empty::math::mat4 tinvv = vt.normalMatrix();
+
+    packets.resize(_visible.size());
+    draws.resize(_visible.size());
+    for(size_t i = 0; i < _visible.size(); ++i)
+    {
+        unsigned int k = _visible[i];
+        const Object4 &obj = *graph.objects[k];
+        Draw &d = draws[i];
+        d.rc = obj._rc;
+        Transform4 mv = Transform4(graph.worldMats[k], graph.worldPos[k]).chain(vt);
+        d.mv = mv.mat;
+        d.tinvMV = graph.viewNormalMatrix(k, tinvv);
+        d.mvt = mv.pos;
+        d.color = obj.color;
+        d.insideOut = obj.insideOut;
+
+        // Distance from the eye to the slice of the object's bounds
+        Empty::math::vec4 c = vt.apply(graph.worldBounds[k].center);
+        float depth = std::sqrt(c.x * c.x + c.y * c.y + c.z * c.z);
+
+        uint64_t program = slot(_programSlots, &d.rc->_program) & ((1u << ProgramBits) - 1),
+            context = slot(_contextSlots, d.rc) & ((1u << ContextBits) - 1);
+        packets[i].key = program << (ContextBits + DepthBits) | context << DepthBits | depthBits(depth);
+        packets[i].payload = static_cast<uint32_t>(i);
+    }
+}
+
+void RenderQueue4::sort()
+{
+    PROFILE_ZONE("Queue sort");
+    radixSort(packets, _scratch);
+}
+
+void RenderQueue4::submit(RenderBackend4 &backend)
+{
+    PROFILE_ZONE("Queue submit");
+    stats = Stats();
+    const Empty::gl::ShaderProgram *program = nullptr;
+    const Model4RenderContext *rc = nullptr;
+    Empty::math::vec4 color = Empty::math::vec4::zero;
+    bool insideOut = false;
+    for(const Packet &packet : packets)
+    {
+        const Draw &d = draws[packet.payload];
+        // Uniforms belong to the program, so a new program invalidates them all
+        bool newProgram = &d.rc->_program != program;
+        if(newProgram)
+        {
+            program = &d.rc->_program;
+            backend.setProgram(d.rc->_program);
+            stats.programs++;
+            rc = nullptr;
+        }
+        if(d.rc != rc)
+        {
+            rc = d.rc;
+            backend.setGeometry(*d.rc);
+            stats.geometries++;
+        }
+        backend.setTransform(d.mv, d.tinvMV, d.mvt);
+        if(newProgram || d.color.x != color.x || d.color.y != color.y || d.color.z != color.z || d.color.w != color.w)
+        {
+            color = d.color;
+            backend.setColor(color);
+            stats.colors++;
+        }
+        if(newProgram || d.insideOut != insideOut)
+        {
+            insideOut = d.insideOut;
+            backend.setInsideOut(insideOut);
+            stats.insideOuts++;
+        }
+        backend.draw(*d.rc);
+        stats.draws++;
+    }
+}
+
+void RenderQueue4::radixSort(std::vector<Packet> &packets, std::vector<Packet> &scratch)
+{
+    if(packets.size() < 2)
+        return;
+
+    // Bits that differ between keys ; digits outside of them need no pass
+    uint64_t differing = 0;
+    for(const Packet &p : packets)
+        differing |= p.key ^ packets[0].key;
+
+    const int DigitBits = 11;
+    const uint64_t mask = (1u << DigitBits) - 1;
+    std::vector<size_t> offsets(size_t(1) << DigitBits);
+    scratch.resize(packets.size());
+    std::vector<Packet> *src = &packets, *dst = &scratch;
+    for(int shift = 0; shift < 64; shift += DigitBits)
+    {
+        if(!((differing >> shift) & mask))
+            continue;
+
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for(const Packet &p : *src)
+            offsets[(p.key >> shift) & mask]++;
+        size_t sum = 0;
+        for(size_t &o : offsets)
+        {
+            size_t count = o;
+            o = sum;
+            sum += count;
+        }
+        Packet *out = dst->data();
+        for(const Packet &p : *src)
+            out[offsets[(p.key >> shift) & mask]++] = p;
+        std::swap(src, dst);
+    }
+    if(src != &packets)
+        packets.swap(scratch);
+}
+
+uint32_t RenderQueue4::depthBits(float depth)
+{
+    // The bit patterns of non-negative IEEE 754 floats are in the same order as the floats
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return depth > 0 ? bits : 0;
+}
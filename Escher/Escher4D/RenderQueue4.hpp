@@ -0,0 +1,178 @@
+#ifndef INC_RENDER_QUEUE4
+#define INC_RENDER_QUEUE4
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Empty/gl/ShaderProgram.hpp>
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Receives the state changes and draws submitted by a `RenderQueue4`.
+ */
+class RenderBackend4
+{
+public:
+    virtual ~RenderBackend4() { }
+
+    virtual void setProgram(Empty::gl::ShaderProgram &program) = 0;
+    /**
+     * Binds the vertex data of a render context for the current program.
+     */
+    virtual void setGeometry(Model4RenderContext &rc) = 0;
+    virtual void setTransform(const Empty::math::mat4 &mv, const Empty::math::mat4 &tinvMV, const Empty::math::vec4 &mvt) = 0;
+    virtual void setColor(const Empty::math::vec4 &color) = 0;
+    virtual void setInsideOut(bool insideOut) = 0;
+    /**
+     * Draws the geometry bound last.
+     */
+    virtual void draw(Model4RenderContext &rc) = 0;
+};
+
+/**
+ * Backend issuing the commands to the current GL context.
+ */
+class GLRenderBackend4 : public RenderBackend4
+{
+public:
+    void setProgram(Empty::gl::ShaderProgram &program) override;
+    void setGeometry(Model4RenderContext &rc) override;
+    void setTransform(const Empty::math::mat4 &mv, const Empty::math::mat4 &tinvMV, const Empty::math::vec4 &mvt) override;
+    void setColor(const Empty::math::vec4 &color) override;
+    void setInsideOut(bool insideOut) override;
+    void draw(Model4RenderContext &rc) override;
+
+private:
+    Empty::gl::ShaderProgram *_program = nullptr;
+};
+
+/**
+ * Backend storing the commands it receives, to inspect what a queue submits
+ * without a GL context.
+ */
+class RecordingRenderBackend4 : public RenderBackend4
+{
+public:
+    enum class CommandType
+    {
+        Program,
+        Geometry,
+        Transform,
+        Color,
+        InsideOut,
+        Draw
+    };
+
+    struct Command
+    {
+        CommandType type;
+        const void *object;
+        Empty::math::vec4 value;
+    };
+
+    void setProgram(Empty::gl::ShaderProgram &program) override { commands.push_back({ CommandType::Program, &program, Empty::math::vec4::zero }); }
+    void setGeometry(Model4RenderContext &rc) override { commands.push_back({ CommandType::Geometry, &rc, Empty::math::vec4::zero }); }
+    void setTransform(const Empty::math::mat4&, const Empty::math::mat4&, const Empty::math::vec4 &mvt) override { commands.push_back({ CommandType::Transform, nullptr, mvt }); }
+    void setColor(const Empty::math::vec4 &color) override { commands.push_back({ CommandType::Color, nullptr, color }); }
+    void setInsideOut(bool insideOut) override { commands.push_back({ CommandType::InsideOut, nullptr, Empty::math::vec4(insideOut ? 1.f : 0.f, 0, 0, 0) }); }
+    void draw(Model4RenderContext &rc) override { commands.push_back({ CommandType::Draw, &rc, Empty::math::vec4::zero }); }
+
+    std::vector<Command> commands;
+};
+
+/**
+ * Queue of draws decoupling what the scene wants drawn from the order and way
+ * it is drawn.
+ *
+ * Gathering emits one packet per visible node, made of a 64-bit sort key and
+ * of the index of the draw's data. Keys hold, from the most significant bits
+ * down, the program, the render context and the view-space depth of the node,
+ * so that sorting them groups draws by state and orders each group front to
+ * back. Packets are sorted with a least significant digit radix sort, and
+ * submission only forwards to the backend the state that actually changes
+ * from one draw to the next.
+ */
+class RenderQueue4
+{
+public:
+    struct Packet
+    {
+        uint64_t key;
+        uint32_t payload;
+    };
+
+    /**
+     * Data of a single draw.
+     */
+    struct Draw
+    {
+        Model4RenderContext *rc;
+        Empty::math::mat4 mv, tinvMV;
+        Empty::math::vec4 mvt;
+        Empty::math::vec4 color;
+        bool insideOut;
+    };
+
+    /**
+     * Amount of commands forwarded to the backend by the last submission.
+     */
+    struct Stats
+    {
+        unsigned int programs = 0, geometries = 0, colors = 0, insideOuts = 0, draws = 0;
+    };
+
+    // Bits of the sort key given to each field
+    static constexpr int ProgramBits = 12, ContextBits = 20, DepthBits = 32;
+
+    /**
+     * Emits a packet for every visible node of a graph whose world transforms
+     * are up to date. Replaces the packets of the previous frame.
+     */
+    void gather(SceneGraph4 &graph, const Transform4 &vt, const Empty::math::mat4 &p);
+    /**
+     * Orders the packets by increasing key.
+     */
+    void sort();
+    /**
+     * Sends the packets in order to a backend, skipping redundant state changes.
+     */
+    void submit(RenderBackend4 &backend);
+
+    /**
+     * Sorts packets by key using 11-bit digits, skipping the digits every key
+     * has in common.
+     * @param   scratch     temporary storage, resized as needed
+     */
+    static void radixSort(std::vector<Packet> &packets, std::vector<Packet> &scratch);
+
+    /**
+     * Maps a non-negative depth to an integer of the same order.
+     */
+    static uint32_t depthBits(float depth);
+
+    std::vector<Packet> packets;
+    std::vector<Draw> draws;
+    Stats stats;
+
+private:
+    // Small integer identifying a pointer, kept across frames so that the
+    // order of the groups stays stable
+    template <typename T>
+    unsigned int slot(std::unordered_map<const T*, unsigned int> &slots, const T *p)
+    {
+        return slots.emplace(p, static_cast<unsigned int>(slots.size())).first->second;
+    }
+
+    std::vector<unsigned int> _visible;
+    std::vector<Packet> _scratch;
+    std::unordered_map<const Empty::gl::ShaderProgram*, unsigned int> _programSlots;
+    std::unordered_map<const Model4RenderContext*, unsigned int> _contextSlots;
+};
+
+#endif
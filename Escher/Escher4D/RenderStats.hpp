@@ -0,0 +1,42 @@
+#ifndef INC_RENDER_STATS
+#define INC_RENDER_STATS
+
+/**
+ * Counters of draw calls and vertex setup work, meant to be displayed and
+ * reset by the application once per frame.
+ */
+struct RenderStats
+{
+    /**
+     * Draw calls issued, instanced or not.
+     */
+    unsigned int drawCalls = 0;
+    /**
+     * Attribute location lookups, ie calls to `ShaderProgram::locateAttributes`.
+     */
+    unsigned int attributeLookups = 0;
+    /**
+     * Vertex arrays (re)specified, ie whose buffers and attribute formats got
+     * attached.
+     */
+    unsigned int vertexArraySetups = 0;
+    /**
+     * Vertex arrays bound.
+     */
+    unsigned int vertexArrayBinds = 0;
+    /**
+     * Compute dispatches issued, and the work groups they launched.
+     */
+    unsigned int dispatches = 0;
+    unsigned long long workGroups = 0;
+
+    void reset() { *this = RenderStats(); }
+
+    static RenderStats &get()
+    {
+        static RenderStats stats;
+        return stats;
+    }
+};
+
+#endif
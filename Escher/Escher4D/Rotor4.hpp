@@ -1,77 +1,111 @@
-#if 0
 #ifndef INC_ROTOR4
 #define INC_ROTOR4
 
 #include <cmath>
 
-#include <Eigen/Eigen>
+#include <Empty/math/funcs.h>
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
 
-using namespace Eigen;
-
-enum
+/**
+ * Planes of rotation in 4D, encoded as the indices of the two axes spanning them.
+ */
+enum Planes4
 {
-    E = 0, XY, XZ, XW, YZ, YW, ZW, XYZW
-} Planes4;
+    XY = 0x01,
+    XZ = 0x02,
+    XW = 0x03,
+    YZ = 0x12,
+    YW = 0x13,
+    ZW = 0x23
+};
 
 /**
  * Represents an arbitrary rotation in 4D space. Formally, this is an element of
  * the even subalgebra of the Clifford Cl(4, 0) algebra. Elements are factors of
  * respectively 1, e1e2, e1e3, e1e4, e2e3, e2e4, e3e4, e1e2e3e4.
+ * Rotors act on vectors through the sandwich product R v ~R.
  */
 struct Rotor4
 {
-    Rotor4() { _data << 1, 0, 0, 0, 0, 0, 0, 0; }
-    float &operator(Planes4 i) { return _data(i); }
-    
     /**
-     * Constructs the rotor that represents a rotation that would move a to b.
+     * Constructs the identity rotor.
+     */
+    Rotor4() : s(1), xy(0), xz(0), xw(0), yz(0), yw(0), zw(0), xyzw(0) { }
+    Rotor4(float s, float xy, float xz, float xw, float yz, float yw, float zw, float xyzw)
+        : s(s), xy(xy), xz(xz), xw(xw), yz(yz), yw(yw), zw(zw), xyzw(xyzw) { }
+
+    /**
+     * Constructs the rotor of a rotation by a given angle in a given plane. The
+     * rotation has the same orientation as `Transform4::rotate`.
      */
-    Rotor4 &rotateTowards(Vector4f &a, Vector4f &b)
+    static Rotor4 rotation(Planes4 p, float angle)
     {
-        Vector4f c = (a + b) / 2;
-        return *this = a, c;
+        Rotor4 r;
+        r.s = cos(angle / 2);
+        r.component(p) = -sin(angle / 2);
+        return r;
     }
-    
+
     /**
-     * Clifford transposition of the rotor, ie reversal of the order of the basis
-     * products.
+     * Constructs the rotor of the smallest rotation that moves a onto b. Both
+     * vectors should be normalized and not opposite.
      */
-    Rotor4 &reverse()
+    static Rotor4 between(const Empty::math::vec4 &a, const Empty::math::vec4 &b)
     {
-        _data(XY) *= -1;
-        _data(XZ) *= -1;
-        _data(XW) *= -1;
-        _data(YZ) *= -1;
-        _data(YW) *= -1;
-        _data(ZW) *= -1;
-        return *this;
+        // (1 + ba) / |1 + ba|, with ba = a.b + b^a
+        Rotor4 r(1 + Empty::math::dot(a, b),
+            b.x * a.y - b.y * a.x, b.x * a.z - b.z * a.x, b.x * a.w - b.w * a.x,
+            b.y * a.z - b.z * a.y, b.y * a.w - b.w * a.y, b.z * a.w - b.w * a.z, 0);
+        return r.normalize();
+    }
+
+    /**
+     * Returns the bivector component associated with a plane.
+     */
+    float &component(Planes4 p)
+    {
+        switch(p)
+        {
+        case XY: return xy;
+        case XZ: return xz;
+        case XW: return xw;
+        case YZ: return yz;
+        case YW: return yw;
+        default: return zw;
+        }
     }
-    
-    Rotor4 operator*(Rotor4 &b) const
+    float component(Planes4 p) const { return const_cast<Rotor4 *>(this)->component(p); }
+
+    /**
+     * Clifford product of two rotors. The resulting rotor applies b, then this rotor.
+     */
+    Rotor4 operator*(const Rotor4 &b) const
+    {
+        return Rotor4(
+            s * b.s - xy * b.xy - xz * b.xz - xw * b.xw - yz * b.yz - yw * b.yw - zw * b.zw + xyzw * b.xyzw,
+            s * b.xy + xy * b.s - xz * b.yz - xw * b.yw + yz * b.xz + yw * b.xw - zw * b.xyzw - xyzw * b.zw,
+            s * b.xz + xy * b.yz + xz * b.s - xw * b.zw - yz * b.xy + yw * b.xyzw + zw * b.xw + xyzw * b.yw,
+            s * b.xw + xy * b.yw + xz * b.zw + xw * b.s - yz * b.xyzw - yw * b.xy - zw * b.xz - xyzw * b.yz,
+            s * b.yz - xy * b.xz + xz * b.xy - xw * b.xyzw + yz * b.s - yw * b.zw + zw * b.yw - xyzw * b.xw,
+            s * b.yw - xy * b.xw + xz * b.xyzw + xw * b.xy + yz * b.zw + yw * b.s - zw * b.yz + xyzw * b.xz,
+            s * b.zw - xy * b.xyzw - xz * b.xw + xw * b.xz - yz * b.yw + yw * b.yz + zw * b.s - xyzw * b.xy,
+            s * b.xyzw + xy * b.zw - xz * b.yw + xw * b.yz + yz * b.xw - yw * b.xz + zw * b.xy + xyzw * b.s);
+    }
+    Rotor4 &operator*=(const Rotor4 &b)
+    {
+        return *this = *this * b;
+    }
+
+    /**
+     * Clifford transposition of the rotor, ie reversal of the order of the basis
+     * products. For a normalized rotor, this is the inverse rotation.
+     */
+    Rotor4 reverse() const
     {
-        Rotor4 c;
-        Vector4f &d = _data;
-        c(E) = d(E) * b(E) + d(XYZW) * b(XYZW);
-        for(unsigned int k = 1; k < 7; ++k)
-            c(E) -= d(k) * b(k);
-        // Ugh
-        c(XY) = d(E) * b(XY) + d(XY) * b(E) - d(XZ) * b(YZ) - d(XW) * b(YW) + d(YZ) * b(XZ)
-            + d(YW) * b(XW) - d(ZW) * b(XYZW) - d(XYZW) * b(ZW);
-        c(XZ) = d(E) * b(XZ) + d(XY) * b(YZ) + d(XZ) * b(E) - d(XW) * b(ZW) - d(YZ) * b(XY)
-            + d(YW) * b(XYZW) + d(ZW) * b(XW) + d(XYZW) * b(YW);
-        c(XW) = d(E) * b(XW) + d(XY) * b(YW) + d(XZ) * b(ZW) + d(XW) * b(E) - d(YZ) * b(XYZW)
-            - d(YW) * b(XY) - d(ZW) * b(XZ) - d(XYZW) * b(YZ);
-        c(YZ) = d(E) * b(YZ) - d(XY) * b(XZ) + d(XZ) * b(XY) - d(XW) * b(XYZW) + d(YZ) * b(E)
-            - d(YW) * b(ZW) + d(ZW) * b(YW) - d(XYZW) * b(XW);
-        c(YW) = d(E) * b(YW) - d(XY) * b(XW) + d(XZ) * b(XYZW) + d(XW) * b(XY) + d(YZ) * b(ZW)
-            + d(YW) * b(E) - d(ZW) * b(YZ) + d(XYZW) * b(XZ);
-        c(ZW) = d(E) * b(ZW) - d(XY) * b(XYZW) - d(XZ) * b(XW) + d(XW) * b(XZ) - d(YZ) * b(YW)
-            + d(YW) * b(YZ) + d(ZW) * b(E) - d(XYZW) * b(XY);
-        c(XYZW) = d(E) * b(XYZW) + d(XY) * b(ZW) - d(XZ) * b(YW) + d(XW) * b(YZ) + d(YZ) * b(XW)
-            - d(YW) * b(XZ) + d(ZW) * b(XY) + d(XYZW) * b(E);
-        return c;
+        return Rotor4(s, -xy, -xz, -xw, -yz, -yw, -zw, xyzw);
     }
-    
+
     /**
      * Square root of the Clifford squared norm.
      */
@@ -79,47 +113,90 @@ struct Rotor4
     {
         return sqrt(sqnorm());
     }
-    
+
     /**
      * Clifford squared norm, ie the scalar part of r.reverse() * r.
      */
     float sqnorm() const
     {
-        float r = 0;
-        for(unsigned int k = 0; k < 8; ++k)
-            r += _data(k) * _data(k);
-        return r;
+        return s * s + xy * xy + xz * xz + xw * xw + yz * yz + yw * yw + zw * zw + xyzw * xyzw;
     }
-    
+
     /**
-     * Converts this rotor to 4x4 matrix form.
+     * Makes the rotor a pure rotation again, ie enforces R ~R = 1. Unlike in 3D,
+     * dividing by the norm is not enough : R ~R = a + b e1e2e3e4, so R is multiplied
+     * by the inverse square root of that quantity, computed on the idempotents
+     * (1 +- e1e2e3e4) / 2.
      */
-    Matrix4f toMatrix() const
+    Rotor4 &normalize()
     {
-        // TODO
-        return Matrix4f::Zero();
+        float a = sqnorm(),
+            b = 2 * (s * xyzw - xy * zw + xz * yw - xw * yz),
+            p = 1 / sqrt(a + b), m = 1 / sqrt(a - b),
+            u = (p + m) / 2, v = (p - m) / 2;
+        // this * (u + v e1e2e3e4)
+        *this = Rotor4(u * s + v * xyzw, u * xy - v * zw, u * xz + v * yw, u * xw - v * yz,
+            u * yz - v * xw, u * yw + v * xz, u * zw - v * xy, u * xyzw + v * s);
+        return *this;
     }
-    
-private:
-    Matrix<float, 8, 1> _data;
-};
 
-/**
- * Constructs the rotor that represents a rotation on the plane described by a and
- * b by twice the angle between a and b.
- */
-Rotor4 operator,(Vector4f &a, Vector4f &b)
-{
-    Rotor4 r;
-    r(0) = a.dot(b);
-    r(1) = a(0) * b(1) - a(1) * b(0);
-    r(2) = a(0) * b(2) - a(2) * b(0);
-    r(3) = a(0) * b(3) - a(3) * b(0);
-    r(4) = a(1) * b(2) - a(2) * b(1);
-    r(5) = a(1) * b(3) - a(3) * b(1);
-    r(6) = a(2) * b(3) - a(3) * b(2);
-    return r;
-}
+    /**
+     * Rotates a vector using the sandwich product R v ~R. Assumes the rotor is
+     * normalized. This costs 64 multiplications, against 16 for a matrix, so
+     * many vectors are better rotated by `toMatrix()`.
+     */
+    Empty::math::vec4 apply(const Empty::math::vec4 &v) const
+    {
+        // R v, a vector plus a trivector
+        const float x = s * v.x + xy * v.y + xz * v.z + xw * v.w,
+            y = s * v.y - xy * v.x + yz * v.z + yw * v.w,
+            z = s * v.z - xz * v.x - yz * v.y + zw * v.w,
+            w = s * v.w - xw * v.x - yw * v.y - zw * v.z,
+            xyz = xy * v.z - xz * v.y + yz * v.x + xyzw * v.w,
+            xyw = xy * v.w - xw * v.y + yw * v.x - xyzw * v.z,
+            xzw = xz * v.w - xw * v.z + zw * v.x + xyzw * v.y,
+            yzw = yz * v.w - yw * v.z + zw * v.y - xyzw * v.x;
+        // Vector part of (R v) ~R, the trivector part cancels out
+        return Empty::math::vec4(
+            s * x + xy * y + xz * z + xw * w + yz * xyz + yw * xyw + zw * xzw + xyzw * yzw,
+            s * y - xy * x + yz * z + yw * w - xz * xyz - xw * xyw - xyzw * xzw + zw * yzw,
+            s * z - xz * x - yz * y + zw * w + xy * xyz + xyzw * xyw - xw * xzw - yw * yzw,
+            s * w - xw * x - yw * y - zw * z - xyzw * xyz + xy * xyw + xz * xzw + yz * yzw);
+    }
+
+    /**
+     * Converts this rotor to 4x4 matrix form. Column k is the image of the k-th
+     * basis vector by the sandwich product. Assumes the rotor is normalized.
+     */
+    Empty::math::mat4 toMatrix() const
+    {
+        Empty::math::mat4 m;
+        const float ss = s * s, xy2 = xy * xy, xz2 = xz * xz, xw2 = xw * xw,
+            yz2 = yz * yz, yw2 = yw * yw, zw2 = zw * zw, p2 = xyzw * xyzw;
+
+        m(0, 0) = ss - xy2 - xz2 - xw2 + yz2 + yw2 + zw2 - p2;
+        m(1, 0) = -2 * (s * xy + xz * yz + xw * yw + xyzw * zw);
+        m(2, 0) = -2 * (s * xz - xy * yz + xw * zw - xyzw * yw);
+        m(3, 0) = -2 * (s * xw - xy * yw - xz * zw + xyzw * yz);
+
+        m(0, 1) = 2 * (s * xy - xz * yz - xw * yw + xyzw * zw);
+        m(1, 1) = ss - xy2 + xz2 + xw2 - yz2 - yw2 + zw2 - p2;
+        m(2, 1) = -2 * (s * yz + xy * xz + yw * zw + xyzw * xw);
+        m(3, 1) = -2 * (s * yw + xy * xw - yz * zw - xyzw * xz);
+
+        m(0, 2) = 2 * (s * xz + xy * yz - xw * zw - xyzw * yw);
+        m(1, 2) = 2 * (s * yz - xy * xz - yw * zw + xyzw * xw);
+        m(2, 2) = ss + xy2 - xz2 + xw2 - yz2 + yw2 - zw2 - p2;
+        m(3, 2) = -2 * (s * zw + xz * xw + yz * yw + xyzw * xy);
+
+        m(0, 3) = 2 * (s * xw + xy * yw + xz * zw + xyzw * yz);
+        m(1, 3) = 2 * (s * yw - xy * xw + yz * zw - xyzw * xz);
+        m(2, 3) = 2 * (s * zw - xz * xw - yz * yw + xyzw * xy);
+        m(3, 3) = ss + xy2 + xz2 - xw2 + yz2 - yw2 - zw2 - p2;
+        return m;
+    }
+
+    float s, xy, xz, xw, yz, yw, zw, xyzw;
+};
 
-#endif
 #endif
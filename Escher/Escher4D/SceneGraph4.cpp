@@ -0,0 +1,236 @@
+#include "SceneGraph4.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/Profiler.hpp"
+
+void SceneGraph4::build(Object4 &root)
+{
+    _root = &root;
+    _structureVersion = Object4::structureVersion();
+    ++_buildCount;
+    parents.clear();
+    objects.clear();
+
+    // Iterative depth-first traversal ; children are pushed in reverse so that
+    // they are popped, and thus stored, in the same order as Object4::visit
+    std::vector<std::pair<Object4*, int>> stack;
+    stack.emplace_back(&root, -1);
+    while(!stack.empty())
+    {
+        auto [obj, parent] = stack.back();
+        stack.pop_back();
+
+        int index = static_cast<int>(objects.size());
+        objects.push_back(obj);
+        parents.push_back(parent);
+
+        for(auto it = obj->_children.rbegin(); it != obj->_children.rend(); ++it)
+            stack.emplace_back(it->get(), index);
+    }
+
+    const size_t n = objects.size();
+    
+    // Children come right after their parent, so walking backwards gives every
+    // subtree's extent before its root's
+    subtreeEnd.resize(n);
+    _subtreeDrawables.resize(n);
+    for(size_t k = 0; k < n; ++k)
+    {
+        subtreeEnd[k] = static_cast<int>(k + 1);
+        _subtreeDrawables[k] = objects[k]->_rc ? 1 : 0;
+    }
+    for(size_t k = n; k-- > 1;)
+    {
+        int p = parents[k];
+        subtreeEnd[p] = std::max(subtreeEnd[p], subtreeEnd[k]);
+        _subtreeDrawables[p] += _subtreeDrawables[k];
+    }
+    
+    // Local bounds, computed once per geometry
+    std::unordered_map<const Geometry4*, BoundingSphere4> geometryBounds;
+    localBounds.assign(n, BoundingSphere4());
+    for(size_t k = 0; k < n; ++k)
+    {
+        const Model4RenderContext *rc = objects[k]->_rc;
+        if(!rc || rc->geometry.vertices.empty())
+            continue;
+        auto it = geometryBounds.find(&rc->geometry);
+        if(it == geometryBounds.end())
+        {
+            AABB4 box;
+            rc->geometry.boundingBox(box.min, box.max);
+            it = geometryBounds.emplace(&rc->geometry, BoundingSphere4(box)).first;
+        }
+        localBounds[k] = it->second;
+    }
+    worldBounds.resize(n);
+    subtreeBounds.resize(n);
+    
+    localMats.resize(n);
+    localPos.resize(n);
+    worldMats.resize(n);
+    worldPos.resize(n);
+    worldKinds.resize(n);
+    normalMats.resize(n);
+    dirty.assign(n, 1);
+    _versions.resize(n);
+    for(size_t k = 0; k < n; ++k)
+    {
+        localMats[k] = objects[k]->mat;
+        localPos[k] = objects[k]->pos;
+        _versions[k] = objects[k]->version();
+    }
+    chainDirty();
+    mergeBounds();
+}
+
+size_t SceneGraph4::updateWorldTransforms()
+{
+    PROFILE_ZONE("Scene update");
+    if(!_root)
+        return 0;
+    if(_structureVersion != Object4::structureVersion())
+    {
+        build(*_root);
+        return objects.size();
+    }
+
+    for(size_t k = 0; k < objects.size(); ++k)
+    {
+        const Object4 &obj = *objects[k];
+        dirty[k] = obj.version() != _versions[k];
+        if(dirty[k])
+        {
+            localMats[k] = obj.mat;
+            localPos[k] = obj.pos;
+            _versions[k] = obj.version();
+        }
+    }
+    size_t count = chainDirty();
+    if(count > 0)
+        mergeBounds();
+    return count;
+}
+
+size_t SceneGraph4::updateWorldTransforms(const std::vector<Empty::math::mat4> &mats, const std::vector<Empty::math::vec4> &pos,
+    const std::vector<unsigned int> &versions)
+{
+    PROFILE_ZONE("Scene update");
+    // Arrays taken before the graph was built
+    if(versions.size() != objects.size())
+        return 0;
+    for(size_t k = 0; k < objects.size(); ++k)
+    {
+        dirty[k] = versions[k] != _versions[k];
+        if(dirty[k])
+        {
+            localMats[k] = mats[k];
+            localPos[k] = pos[k];
+            _versions[k] = versions[k];
+        }
+    }
+    size_t count = chainDirty();
+    if(count > 0)
+        mergeBounds();
+    return count;
+}
+
+size_t SceneGraph4::chainDirty()
+{
+    size_t count = 0;
+    // Parents always come first, so their world transform and dirty flag are
+    // final by the time their children are reached
+    for(size_t k = 0; k < objects.size(); ++k)
+    {
+        int p = parents[k];
+        if(p >= 0 && dirty[p])
+            dirty[k] = 1;
+        if(!dirty[k])
+            continue;
+        
+        if(p < 0)
+        {
+            worldMats[k] = localMats[k];
+            worldPos[k] = localPos[k];
+        }
+        else
+        {
+            worldMats[k] = worldMats[p] * localMats[k];
+            worldPos[k] = worldMats[p] * localPos[k] + worldPos[p];
+        }
+        
+        Transform4 world(worldMats[k], worldPos[k]);
+        worldKinds[k] = world.classify();
+        normalMats[k] = world.normalMatrix(worldKinds[k]);
+        worldBounds[k] = localBounds[k].transformed(world, worldKinds[k]);
+        count++;
+    }
+    return count;
+}
+
+void SceneGraph4::mergeBounds()
+{
+    subtreeBounds.assign(worldBounds.begin(), worldBounds.end());
+    for(size_t k = subtreeBounds.size(); k-- > 1;)
+        subtreeBounds[parents[k]].merge(subtreeBounds[k]);
+}
+
+void SceneGraph4::render(const Camera4 &camera, const Empty::math::mat4 &p)
+{
+    render(camera.computeViewTransform(), p);
+}
+
+void SceneGraph4::collectVisible(const Transform4 &vt, const Empty::math::mat4 &p, std::vector<unsigned int> &nodes)
+{
+    PROFILE_ZONE("Culling");
+    const Frustum3 frustum(p);
+    const float vtScale = vt.maxScale(vt.classify());
+    
+    nodes.clear();
+    cullingStats.drawn = cullingStats.culled = 0;
+    for(size_t k = 0; k < objects.size(); ++k)
+    {
+        if(culling && !isVisible(subtreeBounds[k], vt, vtScale, frustum))
+        {
+            cullingStats.culled += _subtreeDrawables[k];
+            k = subtreeEnd[k] - 1;
+            continue;
+        }
+        
+        if(!objects[k]->_rc)
+            continue;
+        if(culling && !isVisible(worldBounds[k], vt, vtScale, frustum))
+        {
+            cullingStats.culled++;
+            continue;
+        }
+        cullingStats.drawn++;
+        nodes.push_back(static_cast<unsigned int>(k));
+    }
+}
+
+void SceneGraph4::render(const Transform4 &vt, const Empty::math::mat4 &p)
+{
+    collectVisible(vt, p, _visible);
+    const Empty::math::mat4 tinvv = vt.normalMatrix();
+    
+    for(unsigned int k : _visible)
+    {
+        const Object4 &obj = *objects[k];
+        Model4RenderContext *rc = obj._rc;
+        Transform4 mv = Transform4(worldMats[k], worldPos[k]).chain(vt);
+        rc->_program.uniform("MV", mv.mat);
+        rc->_program.uniform("tinvMV", viewNormalMatrix(k, tinvv));
+        rc->_program.uniform("MVt", mv.pos);
+        rc->_program.uniform("uColor", obj.color);
+        rc->_program.uniform("uInsideOut", (int)obj.insideOut);
+        rc->render();
+    }
+}
@@ -0,0 +1,191 @@
+#ifndef INC_SCENE_GRAPH4
+#define INC_SCENE_GRAPH4
+
+#include <cmath>
+#include <vector>
+
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Bounds4.hpp"
+#include "Escher4D/Camera4.hpp"
+#include "Escher4D/Object4.hpp"
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Flattened, data-oriented view of an `Object4` hierarchy. Nodes are stored in
+ * depth-first order, meaning every node comes after its parent, and transforms
+ * are kept as separate contiguous arrays. World transforms are then computed in
+ * a single linear pass instead of a recursive walk of the tree.
+ *
+ * The `Object4` tree remains the authoring interface : the graph reads local
+ * transforms from it, and node k of the graph is the k-th object visited by
+ * `Object4::visit`. Updates are incremental : only objects whose transform
+ * changed (see `Transform4::touch`) and their descendants are re-chained, and
+ * the graph rebuilds itself when objects are added or removed.
+ *
+ * The graph also maintains world-space bounding spheres for every node and every
+ * subtree, which rendering uses to skip whole subtrees that cannot show up in
+ * the view.
+ */
+class SceneGraph4
+{
+public:
+    SceneGraph4() { }
+    SceneGraph4(Object4 &root) { build(root); }
+
+    /**
+     * Flattens the hierarchy under an object, that object included.
+     */
+    void build(Object4 &root);
+
+    /**
+     * Reads modified local transforms back from the objects and recomputes the
+     * world transforms of the subtrees under them in one pass. Flags the nodes
+     * that were updated in `dirty`.
+     * @return  the amount of nodes whose world transform changed
+     */
+    size_t updateWorldTransforms();
+    /**
+     * Same as `updateWorldTransforms`, but takes the local transforms and their
+     * versions from arrays in node order, such as those of a `FrameSnapshot`,
+     * so that another thread may change the objects meanwhile. The hierarchy
+     * itself must not change.
+     */
+    size_t updateWorldTransforms(const std::vector<Empty::math::mat4> &mats, const std::vector<Empty::math::vec4> &pos,
+        const std::vector<unsigned int> &versions);
+
+    /**
+     * Renders every visible node that has a render context using the world
+     * transforms computed by the last call to `updateWorldTransforms`.
+     * @param   camera  camera to render from
+     * @param   p       projection matrix used to slice and project the scene
+     */
+    void render(const Camera4 &camera, const Empty::math::mat4 &p);
+    /**
+     * Renders every visible node that has a render context given a view transform.
+     */
+    void render(const Transform4 &vt, const Empty::math::mat4 &p);
+    /**
+     * Lists the visible nodes that have a render context, in depth-first order,
+     * and updates `cullingStats` accordingly. Does not touch the GPU.
+     */
+    void collectVisible(const Transform4 &vt, const Empty::math::mat4 &p, std::vector<unsigned int> &nodes);
+
+    /**
+     * Tests whether a world-space bounding sphere can show up in the view, ie
+     * whether it crosses the w = 0 hyperplane of view space and its slice lies
+     * at least partially inside the 3D frustum.
+     * @param   vt          view transform
+     * @param   vtScale     maximum scaling factor of the view transform
+     */
+    static bool isVisible(const BoundingSphere4 &bounds, const Transform4 &vt, float vtScale, const Frustum3 &frustum)
+    {
+        if(bounds.empty())
+            return false;
+        Empty::math::vec4 c = vt.apply(bounds.center);
+        float r = bounds.radius * vtScale;
+        if(std::abs(c.w) > r)
+            return false;
+        // The slice of a 4D ball by w = 0 is a 3D ball
+        return frustum.intersectsSphere(c, std::sqrt(r * r - c.w * c.w));
+    }
+
+    /**
+     * Returns the matrix that transforms the normal vectors of a node to view
+     * space.
+     * @param   tinvv   normal matrix of the view transform, ie `vt.normalMatrix()`
+     */
+    Empty::math::mat4 viewNormalMatrix(size_t k, const Empty::math::mat4 &tinvv) const
+    {
+        // (V M)^-T = V^-T M^-T, and M^-T is cached per node
+        return tinvv * normalMats[k];
+    }
+
+    /**
+     * Number of nodes in the graph.
+     */
+    size_t size() const { return objects.size(); }
+    /**
+     * Returns how many times the graph was built, which lets dependent structures
+     * detect that node indices changed.
+     */
+    unsigned int buildCount() const { return _buildCount; }
+
+    /**
+     * Whether rendering skips objects that are out of view.
+     */
+    bool culling = true;
+    /**
+     * Amount of objects drawn and culled during the last call to `render`.
+     */
+    struct
+    {
+        unsigned int drawn = 0, culled = 0;
+    } cullingStats;
+
+    /**
+     * Index of the parent of each node, or -1 for the root.
+     */
+    std::vector<int> parents;
+    /**
+     * Index one past the last descendant of each node. The subtree under node
+     * k is the range [k, subtreeEnd[k]).
+     */
+    std::vector<int> subtreeEnd;
+    /**
+     * Linear and translational parts of each node's transform relative to its parent.
+     */
+    std::vector<Empty::math::mat4> localMats;
+    std::vector<Empty::math::vec4> localPos;
+    /**
+     * Linear and translational parts of each node's transform relative to the
+     * root of the graph.
+     */
+    std::vector<Empty::math::mat4> worldMats;
+    std::vector<Empty::math::vec4> worldPos;
+    /**
+     * Class of each node's world transform and the matrix that transforms its
+     * normal vectors, ie the inverse transpose of its linear part. Only updated
+     * along with the world transform.
+     */
+    std::vector<Transform4::Kind> worldKinds;
+    std::vector<Empty::math::mat4> normalMats;
+    /**
+     * Bounding sphere of each node's own geometry in local space, empty for
+     * nodes without a render context.
+     */
+    std::vector<BoundingSphere4> localBounds;
+    /**
+     * World-space bounding spheres of each node's own geometry and of its whole
+     * subtree.
+     */
+    std::vector<BoundingSphere4> worldBounds, subtreeBounds;
+    /**
+     * Whether each node's world transform changed during the last update.
+     */
+    std::vector<unsigned char> dirty;
+    /**
+     * Objects that the nodes were built from.
+     */
+    std::vector<Object4*> objects;
+    
+private:
+    // Propagates dirty flags down the hierarchy and re-chains flagged nodes
+    size_t chainDirty();
+    // Recomputes subtree bounds bottom-up
+    void mergeBounds();
+    
+    Object4 *_root = nullptr;
+    // Object4::structureVersion() at build time
+    unsigned int _structureVersion = 0;
+    unsigned int _buildCount = 0;
+    // Transform4::version() of each object when its local transform was last read
+    std::vector<unsigned int> _versions;
+    // Amount of nodes with a render context in each subtree
+    std::vector<unsigned int> _subtreeDrawables;
+    // Nodes drawn by the last call to render
+    std::vector<unsigned int> _visible;
+};
+
+#endif
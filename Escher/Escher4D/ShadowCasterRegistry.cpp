@@ -0,0 +1,336 @@
+#include "ShadowCasterRegistry.hpp"
+
+#include <algorithm>
+
+#include "Escher4D/Profiler.hpp"
+#include "Escher4D/ThreadPool.hpp"
+
+void ShadowCasterRegistry::build(const SceneGraph4 &graph)
+{
+    PROFILE_ZONE("Caster build");
+    clear();
+    // Allocate ranges and append instances in node order, which is cheap
+    for(size_t k = 0; k < graph.size(); ++k)
+    {
+        const Object4 &obj = *graph.objects[k];
+        const Model4RenderContext *rc = obj.getRenderContext();
+        if(!obj.castShadows || !rc)
+            continue;
+        auto it = _geometryIndex.find(&rc->geometry);
+        uint32_t g;
+        if(it == _geometryIndex.end())
+        {
+            g = static_cast<uint32_t>(geometries.size());
+            geometries.emplace_back();
+            allocateGeometry(rc->geometry, geometries[g]);
+            geometries[g].refs = 0;
+            _geometrySources.push_back(&rc->geometry);
+            _geometryIndex.emplace(&rc->geometry, g);
+        }
+        else
+            g = it->second;
+        geometries[g].refs++;
+        CasterId id = static_cast<CasterId>(_casterInstances.size());
+        _casterInstances.push_back(appendInstance(id, g, static_cast<uint32_t>(k)));
+        _casterCount++;
+    }
+
+    // Then copy the geometries, whose ranges do not overlap
+    ThreadPool::get().parallelFor(geometries.size(), [&](size_t g, unsigned int)
+    {
+        copyGeometry(*_geometrySources[g], geometries[g]);
+    });
+    dirtyCells.add(0, cells.size());
+    dirtyVertices.add(0, vertices.size());
+}
+
+void ShadowCasterRegistry::clear()
+{
+    geometries.clear();
+    instances.clear();
+    cells.clear();
+    vertices.clear();
+    _cellRanges.reset(0);
+    _vertexRanges.reset(0);
+    _geometryIndex.clear();
+    _geometrySources.clear();
+    _freeGeometries.clear();
+    _instanceCasters.clear();
+    _instanceGeometries.clear();
+    _casterInstances.clear();
+    _freeIds.clear();
+    _instancedCells = _liveCells = 0;
+    _casterCount = 0;
+    clearDirty();
+}
+
+ShadowCasterRegistry::CasterId ShadowCasterRegistry::addCaster(const Geometry4 &geometry, uint32_t transform)
+{
+    CasterId id;
+    if(_freeIds.empty())
+    {
+        id = static_cast<CasterId>(_casterInstances.size());
+        _casterInstances.push_back(InvalidCaster);
+    }
+    else
+    {
+        id = _freeIds.back();
+        _freeIds.pop_back();
+    }
+    _casterInstances[id] = appendInstance(id, acquireGeometry(geometry), transform);
+    _casterCount++;
+    return id;
+}
+
+void ShadowCasterRegistry::removeCaster(CasterId id)
+{
+    uint32_t index = _casterInstances[id];
+    releaseGeometry(_instanceGeometries[index]);
+    clearInstance(index);
+    _casterInstances[id] = InvalidCaster;
+    _freeIds.push_back(id);
+    _casterCount--;
+}
+
+void ShadowCasterRegistry::setTransform(CasterId id, uint32_t transform)
+{
+    uint32_t index = _casterInstances[id];
+    instances[index].transform = transform;
+    dirtyInstances.add(index, index + 1);
+}
+
+void ShadowCasterRegistry::setGeometry(CasterId id, const Geometry4 &geometry)
+{
+    uint32_t index = _casterInstances[id], transform = instances[index].transform;
+    uint32_t g = acquireGeometry(geometry);
+    releaseGeometry(_instanceGeometries[index]);
+    const GeometryRange &range = geometries[g];
+    if(range.cellCount == instances[index].cellCount)
+    {
+        // Same cell numbering, the instance can stay in place
+        instances[index].geometryCell = range.firstCell;
+        _instanceGeometries[index] = g;
+        dirtyInstances.add(index, index + 1);
+    }
+    else
+    {
+        clearInstance(index);
+        _casterInstances[id] = appendInstance(id, g, transform);
+    }
+}
+
+void ShadowCasterRegistry::updateGeometry(const Geometry4 &geometry)
+{
+    auto it = _geometryIndex.find(&geometry);
+    if(it == _geometryIndex.end())
+        return;
+    uint32_t g = it->second;
+    GeometryRange &range = geometries[g];
+    uint32_t oldCells = range.cellCount;
+    _cellRanges.release(range.firstCell, range.cellCount);
+    _vertexRanges.release(range.firstVertex, range.vertexCount);
+    storeGeometry(geometry, range);
+
+    // Instances appended along the way are up to date already
+    const uint32_t count = static_cast<uint32_t>(instances.size());
+    for(uint32_t i = 0; i < count; ++i)
+        if(_instanceCasters[i] != InvalidCaster && _instanceGeometries[i] == g)
+        {
+            if(range.cellCount == oldCells)
+            {
+                instances[i].geometryCell = range.firstCell;
+                dirtyInstances.add(i, i + 1);
+            }
+            else
+            {
+                CasterId id = _instanceCasters[i];
+                uint32_t transform = instances[i].transform;
+                clearInstance(i);
+                _casterInstances[id] = appendInstance(id, g, transform);
+            }
+        }
+}
+
+void ShadowCasterRegistry::defragment()
+{
+    PROFILE_ZONE("Caster defragmentation");
+    std::vector<GeometryRange> oldGeometries = geometries;
+    std::vector<Empty::math::uvec4> oldCells;
+    std::vector<Empty::math::vec4> oldVertices;
+    oldCells.swap(cells);
+    oldVertices.swap(vertices);
+
+    // Pack live geometries in order
+    uint32_t cellCount = 0, vertexCount = 0;
+    for(uint32_t g = 0; g < geometries.size(); ++g)
+    {
+        GeometryRange &range = geometries[g];
+        if(!range.refs)
+            continue;
+        const GeometryRange &old = oldGeometries[g];
+        range.firstCell = cellCount;
+        range.firstVertex = vertexCount;
+        for(uint32_t c = 0; c < old.cellCount; ++c)
+            cells.push_back(oldCells[old.firstCell + c] + (range.firstVertex - old.firstVertex));
+        vertices.insert(vertices.end(), oldVertices.begin() + old.firstVertex, oldVertices.begin() + old.firstVertex + old.vertexCount);
+        cellCount += range.cellCount;
+        vertexCount += range.vertexCount;
+    }
+    _cellRanges.reset(cellCount);
+    _cellRanges.allocate(cellCount);
+    _vertexRanges.reset(vertexCount);
+    _vertexRanges.allocate(vertexCount);
+
+    // Pack live instances in order, renumbering their cells
+    size_t live = 0;
+    _instancedCells = 0;
+    for(size_t i = 0; i < instances.size(); ++i)
+    {
+        if(_instanceCasters[i] == InvalidCaster)
+            continue;
+        Instance inst = instances[i];
+        inst.firstCell = _instancedCells;
+        inst.geometryCell = geometries[_instanceGeometries[i]].firstCell;
+        _instancedCells += inst.cellCount;
+        instances[live] = inst;
+        _instanceCasters[live] = _instanceCasters[i];
+        _instanceGeometries[live] = _instanceGeometries[i];
+        _casterInstances[_instanceCasters[live]] = static_cast<uint32_t>(live);
+        live++;
+    }
+    instances.resize(live);
+    _instanceCasters.resize(live);
+    _instanceGeometries.resize(live);
+
+    dirtyCells.add(0, cells.size());
+    dirtyVertices.add(0, vertices.size());
+    dirtyInstances.add(0, instances.size());
+}
+
+uint32_t ShadowCasterRegistry::findInstance(uint32_t cell) const
+{
+    // Last instance starting at or before the cell ; keep in sync with test_compute.glsl
+    uint32_t lo = 0, hi = static_cast<uint32_t>(instances.size());
+    while(hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if(instances[mid].firstCell <= cell)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint32_t ShadowCasterRegistry::acquireGeometry(const Geometry4 &geometry)
+{
+    auto it = _geometryIndex.find(&geometry);
+    if(it != _geometryIndex.end())
+    {
+        geometries[it->second].refs++;
+        return it->second;
+    }
+
+    uint32_t index;
+    if(_freeGeometries.empty())
+    {
+        index = static_cast<uint32_t>(geometries.size());
+        geometries.emplace_back();
+        _geometrySources.push_back(nullptr);
+    }
+    else
+    {
+        index = _freeGeometries.back();
+        _freeGeometries.pop_back();
+    }
+    storeGeometry(geometry, geometries[index]);
+    geometries[index].refs = 1;
+    _geometrySources[index] = &geometry;
+    _geometryIndex.emplace(&geometry, index);
+    return index;
+}
+
+void ShadowCasterRegistry::releaseGeometry(uint32_t index)
+{
+    GeometryRange &range = geometries[index];
+    if(--range.refs)
+        return;
+    _cellRanges.release(range.firstCell, range.cellCount);
+    _vertexRanges.release(range.firstVertex, range.vertexCount);
+    _geometryIndex.erase(_geometrySources[index]);
+    _geometrySources[index] = nullptr;
+    _freeGeometries.push_back(index);
+}
+
+void ShadowCasterRegistry::storeGeometry(const Geometry4 &geometry, GeometryRange &range)
+{
+    allocateGeometry(geometry, range);
+    copyGeometry(geometry, range);
+    dirtyCells.add(range.firstCell, range.firstCell + range.cellCount);
+    dirtyVertices.add(range.firstVertex, range.firstVertex + range.vertexCount);
+}
+
+void ShadowCasterRegistry::allocateGeometry(const Geometry4 &geometry, GeometryRange &range)
+{
+    // Unindexed geometries have 4 vertices per cell
+    const uint32_t vertexCount = static_cast<uint32_t>(geometry.vertices.size()),
+        cellCount = static_cast<uint32_t>(geometry.isIndexed() ? geometry.cells.size() : vertexCount / 4);
+
+    // Grow the arrays geometrically when the free lists run out
+    size_t firstCell = _cellRanges.allocate(cellCount);
+    if(firstCell == RangeAllocator::npos)
+    {
+        _cellRanges.grow(std::max(_cellRanges.capacity() * 2, _cellRanges.capacity() + cellCount));
+        cells.resize(_cellRanges.capacity());
+        firstCell = _cellRanges.allocate(cellCount);
+    }
+    size_t firstVertex = _vertexRanges.allocate(vertexCount);
+    if(firstVertex == RangeAllocator::npos)
+    {
+        _vertexRanges.grow(std::max(_vertexRanges.capacity() * 2, _vertexRanges.capacity() + vertexCount));
+        vertices.resize(_vertexRanges.capacity());
+        firstVertex = _vertexRanges.allocate(vertexCount);
+    }
+
+    range.firstCell = static_cast<uint32_t>(firstCell);
+    range.cellCount = cellCount;
+    range.firstVertex = static_cast<uint32_t>(firstVertex);
+    range.vertexCount = vertexCount;
+}
+
+void ShadowCasterRegistry::copyGeometry(const Geometry4 &geometry, const GeometryRange &range)
+{
+    const unsigned int base = range.firstVertex;
+    for(uint32_t c = 0; c < range.cellCount; ++c)
+    {
+        if(geometry.isIndexed())
+            cells[range.firstCell + c] = geometry.cells[c] + base;
+        else
+        {
+            unsigned int v = 4 * c + base;
+            cells[range.firstCell + c] = { v, v + 1, v + 2, v + 3 };
+        }
+    }
+    std::copy(geometry.vertices.begin(), geometry.vertices.end(), vertices.begin() + range.firstVertex);
+}
+
+uint32_t ShadowCasterRegistry::appendInstance(CasterId id, uint32_t geometry, uint32_t transform)
+{
+    const GeometryRange &range = geometries[geometry];
+    uint32_t index = static_cast<uint32_t>(instances.size());
+    instances.push_back({ _instancedCells, range.firstCell, range.cellCount, transform });
+    _instanceCasters.push_back(id);
+    _instanceGeometries.push_back(geometry);
+    _instancedCells += range.cellCount;
+    _liveCells += range.cellCount;
+    dirtyInstances.add(index, index + 1);
+    return index;
+}
+
+void ShadowCasterRegistry::clearInstance(uint32_t index)
+{
+    _liveCells -= instances[index].cellCount;
+    instances[index].cellCount = 0;
+    _instanceCasters[index] = InvalidCaster;
+    dirtyInstances.add(index, index + 1);
+}
@@ -0,0 +1,216 @@
+#ifndef INC_SHADOW_CASTER_REGISTRY
+#define INC_SHADOW_CASTER_REGISTRY
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Empty/math/vec.h>
+
+#include "Escher4D/RangeAllocator.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+/**
+ * Shadow-casting cells of a scene, stored once per unique geometry.
+ *
+ * Every geometry used by a caster gets its cells and vertices stored once in
+ * shared arrays, and every caster is an instance referring to the cell range
+ * of its geometry and to the transform of its node. Instances are laid out so
+ * that their cells follow each other : the cells of instance i are numbered
+ * from `instances[i].firstCell` on, and the instance owning a given cell is
+ * found by binary search over the instances, which is what the shadow compute
+ * shader does for each of its work groups.
+ *
+ * Casters can be added, removed and changed one at a time, and are referred to
+ * by IDs that remain valid until they are removed. Geometry ranges are
+ * sub-allocated from free lists within the arrays, new instances are appended
+ * and removed ones leave a hole with no cells behind, so that each change only
+ * touches the entries of that caster ; the touched entries are tracked in dirty
+ * ranges for uploads to do the same. `defragment` compacts the arrays once
+ * holes pile up.
+ */
+class ShadowCasterRegistry
+{
+public:
+    typedef uint32_t CasterId;
+    static constexpr CasterId InvalidCaster = ~0u;
+
+    /**
+     * Cells and vertices of a geometry within the shared arrays.
+     */
+    struct GeometryRange
+    {
+        uint32_t firstCell, cellCount;
+        uint32_t firstVertex, vertexCount;
+        /**
+         * Amount of casters using the geometry, 0 for unused entries.
+         */
+        uint32_t refs;
+    };
+
+    /**
+     * Caster instance, laid out as a std430 uvec4.
+     */
+    struct Instance
+    {
+        /**
+         * Index of the instance's first cell among the cells of all instances.
+         */
+        uint32_t firstCell;
+        /**
+         * First cell of the instance's geometry in `cells`.
+         */
+        uint32_t geometryCell;
+        /**
+         * Amount of cells, 0 for holes left by removed casters.
+         */
+        uint32_t cellCount;
+        /**
+         * Index of the node whose world transform applies to the instance.
+         */
+        uint32_t transform;
+    };
+
+    /**
+     * Range of array elements modified since the last call to `clearDirty`.
+     */
+    struct DirtyRange
+    {
+        size_t begin = ~size_t(0), end = 0;
+
+        void add(size_t b, size_t e)
+        {
+            if(b < e)
+            {
+                begin = b < begin ? b : begin;
+                end = e > end ? e : end;
+            }
+        }
+        bool empty() const { return begin >= end; }
+    };
+
+    /**
+     * Registers every node of a graph that casts shadows and has a render
+     * context, replacing any previous caster. Transform indices are node
+     * indices in the graph, and casters get IDs in node order. Geometries are
+     * copied on the shared `ThreadPool`.
+     */
+    void build(const SceneGraph4 &graph);
+
+    /**
+     * Removes every geometry and caster.
+     */
+    void clear();
+
+    /**
+     * Adds a caster and returns its ID.
+     * @param   transform   index of the transform to apply to it
+     */
+    CasterId addCaster(const Geometry4 &geometry, uint32_t transform);
+    /**
+     * Removes a caster. Its geometry is freed if no other caster uses it.
+     */
+    void removeCaster(CasterId id);
+    /**
+     * Changes the transform index of a caster.
+     */
+    void setTransform(CasterId id, uint32_t transform);
+    /**
+     * Changes the geometry of a caster.
+     */
+    void setGeometry(CasterId id, const Geometry4 &geometry);
+    /**
+     * Reads back a registered geometry after it changed shape, and updates the
+     * casters using it.
+     */
+    void updateGeometry(const Geometry4 &geometry);
+
+    /**
+     * Moves every geometry and instance to the front of the arrays, getting rid
+     * of holes. Caster IDs remain valid, and everything is marked dirty.
+     */
+    void defragment();
+    /**
+     * Share of the cells numbered by instances that belong to holes.
+     */
+    float fragmentation() const
+    {
+        return _instancedCells ? 1.f - static_cast<float>(_liveCells) / _instancedCells : 0.f;
+    }
+
+    /**
+     * Amount of cells numbered by instances, holes included ; the shadow pass
+     * dispatches one work group per cell.
+     */
+    uint32_t instancedCells() const { return _instancedCells; }
+    /**
+     * Amount of registered casters.
+     */
+    size_t casterCount() const { return _casterCount; }
+
+    /**
+     * Returns the index of the last instance starting at or before a cell,
+     * the cell being numbered among the cells of all instances. The cell
+     * belongs to that instance unless it lies in a hole.
+     */
+    uint32_t findInstance(uint32_t cell) const;
+
+    /**
+     * Bytes taken by the arrays that would be uploaded.
+     */
+    size_t memory() const
+    {
+        return cells.size() * sizeof(cells[0]) + vertices.size() * sizeof(vertices[0]) + instances.size() * sizeof(instances[0]);
+    }
+
+    void clearDirty()
+    {
+        dirtyCells = dirtyVertices = dirtyInstances = DirtyRange();
+    }
+
+    std::vector<GeometryRange> geometries;
+    std::vector<Instance> instances;
+    /**
+     * Cells of every geometry, as indices into `vertices`. Sized to the
+     * capacity of the arrays, free ranges included.
+     */
+    std::vector<Empty::math::uvec4> cells;
+    std::vector<Empty::math::vec4> vertices;
+
+    DirtyRange dirtyCells, dirtyVertices, dirtyInstances;
+
+private:
+    // Adds a reference to a geometry, registering it if needed, and returns its index
+    uint32_t acquireGeometry(const Geometry4 &geometry);
+    // Removes a reference to a geometry, freeing it when unused
+    void releaseGeometry(uint32_t index);
+    // Copies a geometry's cells and vertices to freshly allocated ranges
+    void storeGeometry(const Geometry4 &geometry, GeometryRange &range);
+    // Allocates ranges for a geometry's cells and vertices
+    void allocateGeometry(const Geometry4 &geometry, GeometryRange &range);
+    // Copies a geometry's cells and vertices to its ranges, without marking them dirty
+    void copyGeometry(const Geometry4 &geometry, const GeometryRange &range);
+    // Appends an instance for a caster and returns its index
+    uint32_t appendInstance(CasterId id, uint32_t geometry, uint32_t transform);
+    // Turns an instance into a hole
+    void clearInstance(uint32_t index);
+
+    RangeAllocator _cellRanges, _vertexRanges;
+    std::unordered_map<const Geometry4*, uint32_t> _geometryIndex;
+    // Geometry each entry of `geometries` was read from
+    std::vector<const Geometry4*> _geometrySources;
+    // Unused entries of `geometries`
+    std::vector<uint32_t> _freeGeometries;
+    // Caster and geometry of each instance, `InvalidCaster` marking holes since
+    // casters with empty geometries have no cells either
+    std::vector<CasterId> _instanceCasters;
+    std::vector<uint32_t> _instanceGeometries;
+    // Instance of each caster ID, `InvalidCaster` for free IDs
+    std::vector<uint32_t> _casterInstances;
+    std::vector<CasterId> _freeIds;
+    uint32_t _instancedCells = 0, _liveCells = 0;
+    size_t _casterCount = 0;
+};
+
+#endif
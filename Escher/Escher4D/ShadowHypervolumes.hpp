@@ -10,6 +10,10 @@
 #include <GLFW/glfw3.h>
 
 #include "Escher4D/Context.h"
+#include "Escher4D/Profiler.hpp"
+#include "Escher4D/RenderStats.hpp"
+#include "Escher4D/ShadowCasterRegistry.hpp"
+#include "Escher4D/UploadRing.hpp"
 
 /**
  * Shadow hypervolumes computer. Based off of "An Efficient Alias-free Shadow
@@ -26,29 +30,59 @@ class ShadowHypervolumes
 public:
     ShadowHypervolumes()
     {
+        // The intersection test relies on NVIDIA warp intrinsics, which software
+        // renderers such as llvmpipe lack
+        Context &context = Context::get();
+        _available = context.hasExtension("GL_NV_gpu_shader5") && context.hasExtension("GL_NV_shader_thread_group");
+        if(!_available)
+            return;
         _aabbProgram.attachFile(Empty::gl::ShaderType::Compute, "shaders/reduction_compute.glsl");
         _aabbProgram.build();
         _computeProgram.attachFile(Empty::gl::ShaderType::Compute, "shaders/test_compute.glsl");
         _computeProgram.build();
     }
     
+    /**
+     * Whether shadows can be computed on this context. When they can't, call
+     * `clear` instead of `precompute` and `compute` to render without shadows.
+     */
+    bool available() const { return _available; }
+    
     /**
      * Re-initializes the state of the shadow volumes computer. Call this when changing
-     * screen dimensions, shadow-casting tetrahedra or vertices.
+     * screen dimensions.
      */
-    void reinit(int w, int h, const Empty::gl::TextureInfo &texPos, const std::vector<Empty::math::uvec4> &cells, const std::vector<unsigned int> &objIndices, const std::vector<Empty::math::vec4> &vertices)
+    void reinit(int w, int h, const Empty::gl::TextureInfo &texPos)
     {
         _w = w;
         _h = h;
-        _cellsAmount = static_cast<int>(cells.size());
-        _cellBuf.setStorage(cells.size() * sizeof(cells[0]), Empty::gl::BufferUsage::StaticDraw, cells[0]);
-        _objIDBuf.setStorage(objIndices.size() * sizeof(objIndices[0]), Empty::gl::BufferUsage::StaticDraw, &objIndices[0]);
-        _vertexBuf.setStorage(vertices.size() * sizeof(vertices[0]), Empty::gl::BufferUsage::StaticDraw, vertices[0]);
         // AABB hierarchy has 4 * 2 floats per pixel
         _aabbBuf.setStorage(BUFFER_SIZE * 4 * 2 * sizeof(float), Empty::gl::BufferUsage::DynamicCopy);
         // Shadow hierarchy has 1 bit per pixel but OpenGL needs ints, so divide the size by 32
         _shadowBuf.setStorage((BUFFER_SIZE + w * h) * sizeof(int) / 32, Empty::gl::BufferUsage::DynamicCopy);
-        _aabbProgram.registerTexture("texPos", texPos);
+        if(_available)
+            _aabbProgram.registerTexture("texPos", texPos);
+    }
+    void reinit(int w, int h, const Empty::gl::TextureInfo &texPos, ShadowCasterRegistry &casters)
+    {
+        reinit(w, h, texPos);
+        updateCasters(casters);
+    }
+    
+    /**
+     * Uploads the caster data that changed since the last call, then clears the
+     * registry's dirty ranges. Buffers are only reallocated when the registry
+     * outgrew them.
+     */
+    void updateCasters(ShadowCasterRegistry &casters)
+    {
+        PROFILE_ZONE("Caster upload");
+        _cellsAmount = static_cast<int>(casters.instancedCells());
+        _instanceCount = static_cast<int>(casters.instances.size());
+        uploadRange(_cellBuf, _cellCapacity, casters.cells, casters.dirtyCells);
+        uploadRange(_vertexBuf, _vertexCapacity, casters.vertices, casters.dirtyVertices);
+        uploadRange(_instanceBuf, _instanceCapacity, casters.instances, casters.dirtyInstances);
+        casters.clearDirty();
     }
     
     /**
@@ -57,6 +91,7 @@ public:
      */
     Empty::gl::ShaderProgram &precompute()
     {
+        PROFILE_ZONE("AABB reduction");
         Context& context = Context::get();
 
         _aabbProgram.uniform("uTexSize", Empty::math::ivec2(_w, _h));
@@ -64,6 +99,8 @@ public:
         context.memoryBarrier(Empty::gl::MemoryBarrierType::ShaderStorage);
         context.setShaderProgram(_aabbProgram);
         context.dispatchCompute((_w + 7) / 8, (_h  + 3) / 4, 1);
+        RenderStats::get().dispatches++;
+        RenderStats::get().workGroups += static_cast<unsigned long long>((_w + 7) / 8) * ((_h + 3) / 4);
         
         // Clear shadow hierarchy
         _shadowBuf.clearData<Empty::gl::DataFormat::Red, Empty::gl::DataType::UInt>(Empty::gl::BufferDataFormat::Red32ui, 0);
@@ -72,39 +109,75 @@ public:
         return _computeProgram;
     }
     
+    /**
+     * Binds an empty shadow hierarchy, leaving everything lit.
+     */
+    void clear()
+    {
+        _shadowBuf.clearData<Empty::gl::DataFormat::Red, Empty::gl::DataType::UInt>(Empty::gl::BufferDataFormat::Red32ui, 0);
+        Context::get().bind(_shadowBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 6);
+    }
+    
     /**
      * Builds the shadow hierarchy, which is then retrievable through buffer binding
-     * #5 in a shader.
+     * #5 in a shader. Object transforms are uploaded through the frame's ring.
      */
-    void compute(std::vector<Empty::math::mat4> &ms, std::vector<Empty::math::vec4> &ts)
+    void compute(const std::vector<Empty::math::mat4> &ms, const std::vector<Empty::math::vec4> &ts, UploadRing &uploads)
     {
+        PROFILE_ZONE("Shadow traversal");
         Context& context = Context::get();
         
-        _matBuf.setStorage(ms.size() * sizeof(Empty::math::mat4), Empty::gl::BufferUsage::StreamDraw, ms[0]);
-        _tBuf.setStorage(ts.size() * sizeof(Empty::math::vec4), Empty::gl::BufferUsage::StreamDraw, ts[0]);
-        
         context.bind(_cellBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 0);
-        context.bind(_objIDBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 1);
+        context.bind(_instanceBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 1);
         context.bind(_vertexBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 2);
-        context.bind(_matBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 3);
-        context.bind(_tBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 4);
+        UploadRing::bind(uploads.upload(ms), 3);
+        UploadRing::bind(uploads.upload(ts), 4);
         context.bind(_aabbBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 5);
         context.bind(_shadowBuf, Empty::gl::IndexedBufferTarget::ShaderStorage, 6);
         
         context.memoryBarrier(Empty::gl::MemoryBarrierType::ShaderStorage);
         context.setShaderProgram(_computeProgram);
-        context.dispatchCompute(_cellsAmount, 1, 1);
+        _computeProgram.uniform("uInstanceCount", _instanceCount);
+        if(_cellsAmount > 0)
+        {
+            context.dispatchCompute(_cellsAmount, 1, 1);
+            RenderStats::get().dispatches++;
+            RenderStats::get().workGroups += _cellsAmount;
+        }
     }
 
 private:
+    // Uploads the dirty part of an array, or all of it to a larger buffer if it
+    // does not fit anymore
+    template <typename T>
+    void uploadRange(Empty::gl::Buffer &buffer, size_t &capacity, const std::vector<T> &data, const ShadowCasterRegistry::DirtyRange &dirty)
+    {
+        if(data.empty())
+            return;
+        if(data.size() > capacity)
+        {
+            capacity = data.capacity();
+            buffer.setStorage(capacity * sizeof(T), Empty::gl::BufferUsage::DynamicDraw);
+            buffer.uploadData(0, data.size() * sizeof(T), data[0]);
+        }
+        else if(!dirty.empty())
+            buffer.uploadData(dirty.begin * sizeof(T), (dirty.end - dirty.begin) * sizeof(T), data[dirty.begin]);
+    }
+
     const size_t BUFFER_SIZE = 8 * 4 + 32 * 32 + 256 * 128 + 1024 * 1024;
 
-    // 0 : cells, 1 : object indices, 2 : vertices, 3 : M matrices, 4 : translation
-    // part of M matrices, 5 : AABB hierarchy, 6 : shadow hierarchy
-    Empty::gl::Buffer _cellBuf, _objIDBuf, _vertexBuf, _matBuf, _tBuf, _aabbBuf, _shadowBuf;
+    // 0 : cells, 1 : caster instances, 2 : vertices, 5 : AABB hierarchy, 6 : shadow
+    // hierarchy ; 3 : M matrices and 4 : translation part of M matrices come from
+    // the upload ring
+    Empty::gl::Buffer _cellBuf, _instanceBuf, _vertexBuf, _aabbBuf, _shadowBuf;
     Empty::gl::ShaderProgram _computeProgram, _aabbProgram;
     int _w = 1, _h = 1;
+    bool _available = false;
+    // Cells over all caster instances, one work group each
     int _cellsAmount = 0;
+    int _instanceCount = 0;
+    // Elements the caster buffers can hold
+    size_t _cellCapacity = 0, _vertexCapacity = 0, _instanceCapacity = 0;
 };
 
 #endif
@@ -0,0 +1,527 @@
+#include "SoftwareRenderer4.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/Object4.hpp"
+#include "Escher4D/Profiler.hpp"
+#include "Escher4D/TransformKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ESCHER_X86
+#include <immintrin.h>
+#endif
+
+using namespace Empty::math;
+
+namespace
+{
+    /// 4-wide floats for edge functions, one lane per pixel of a row
+
+#ifdef ESCHER_X86
+    struct F4
+    {
+        __m128 v;
+        F4(__m128 v) : v(v) { }
+        F4(float f) : v(_mm_set1_ps(f)) { }
+        F4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) { }
+        float operator[](int i) const { alignas(16) float f[4]; _mm_store_ps(f, v); return f[i]; }
+    };
+    inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+    inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+    inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+    // Comparisons return a lane mask
+    inline int operator>(F4 a, F4 b) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v)); }
+    inline int operator==(F4 a, F4 b) { return _mm_movemask_ps(_mm_cmpeq_ps(a.v, b.v)); }
+#else
+    struct F4
+    {
+        float v[4];
+        F4(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+        F4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+        float operator[](int i) const { return v[i]; }
+    };
+    template <typename Op>
+    inline F4 lanes(F4 a, F4 b, Op op)
+    {
+        return F4(op(a.v[0], b.v[0]), op(a.v[1], b.v[1]), op(a.v[2], b.v[2]), op(a.v[3], b.v[3]));
+    }
+    inline F4 operator+(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x + y; }); }
+    inline F4 operator-(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x - y; }); }
+    inline F4 operator*(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x * y; }); }
+    inline int operator>(F4 a, F4 b)
+    {
+        int m = 0;
+        for(int i = 0; i < 4; ++i)
+            m |= (a.v[i] > b.v[i]) << i;
+        return m;
+    }
+    inline int operator==(F4 a, F4 b)
+    {
+        int m = 0;
+        for(int i = 0; i < 4; ++i)
+            m |= (a.v[i] == b.v[i]) << i;
+        return m;
+    }
+#endif
+
+    struct Vertex
+    {
+        vec4 pos, normal;
+    };
+
+    Vertex interpolate(const Vertex &v1, const Vertex &v2, float a)
+    {
+        return { v1.pos + (v2.pos - v1.pos) * a, v1.normal + (v2.normal - v1.normal) * a };
+    }
+
+    float sign(float x)
+    {
+        return static_cast<float>((x > 0) - (x < 0));
+    }
+
+    // Same as lineSpaceIntersect in geometry.glsl
+    float lineSpaceIntersect(const Vertex &v1, const Vertex &v2)
+    {
+        float u = v2.pos.w - v1.pos.w;
+        return u != 0 ? -v1.pos.w / u : -1.f;
+    }
+
+    vec4 xyz1(const vec4 &v)
+    {
+        return vec4(v.x, v.y, v.z, 1.f);
+    }
+
+    uint32_t packColor(const vec4 &c)
+    {
+        auto channel = [](float f) { return static_cast<uint32_t>(std::min(std::max(f, 0.f), 1.f) * 255.f + 0.5f); };
+        return channel(c.x) | channel(c.y) << 8 | channel(c.z) << 16 | 0xff000000u;
+    }
+
+    // Triangles sliced from the nodes of a group are kept together
+    const size_t nodesPerGroup = 16;
+}
+
+SoftwareRenderer4::SoftwareRenderer4(ThreadPool &pool, int w, int h) : _pool(pool), _scratch(pool.size())
+{
+    resize(w, h);
+}
+
+void SoftwareRenderer4::resize(int w, int h)
+{
+    _w = w;
+    _h = h;
+    _tilesX = (w + tileSize - 1) / tileSize;
+    _tilesY = (h + tileSize - 1) / tileSize;
+    const size_t n = static_cast<size_t>(w) * h;
+    positions.assign(n, vec4::zero);
+    normals.assign(n, vec4::zero);
+    colors.assign(n, vec4::zero);
+    depth.assign(n, 1.f);
+    image.assign(n, 0);
+}
+
+void SoftwareRenderer4::render(SceneGraph4 &graph, const Transform4 &vt, const mat4 &p, const Light &light)
+{
+    PROFILE_ZONE("Software render");
+    stats = Stats();
+    for(Scratch &s : _scratch)
+        s.shadowRays = 0;
+
+    /// Vertex and slicing stages
+    graph.collectVisible(vt, p, _visible);
+    const mat4 tinvv = vt.normalMatrix();
+    const size_t groups = (_visible.size() + nodesPerGroup - 1) / nodesPerGroup;
+    if(_groupTriangles.size() < groups)
+        _groupTriangles.resize(groups);
+    _pool.parallelFor(groups, [&](size_t group, unsigned int worker)
+    {
+        PROFILE_ZONE("Slicing");
+        std::vector<Triangle> &out = _groupTriangles[group];
+        out.clear();
+        const size_t last = std::min(_visible.size(), (group + 1) * nodesPerGroup);
+        for(size_t i = group * nodesPerGroup; i < last; ++i)
+            sliceNode(graph, _visible[i], vt, tinvv, p, out, worker);
+    });
+    _triangles.clear();
+    for(size_t g = 0; g < groups; ++g)
+        _triangles.insert(_triangles.end(), _groupTriangles[g].begin(), _groupTriangles[g].end());
+    stats.triangles = static_cast<unsigned int>(_triangles.size());
+
+    /// Binning, by counting sort so that each tile lists its triangles in scene order
+    const int tiles = _tilesX * _tilesY;
+    auto tileRange = [&](const Triangle &t, int &tx0, int &ty0, int &tx1, int &ty1)
+    {
+        float x0 = std::min({ t.x[0], t.x[1], t.x[2] }), x1 = std::max({ t.x[0], t.x[1], t.x[2] }),
+            y0 = std::min({ t.y[0], t.y[1], t.y[2] }), y1 = std::max({ t.y[0], t.y[1], t.y[2] });
+        if(!(x1 >= 0 && y1 >= 0 && x0 < _w && y0 < _h))
+            return false;
+        tx0 = static_cast<int>(std::max(x0, 0.f)) / tileSize;
+        ty0 = static_cast<int>(std::max(y0, 0.f)) / tileSize;
+        tx1 = static_cast<int>(std::min(x1, _w - 1.f)) / tileSize;
+        ty1 = static_cast<int>(std::min(y1, _h - 1.f)) / tileSize;
+        return true;
+    };
+    _binStart.assign(tiles + 1, 0);
+    for(const Triangle &t : _triangles)
+    {
+        int tx0, ty0, tx1, ty1;
+        if(tileRange(t, tx0, ty0, tx1, ty1))
+            for(int ty = ty0; ty <= ty1; ++ty)
+                for(int tx = tx0; tx <= tx1; ++tx)
+                    _binStart[ty * _tilesX + tx + 1]++;
+    }
+    for(int k = 0; k < tiles; ++k)
+        _binStart[k + 1] += _binStart[k];
+    _binned.resize(_binStart[tiles]);
+    std::vector<uint32_t> cursor(_binStart.begin(), _binStart.end() - 1);
+    for(uint32_t i = 0; i < _triangles.size(); ++i)
+    {
+        int tx0, ty0, tx1, ty1;
+        if(tileRange(_triangles[i], tx0, ty0, tx1, ty1))
+            for(int ty = ty0; ty <= ty1; ++ty)
+                for(int tx = tx0; tx <= tx1; ++tx)
+                    _binned[cursor[ty * _tilesX + tx]++] = i;
+    }
+    stats.binned = static_cast<unsigned int>(_binned.size());
+
+    /// Rasterization, shadows and shading, tile by tile
+    if(shadows)
+        buildCasters(graph);
+    const Transform4 viewToWorld = vt.inverse();
+    const vec4 lightView = vt.apply(light.position);
+    _pool.parallelFor(tiles, [&](size_t tile, unsigned int worker)
+    {
+        rasterizeTile(static_cast<int>(tile));
+        shadeTile(static_cast<int>(tile), lightView, light.position, viewToWorld, light, worker);
+    });
+    for(const Scratch &s : _scratch)
+        stats.shadowRays += s.shadowRays;
+}
+
+void SoftwareRenderer4::sliceNode(const SceneGraph4 &graph, unsigned int node, const Transform4 &vt, const mat4 &tinvv,
+    const mat4 &p, std::vector<Triangle> &out, unsigned int worker)
+{
+    const Object4 &obj = *graph.objects[node];
+    const Geometry4 &geometry = obj.getRenderContext()->geometry;
+    if(geometry.normals.size() != geometry.vertices.size())
+        return;
+
+    // Vertex stage
+    Scratch &s = _scratch[worker];
+    const Transform4 mv = Transform4(graph.worldMats[node], graph.worldPos[node]).chain(vt);
+    TransformKernels::transformPoints(mv, geometry.vertices, s.positions);
+    TransformKernels::transformNormals(tinvv * graph.normalMats[node], geometry.normals, s.normals);
+    if(obj.insideOut)
+        for(vec4 &n : s.normals)
+            n *= -1.f;
+
+    // Slicing, following geometry.glsl
+    const size_t cells = geometry.isIndexed() ? geometry.cells.size() : geometry.vertices.size() / 4;
+    for(size_t c = 0; c < cells; ++c)
+    {
+        Vertex v[4];
+        for(int k = 0; k < 4; ++k)
+        {
+            unsigned int i = geometry.isIndexed() ? geometry.cells[c](k) : static_cast<unsigned int>(4 * c + k);
+            v[k] = { s.positions[i], s.normals[i] };
+        }
+
+        float v1v2 = -1, v1v3 = -1, v1v4 = -1, v2v3 = -1, v2v4 = -1, v3v4 = -1;
+        const float s1 = sign(v[0].pos.w), s2 = sign(v[1].pos.w), s3 = sign(v[2].pos.w), s4 = sign(v[3].pos.w);
+        // Cells entirely on one side are the vast majority
+        if(s1 == s2 && s2 == s3 && s3 == s4 && s1 != 0)
+            continue;
+
+        if(s1 == 0)
+            v1v2 = 0;
+        if(s2 == 0)
+            v2v3 = 0;
+        if(s3 == 0)
+            v3v4 = 0;
+        if(s4 == 0)
+            v1v4 = 1;
+
+        if(s1 * s2 == -1)
+            v1v2 = lineSpaceIntersect(v[0], v[1]);
+        if(s1 * s3 == -1)
+            v1v3 = lineSpaceIntersect(v[0], v[2]);
+        if(s1 * s4 == -1)
+            v1v4 = lineSpaceIntersect(v[0], v[3]);
+        if(s2 * s3 == -1)
+            v2v3 = lineSpaceIntersect(v[1], v[2]);
+        if(s2 * s4 == -1)
+            v2v4 = lineSpaceIntersect(v[1], v[3]);
+        if(s3 * s4 == -1)
+            v3v4 = lineSpaceIntersect(v[2], v[3]);
+
+        // The shader drops intersections past the fourth
+        Vertex r[4];
+        int i = 0;
+        auto push = [&](float a, int v1, int v2)
+        {
+            if(a >= 0)
+            {
+                if(i < 4)
+                    r[i] = interpolate(v[v1], v[v2], a);
+                i++;
+            }
+        };
+        push(v1v2, 0, 1);
+        push(v1v3, 0, 2);
+        push(v1v4, 0, 3);
+        push(v2v3, 1, 2);
+        push(v2v4, 1, 3);
+        push(v3v4, 2, 3);
+        if(i < 3)
+            continue;
+
+        if(i == 4)
+        {
+            // Order the quad's vertices around it ; acos is decreasing, so compare cosines
+            vec4 e12 = r[1].pos - r[0].pos, e23 = r[2].pos - r[1].pos, e24 = r[3].pos - r[1].pos;
+            float l12 = length(e12);
+            if(dot(e12, e23) / (l12 * length(e23)) < dot(e12, e24) / (l12 * length(e24)))
+                std::swap(r[2], r[3]);
+        }
+
+        // Projection of the w = 0 slice
+        vec4 clip[4], pos[4], nrm[4];
+        for(int k = 0; k < std::min(i, 4); ++k)
+        {
+            clip[k] = p * xyz1(r[k].pos);
+            pos[k] = r[k].pos;
+            nrm[k] = r[k].normal;
+        }
+        emitTriangle(clip, pos, nrm, obj.color, out);
+        // The slice of a tetrahedron by a hyperplane is planar, so the shader's
+        // tetrahedron case only ever adds triangles over the quad
+        if(i == 4)
+        {
+            const vec4 clip2[3] = { clip[0], clip[2], clip[3] }, pos2[3] = { pos[0], pos[2], pos[3] },
+                nrm2[3] = { nrm[0], nrm[2], nrm[3] };
+            emitTriangle(clip2, pos2, nrm2, obj.color, out);
+        }
+    }
+}
+
+void SoftwareRenderer4::emitTriangle(const vec4 clip[3], const vec4 pos[3], const vec4 nrm[3], const vec4 &color,
+    std::vector<Triangle> &out) const
+{
+    // Clip against the near plane z = -w, leaving at most a quad
+    vec4 c[4], ps[4], ns[4];
+    int n = 0;
+    for(int k = 0; k < 3; ++k)
+    {
+        const int l = (k + 1) % 3;
+        const float dk = clip[k].z + clip[k].w, dl = clip[l].z + clip[l].w;
+        if(dk >= 0)
+        {
+            c[n] = clip[k];
+            ps[n] = pos[k];
+            ns[n++] = nrm[k];
+        }
+        if((dk >= 0) != (dl >= 0))
+        {
+            const float a = dk / (dk - dl);
+            c[n] = clip[k] + (clip[l] - clip[k]) * a;
+            ps[n] = pos[k] + (pos[l] - pos[k]) * a;
+            ns[n++] = nrm[k] + (nrm[l] - nrm[k]) * a;
+        }
+    }
+
+    for(int k = 1; k + 1 < n; ++k)
+    {
+        const int idx[3] = { 0, k, k + 1 };
+        Triangle t;
+        for(int j = 0; j < 3; ++j)
+        {
+            const vec4 &v = c[idx[j]];
+            const float invW = 1.f / v.w;
+            t.x[j] = (v.x * invW * 0.5f + 0.5f) * _w;
+            t.y[j] = (v.y * invW * 0.5f + 0.5f) * _h;
+            t.z[j] = v.z * invW * 0.5f + 0.5f;
+            t.invW[j] = invW;
+            t.position[j] = ps[idx[j]];
+            t.normal[j] = ns[idx[j]];
+        }
+        t.color = color;
+        out.push_back(t);
+    }
+}
+
+void SoftwareRenderer4::rasterizeTile(int tile)
+{
+    PROFILE_ZONE("Rasterization");
+    const int x0 = (tile % _tilesX) * tileSize, y0 = (tile / _tilesX) * tileSize,
+        x1 = std::min(x0 + tileSize, _w), y1 = std::min(y0 + tileSize, _h);
+
+    for(int y = y0; y < y1; ++y)
+    {
+        const size_t row = static_cast<size_t>(y) * _w;
+        std::fill(positions.begin() + row + x0, positions.begin() + row + x1, vec4::zero);
+        std::fill(normals.begin() + row + x0, normals.begin() + row + x1, vec4::zero);
+        std::fill(colors.begin() + row + x0, colors.begin() + row + x1, vec4::zero);
+        std::fill(depth.begin() + row + x0, depth.begin() + row + x1, 1.f);
+    }
+
+    for(uint32_t b = _binStart[tile]; b < _binStart[tile + 1]; ++b)
+    {
+        const Triangle &t = _triangles[_binned[b]];
+        // Wind counter-clockwise, there is no culling
+        int v[3] = { 0, 1, 2 };
+        float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        if(area == 0 || std::isnan(area))
+            continue;
+        if(area < 0)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+
+        // Edge k is opposite vertex k, E(p) = A (px - xa) + B (py - ya) is
+        // positive inside, and ties go to one side of shared edges only
+        float ea[3], eb[3], ex[3], ey[3];
+        int tie[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            const int a = v[(k + 1) % 3], c = v[(k + 2) % 3];
+            ea[k] = t.y[a] - t.y[c];
+            eb[k] = t.x[c] - t.x[a];
+            ex[k] = t.x[a];
+            ey[k] = t.y[a];
+            tie[k] = ea[k] > 0 || (ea[k] == 0 && eb[k] > 0) ? 0xf : 0;
+        }
+
+        // Pixel centers covered by the bounding box, rows starting on 4-pixel boundaries
+        const float minX = std::min({ t.x[0], t.x[1], t.x[2] }), maxX = std::max({ t.x[0], t.x[1], t.x[2] }),
+            minY = std::min({ t.y[0], t.y[1], t.y[2] }), maxY = std::max({ t.y[0], t.y[1], t.y[2] });
+        const int bx0 = static_cast<int>(std::floor(std::max(minX - 0.5f, static_cast<float>(x0)))) & ~3,
+            bx1 = static_cast<int>(std::ceil(std::min(maxX + 0.5f, static_cast<float>(x1)))),
+            by0 = static_cast<int>(std::floor(std::max(minY - 0.5f, static_cast<float>(y0)))),
+            by1 = static_cast<int>(std::ceil(std::min(maxY + 0.5f, static_cast<float>(y1))));
+        const float invArea = 1.f / area;
+
+        for(int y = by0; y < by1; ++y)
+        {
+            const float py = y + 0.5f;
+            F4 rowE[3] = { eb[0] * (py - ey[0]), eb[1] * (py - ey[1]), eb[2] * (py - ey[2]) };
+            for(int x = bx0; x < bx1; x += 4)
+            {
+                const F4 px(x + 0.5f, x + 1.5f, x + 2.5f, x + 3.5f);
+                F4 e[3] = { F4(ea[0]) * (px - F4(ex[0])) + rowE[0], F4(ea[1]) * (px - F4(ex[1])) + rowE[1],
+                    F4(ea[2]) * (px - F4(ex[2])) + rowE[2] };
+                int mask = 0xf;
+                for(int k = 0; k < 3; ++k)
+                    mask &= (e[k] > F4(0.f)) | ((e[k] == F4(0.f)) & tie[k]);
+                // Lanes past the tile
+                mask &= (1 << std::min(4, x1 - x)) - 1;
+                for(; mask; mask &= mask - 1)
+                {
+                    const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+                    float bary[3];
+                    for(int k = 0; k < 3; ++k)
+                        bary[v[k]] = e[k][lane] * invArea;
+                    const float z = bary[0] * t.z[0] + bary[1] * t.z[1] + bary[2] * t.z[2];
+                    const size_t idx = static_cast<size_t>(y) * _w + x + lane;
+                    if(!(z < depth[idx]) || z < 0)
+                        continue;
+                    depth[idx] = z;
+
+                    // Perspective-correct interpolation
+                    const float w0 = bary[0] * t.invW[0], w1 = bary[1] * t.invW[1], w2 = bary[2] * t.invW[2],
+                        norm = 1.f / (w0 + w1 + w2);
+                    positions[idx] = (t.position[0] * w0 + t.position[1] * w1 + t.position[2] * w2) * norm;
+                    vec4 n = t.normal[0] * w0 + t.normal[1] * w1 + t.normal[2] * w2;
+                    float l = length(n);
+                    normals[idx] = l > 0 ? n / l : n;
+                    colors[idx] = vec4(t.color.x, t.color.y, t.color.z, 1.f);
+                }
+            }
+        }
+    }
+}
+
+void SoftwareRenderer4::shadeTile(int tile, const vec4 &lightView, const vec4 &lightWorld, const Transform4 &viewToWorld,
+    const Light &light, unsigned int worker)
+{
+    PROFILE_ZONE("Shading");
+    const int x0 = (tile % _tilesX) * tileSize, y0 = (tile / _tilesX) * tileSize,
+        x1 = std::min(x0 + tileSize, _w), y1 = std::min(y0 + tileSize, _h);
+    const float r4 = std::pow(light.radius, 4.f);
+
+    for(int y = y0; y < y1; ++y)
+        for(int x = x0; x < x1; ++x)
+        {
+            const size_t idx = static_cast<size_t>(y) * _w + x;
+            // Same as deferred_frag.glsl
+            const vec4 &pos = positions[idx];
+            const vec4 lightD = lightView - pos;
+            const float sqd = dot(lightD, lightD);
+            float falloff = std::min(std::max(1 - sqd * sqd / r4, 0.f), 1.f);
+            falloff *= falloff / (1 + sqd);
+            const float lambert = std::abs(dot(normals[idx], lightD / std::sqrt(sqd)));
+            vec4 color = colors[idx] * (std::min(1.f, light.intensity * falloff) * lambert);
+
+            // Only lit pixels need a shadow ray
+            if(shadows && depth[idx] < 1 && (color.x > 0 || color.y > 0 || color.z > 0)
+                && occluded(viewToWorld.apply(pos), lightWorld, worker))
+                color = vec4::zero;
+            image[idx] = packColor(color);
+        }
+}
+
+bool SoftwareRenderer4::occluded(const vec4 &p, const vec4 &light, unsigned int worker)
+{
+    Scratch &s = _scratch[worker];
+    s.shadowRays++;
+    // Start and stop a little away from both ends, to miss the receiving cell
+    const float epsilon = 1e-3f;
+    const vec4 d = light - p, o = p + d * epsilon;
+    const float tmax = 1 - 2 * epsilon;
+    s.casters.clear();
+    _casterBVH.queryRay(o, d, tmax, s.casters);
+    for(int k : s.casters)
+    {
+        const Caster &c = _casters[k];
+        if(c.bvh->occluded(c.worldToLocal.apply(o), c.worldToLocal.mat * d, tmax))
+            return true;
+    }
+    return false;
+}
+
+void SoftwareRenderer4::buildCasters(const SceneGraph4 &graph)
+{
+    PROFILE_ZONE("Shadow casters");
+    _casterNodes.clear();
+    std::vector<std::pair<const Geometry4*, std::unique_ptr<CellBVH4>*>> missing;
+    for(size_t k = 0; k < graph.size(); ++k)
+    {
+        const Object4 &obj = *graph.objects[k];
+        const Model4RenderContext *rc = obj.getRenderContext();
+        if(!obj.castShadows || !rc)
+            continue;
+        auto it = _cellBVHs.try_emplace(&rc->geometry);
+        if(it.second)
+            missing.push_back({ &rc->geometry, &it.first->second });
+        _casterNodes.push_back(static_cast<uint32_t>(k));
+    }
+
+    // Hierarchies of new geometries, then casters, are built in parallel
+    _pool.parallelFor(missing.size(), [&](size_t m, unsigned int)
+    {
+        *missing[m].second = std::make_unique<CellBVH4>(*missing[m].first);
+    }, 1);
+    _casters.resize(_casterNodes.size());
+    _casterBoxes.resize(_casterNodes.size());
+    _pool.parallelFor(_casterNodes.size(), [&](size_t c, unsigned int)
+    {
+        const uint32_t k = _casterNodes[c];
+        _casters[c] = { _cellBVHs.find(&graph.objects[k]->getRenderContext()->geometry)->second.get(),
+            Transform4(graph.worldMats[k], graph.worldPos[k]).inverse() };
+        const BoundingSphere4 &b = graph.worldBounds[k];
+        _casterBoxes[c] = AABB4(b.center, b.radius);
+    });
+    _casterBVH.build(_casterBoxes);
+}
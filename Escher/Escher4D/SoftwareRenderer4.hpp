@@ -0,0 +1,170 @@
+#ifndef INC_SOFTWARE_RENDERER4
+#define INC_SOFTWARE_RENDERER4
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/BVH4.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/ThreadPool.hpp"
+#include "Escher4D/Transform4.hpp"
+#include "Escher4D/meshes/CellBVH4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+/**
+ * CPU implementation of the whole 4D pipeline, needing no OpenGL at all : the
+ * vertex stage of `vertex.glsl`, the w = 0 slicing of `geometry.glsl`, the
+ * G-buffer writes of `fragment.glsl`, shadows and the shading of
+ * `deferred_frag.glsl`. Meant for batch rendering on machines without a GPU
+ * and for reproducible reference images.
+ *
+ * Visible nodes are transformed and sliced in parallel, the resulting triangles
+ * are binned into screen tiles, and each tile is then rasterized, shadowed and
+ * shaded by one worker of a thread pool. Edge functions are evaluated for 4
+ * pixels at a time with SSE when available. Triangles are binned in scene order,
+ * so the image does not depend on the amount of threads.
+ *
+ * Shadows are exact : for every pixel, a 4D ray is cast towards the light
+ * against the cells of the shadow casters, through a BVH over the casters'
+ * bounds and a `CellBVH4` per geometry. The latter are built the first time a
+ * geometry casts a shadow ; call `invalidate` when a geometry changes.
+ *
+ * Images follow OpenGL conventions : rows go from the bottom of the screen up.
+ */
+class SoftwareRenderer4
+{
+public:
+    struct Light
+    {
+        /**
+         * World-space position.
+         */
+        Empty::math::vec4 position;
+        float intensity = 10.f;
+        float radius = 20.f;
+    };
+
+    struct Stats
+    {
+        unsigned int triangles = 0;
+        /**
+         * Triangle references over all tiles.
+         */
+        unsigned int binned = 0;
+        unsigned int shadowRays = 0;
+    };
+
+    /**
+     * Side of the square screen tiles in pixels, a multiple of 4.
+     */
+    static const int tileSize = 32;
+
+    SoftwareRenderer4(ThreadPool &pool, int w = 1, int h = 1);
+
+    /**
+     * Changes the dimensions of the image.
+     */
+    void resize(int w, int h);
+
+    /**
+     * Renders the visible nodes of a graph whose world transforms are up to date.
+     * @param   vt      view transform
+     * @param   p       projection matrix, as given to `geometry.glsl`
+     */
+    void render(SceneGraph4 &graph, const Transform4 &vt, const Empty::math::mat4 &p, const Light &light);
+
+    /**
+     * Forgets the ray casting hierarchy of a geometry after its cells changed.
+     */
+    void invalidate(const Geometry4 &geometry) { _cellBVHs.erase(&geometry); }
+
+    int width() const { return _w; }
+    int height() const { return _h; }
+
+    /**
+     * G-buffer : view-space positions and normals, and colors. Pixels that no
+     * cell covers are zero, as in the GPU pipeline.
+     */
+    std::vector<Empty::math::vec4> positions, normals, colors;
+    /**
+     * Window depth in [0, 1], 1 where nothing was drawn.
+     */
+    std::vector<float> depth;
+    /**
+     * Shaded image as RGBA8, red in the low byte.
+     */
+    std::vector<uint32_t> image;
+
+    /**
+     * Whether to cast shadow rays.
+     */
+    bool shadows = true;
+
+    Stats stats;
+
+private:
+    // Screen-space triangle produced by the slicing stage
+    struct Triangle
+    {
+        // Window coordinates and depth, and 1 / w_clip
+        float x[3], y[3], z[3], invW[3];
+        // View-space attributes
+        Empty::math::vec4 position[3], normal[3];
+        Empty::math::vec4 color;
+    };
+
+    // Transforms and slices the cells of a node
+    void sliceNode(const SceneGraph4 &graph, unsigned int node, const Transform4 &vt, const Empty::math::mat4 &tinvv,
+        const Empty::math::mat4 &p, std::vector<Triangle> &out, unsigned int worker);
+    // Clips a triangle against the near plane, projects it and appends the result
+    void emitTriangle(const Empty::math::vec4 clip[3], const Empty::math::vec4 pos[3], const Empty::math::vec4 nrm[3],
+        const Empty::math::vec4 &color, std::vector<Triangle> &out) const;
+    // Rasterizes the binned triangles of a tile to the G-buffer
+    void rasterizeTile(int tile);
+    // Shadows and shades the pixels of a tile
+    void shadeTile(int tile, const Empty::math::vec4 &lightView, const Empty::math::vec4 &lightWorld,
+        const Transform4 &viewToWorld, const Light &light, unsigned int worker);
+    // Whether a world-space segment from p to the light is blocked by a caster
+    bool occluded(const Empty::math::vec4 &p, const Empty::math::vec4 &light, unsigned int worker);
+    // Prepares the casters' hierarchies for the frame
+    void buildCasters(const SceneGraph4 &graph);
+
+    ThreadPool &_pool;
+    int _w = 0, _h = 0, _tilesX = 0, _tilesY = 0;
+
+    // Visible nodes, in scene order, and their triangles by group of nodes
+    std::vector<unsigned int> _visible;
+    std::vector<std::vector<Triangle>> _groupTriangles;
+    // Triangles of tile t are _triangles[_binned[_binStart[t] ... _binStart[t + 1] - 1]]
+    std::vector<Triangle> _triangles;
+    std::vector<uint32_t> _binStart, _binned;
+
+    // Per worker scratch space
+    struct Scratch
+    {
+        std::vector<Empty::math::vec4> positions, normals;
+        std::vector<int> casters;
+        unsigned int shadowRays = 0;
+    };
+    std::vector<Scratch> _scratch;
+
+    // Shadow casters : geometry hierarchy and world-to-local transform
+    struct Caster
+    {
+        const CellBVH4 *bvh;
+        Transform4 worldToLocal;
+    };
+    std::vector<Caster> _casters;
+    // Node and box of each caster
+    std::vector<uint32_t> _casterNodes;
+    std::vector<AABB4> _casterBoxes;
+    BVH4 _casterBVH;
+    std::unordered_map<const Geometry4*, std::unique_ptr<CellBVH4>> _cellBVHs;
+};
+
+#endif
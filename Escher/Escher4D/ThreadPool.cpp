@@ -0,0 +1,338 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "Escher4D/Profiler.hpp"
+
+namespace
+{
+    // Pool and worker index of the calling thread, if it works for a pool
+    thread_local ThreadPool *currentPool = nullptr;
+    thread_local unsigned int currentWorker = 0;
+
+    // Ranges per worker that parallel loops aim for by default, so that
+    // uneven items balance out
+    const size_t rangesPerWorker = 8;
+    // Rounds idle workers look for jobs before going to sleep
+    const int spinRounds = 64;
+}
+
+/**
+ * Makes the calling thread a worker of a pool for its lifetime : threads that
+ * are not workers become worker 0, once the previous one is done.
+ */
+struct ThreadPool::Participant
+{
+    ThreadPool &pool;
+    ThreadPool *previousPool;
+    unsigned int previousWorker, worker;
+    std::unique_lock<std::mutex> lock;
+
+    explicit Participant(ThreadPool &p) : pool(p), previousPool(currentPool), previousWorker(currentWorker),
+        lock(p._participantMutex, std::defer_lock)
+    {
+        if(currentPool != &pool)
+        {
+            lock.lock();
+            currentPool = &pool;
+            currentWorker = 0;
+        }
+        worker = currentWorker;
+    }
+
+    ~Participant()
+    {
+        currentPool = previousPool;
+        currentWorker = previousWorker;
+    }
+};
+
+bool ThreadPool::Deque::push(Job *job)
+{
+    const int64_t b = _bottom.load(std::memory_order_relaxed), t = _top.load(std::memory_order_acquire);
+    if(b - t >= capacity)
+        return false;
+    _jobs[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+    _bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+ThreadPool::Job *ThreadPool::Deque::pop()
+{
+    const int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    if(t > b)
+    {
+        // Empty
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job *job = _jobs[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if(t == b)
+    {
+        // Last job, thieves may be after it too
+        if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+ThreadPool::Job *ThreadPool::Deque::steal()
+{
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = _bottom.load(std::memory_order_acquire);
+    if(t >= b)
+        return nullptr;
+    Job *job = _jobs[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    // Workers record their name there, so it must outlive them
+    Profiler::get();
+    if(!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned int k = 0; k < threads; ++k)
+    {
+        _workers.push_back(std::make_unique<Worker>());
+        _workers.back()->random = 2654435761u * (k + 1);
+    }
+    for(unsigned int k = 1; k < threads; ++k)
+        _threads.emplace_back(&ThreadPool::work, this, k);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for(std::thread &t : _threads)
+        t.join();
+}
+
+ThreadPool &ThreadPool::get()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, unsigned int)> &f, size_t grain)
+{
+    if(!count)
+        return;
+    if(!grain)
+        grain = std::max<size_t>(1, count / (size() * rangesPerWorker));
+
+    Participant participant(*this);
+    if(count <= grain)
+    {
+        for(size_t k = 0; k < count; ++k)
+            f(k, participant.worker);
+        return;
+    }
+
+    // Every range that is not split further is at least half a grain long,
+    // which bounds the amount of jobs
+    Loop loop;
+    loop.f = &f;
+    loop.grain = grain;
+    loop.jobs.resize(count / ((grain + 1) / 2) + 1);
+    JobCounter counter;
+    counter._pending.store(1, std::memory_order_relaxed);
+    Job &root = loop.jobs[loop.used++];
+    root = { &ThreadPool::runRange, &loop, 0, count, &counter };
+    runRange(*this, root, participant.worker);
+    help(counter, participant.worker);
+}
+
+void ThreadPool::submit(TaskGraph &graph, JobCounter &counter)
+{
+    if(graph._nodes.empty())
+        return;
+    counter._pending.fetch_add(graph._nodes.size(), std::memory_order_relaxed);
+    for(TaskGraph::Node &node : graph._nodes)
+    {
+        node.remaining.store(node.dependencies, std::memory_order_relaxed);
+        node.job = { &ThreadPool::runTask, &node, 0, 0, &counter };
+    }
+    for(TaskGraph::Node &node : graph._nodes)
+        if(!node.dependencies)
+            push(node.job);
+}
+
+void ThreadPool::wait(JobCounter &counter)
+{
+    if(counter.done())
+        return;
+    Participant participant(*this);
+    help(counter, participant.worker);
+}
+
+void ThreadPool::run(TaskGraph &graph)
+{
+    // Roots go to the deque of the waiting thread rather than the shared queue
+    Participant participant(*this);
+    JobCounter counter;
+    submit(graph, counter);
+    help(counter, participant.worker);
+}
+
+void ThreadPool::push(Job &job)
+{
+    _queued.fetch_add(1);
+    if(currentPool == this)
+    {
+        if(!_workers[currentWorker]->deque.push(&job))
+        {
+            _queued.fetch_sub(1);
+            job.run(*this, job, currentWorker);
+            return;
+        }
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(_sharedMutex);
+        _shared.push_back(&job);
+        _sharedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Workers count themselves as sleeping before checking for jobs one last
+    // time, so either they see this one or we see them
+    if(_sleeping.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _wake.notify_one();
+    }
+}
+
+ThreadPool::Job *ThreadPool::take(unsigned int worker)
+{
+    Job *job = _workers[worker]->deque.pop();
+    if(!job && _sharedCount.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(_sharedMutex);
+        if(!_shared.empty())
+        {
+            job = _shared.front();
+            _shared.pop_front();
+            _sharedCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    if(!job && _workers.size() > 1)
+    {
+        // Xorshift, so that thieves spread over victims
+        uint32_t &r = _workers[worker]->random;
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        const size_t n = _workers.size(), first = r % n;
+        for(size_t k = 0; !job && k < n; ++k)
+        {
+            const size_t victim = (first + k) % n;
+            if(victim != worker)
+                job = _workers[victim]->deque.steal();
+        }
+    }
+    if(job)
+        _queued.fetch_sub(1);
+    return job;
+}
+
+void ThreadPool::help(JobCounter &counter, unsigned int worker)
+{
+    while(!counter.done())
+    {
+        if(Job *job = take(worker))
+            job->run(*this, *job, worker);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::work(unsigned int worker)
+{
+    currentPool = this;
+    currentWorker = worker;
+    Profiler::get().setThreadName("worker " + std::to_string(worker));
+    for(;;)
+    {
+        if(Job *job = take(worker))
+        {
+            job->run(*this, *job, worker);
+            continue;
+        }
+        // Jobs tend to come in bursts
+        bool pending = false;
+        for(int k = 0; k < spinRounds && !pending; ++k)
+        {
+            std::this_thread::yield();
+            pending = _queued.load() > 0;
+        }
+        if(pending)
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleeping.fetch_add(1);
+        _wake.wait(lock, [this]() { return _quit || _queued.load() > 0; });
+        _sleeping.fetch_sub(1);
+        if(_quit)
+            return;
+    }
+}
+
+void ThreadPool::runRange(ThreadPool &pool, Job &job, unsigned int worker)
+{
+    Loop &loop = *static_cast<Loop*>(job.data);
+    size_t begin = job.begin, end = job.end;
+    // Hand the upper half out until the rest is small enough
+    while(end - begin > loop.grain)
+    {
+        const size_t mid = begin + (end - begin) / 2;
+        Job &half = loop.jobs[loop.used.fetch_add(1, std::memory_order_relaxed)];
+        half = { &ThreadPool::runRange, &loop, mid, end, job.counter };
+        job.counter->_pending.fetch_add(1, std::memory_order_relaxed);
+        pool.push(half);
+        end = mid;
+    }
+    for(size_t k = begin; k < end; ++k)
+        (*loop.f)(k, worker);
+    finish(job);
+}
+
+void ThreadPool::runTask(ThreadPool &pool, Job &job, unsigned int worker)
+{
+    TaskGraph::Node &node = *static_cast<TaskGraph::Node*>(job.data);
+    node.task(worker);
+    for(TaskGraph::Node *next : node.successors)
+        if(next->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            pool.push(next->job);
+    finish(job);
+}
+
+void ThreadPool::finish(Job &job)
+{
+    // The job may be gone as soon as its counter drops
+    job.counter->_pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+size_t TaskGraph::add(Task task)
+{
+    _nodes.emplace_back();
+    _nodes.back().task = std::move(task);
+    return _nodes.size() - 1;
+}
+
+void TaskGraph::precede(size_t before, size_t after)
+{
+    _nodes[before].successors.push_back(&_nodes[after]);
+    _nodes[after].dependencies++;
+}
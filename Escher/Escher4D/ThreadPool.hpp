@@ -0,0 +1,219 @@
+#ifndef INC_THREAD_POOL
+#define INC_THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGraph;
+
+/**
+ * Amount of jobs left of some work submitted to a `ThreadPool`.
+ */
+class JobCounter
+{
+public:
+    bool done() const { return _pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+
+    std::atomic<size_t> _pending{0};
+};
+
+/**
+ * Work-stealing job scheduler shared by the engine, see `get`.
+ *
+ * Every worker owns a Chase-Lev deque : it pushes and pops jobs at one end
+ * without locking, while idle workers steal from the other end. Jobs spawned
+ * by a job thus stay on the same worker and its caches unless another one
+ * runs out of work. Idle workers spin briefly, then sleep until jobs come in.
+ *
+ * Waiting for work, with `parallelFor`, `run` or `wait`, never blocks a
+ * worker : the waiting thread runs pending jobs until the work it waits for is
+ * done, so jobs can wait for other jobs. Threads that are not workers of the
+ * pool, such as the main thread, take part in the work as worker 0 while they
+ * wait ; they take turns doing so, one at a time.
+ *
+ * Which worker runs which job is not deterministic : results should only
+ * depend on job data, not on worker indices. Jobs must not throw.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @param   threads amount of workers including the waiting thread, 0 for
+     *                  one per hardware thread
+     */
+    explicit ThreadPool(unsigned int threads = 0);
+    /**
+     * Every job must be done.
+     */
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    /**
+     * Pool with one worker per hardware thread, created on first use. Engine
+     * subsystems run their jobs there rather than on threads of their own.
+     */
+    static ThreadPool &get();
+
+    /**
+     * Calls f(item, worker) for every item in [0, count), worker being in
+     * [0, size()), and returns once every item is done. Items are split in
+     * halves on demand, so that idle workers steal large ranges first, down to
+     * ranges of `grain` items.
+     * @param   grain   items below which ranges are not split further, 0 to
+     *                  aim for a few ranges per worker
+     */
+    void parallelFor(size_t count, const std::function<void(size_t item, unsigned int worker)> &f, size_t grain = 0);
+
+    /**
+     * Schedules the tasks of a graph and counts them in a counter. The graph
+     * and the counter must outlive the tasks, and the graph must not change
+     * until they are done.
+     */
+    void submit(TaskGraph &graph, JobCounter &counter);
+    /**
+     * Runs pending jobs until a counter drops to zero.
+     */
+    void wait(JobCounter &counter);
+    /**
+     * Runs every task of a graph and returns once they are done.
+     */
+    void run(TaskGraph &graph);
+
+    /**
+     * Amount of workers, the waiting thread included.
+     */
+    unsigned int size() const { return static_cast<unsigned int>(_workers.size()); }
+
+private:
+    friend class TaskGraph;
+    struct Participant;
+
+    struct Job
+    {
+        // Runs the job, then accounts for it in its counter
+        void (*run)(ThreadPool &pool, Job &job, unsigned int worker);
+        void *data;
+        size_t begin, end;
+        JobCounter *counter;
+    };
+
+    /**
+     * Chase-Lev deque with a fixed capacity ; see "Correct and Efficient
+     * Work-Stealing for Weak Memory Models", Lê et al., 2013.
+     */
+    class Deque
+    {
+    public:
+        static const int64_t capacity = 1 << 12;
+
+        // Owner only ; false if full
+        bool push(Job *job);
+        // Owner only
+        Job *pop();
+        // Any thread ; null if empty or if another thread won the race
+        Job *steal();
+
+    private:
+        std::atomic<int64_t> _top{0}, _bottom{0};
+        std::atomic<Job*> _jobs[capacity];
+    };
+
+    // Deques go on separate cache lines
+    struct alignas(64) Worker
+    {
+        Deque deque;
+        uint32_t random;
+    };
+
+    // State of a parallel loop
+    struct Loop
+    {
+        const std::function<void(size_t, unsigned int)> *f;
+        size_t grain;
+        std::vector<Job> jobs;
+        std::atomic<size_t> used{0};
+    };
+
+    // Makes a job available to the workers, or runs it right away if the
+    // calling worker's deque is full
+    void push(Job &job);
+    // Takes a job from the worker's deque, the shared queue or another worker
+    Job *take(unsigned int worker);
+    // Runs jobs until the counter drops to zero
+    void help(JobCounter &counter, unsigned int worker);
+    // Body of the worker threads
+    void work(unsigned int worker);
+
+    static void runRange(ThreadPool &pool, Job &job, unsigned int worker);
+    static void runTask(ThreadPool &pool, Job &job, unsigned int worker);
+    static void finish(Job &job);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    // Jobs pushed by threads that are not workers
+    std::mutex _sharedMutex;
+    std::deque<Job*> _shared;
+    std::atomic<size_t> _sharedCount{0};
+    // Held by the thread acting as worker 0
+    std::mutex _participantMutex;
+    // Jobs pushed and not taken yet, which idle workers sleep until
+    std::atomic<size_t> _queued{0};
+    std::atomic<unsigned int> _sleeping{0};
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+    bool _quit = false;
+};
+
+/**
+ * Tasks and dependencies between them, run by a `ThreadPool`. Each task counts
+ * the tasks it still waits for, and is scheduled by the one that brings that
+ * count down to zero. A graph can be run again once done, and must not have
+ * cycles.
+ */
+class TaskGraph
+{
+public:
+    using Task = std::function<void(unsigned int worker)>;
+
+    /**
+     * Adds a task and returns its index.
+     */
+    size_t add(Task task);
+    /**
+     * Makes a task wait for another one to be done before starting.
+     */
+    void precede(size_t before, size_t after);
+
+    size_t size() const { return _nodes.size(); }
+    void clear() { _nodes.clear(); }
+
+private:
+    friend class ThreadPool;
+
+    struct Node
+    {
+        Task task;
+        std::vector<Node*> successors;
+        unsigned int dependencies = 0;
+        // Dependencies not done yet in the current run
+        std::atomic<unsigned int> remaining{0};
+        ThreadPool::Job job;
+    };
+
+    // Never moves its elements
+    std::deque<Node> _nodes;
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef INC_TRANSFORM4
 #define INC_TRANSFORM4
 
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <vector>
 
 #include <Empty/math/funcs.h>
@@ -10,20 +12,51 @@
 #include "Escher4D/Rotor4.hpp"
 #include "Escher4D/utils.hpp"
 
-enum Planes4
-{
-    XY = 0x01,
-    XZ = 0x02,
-    XW = 0x03,
-    YZ = 0x12,
-    YW = 0x13,
-    ZW = 0x23
-};
-
 struct Transform4
 {
+    /**
+     * Classes of linear parts, from cheapest to most expensive to invert.
+     */
+    enum Kind
+    {
+        /// Orthonormal linear part, ie rotations and reflections
+        Rigid,
+        /// Orthogonal rows or columns, ie per-axis scaling before or after a rigid transform
+        ScaledOrthogonal,
+        /// Anything else
+        General
+    };
+    
     Transform4() { mat = Empty::math::mat4::Identity(); pos = Empty::math::vec4(0, 0, 0, 0); }
     Transform4(const Empty::math::mat4 &m, const Empty::math::vec4 &t) : mat(m), pos(t) { }
+    Transform4(const Transform4&) = default;
+    /**
+     * Copies the transform of another one. The version is bumped rather than
+     * copied, since copying it could bring it back to a value that cached data
+     * was derived from.
+     */
+    Transform4 &operator=(const Transform4 &t)
+    {
+        mat = t.mat;
+        pos = t.pos;
+        return touch();
+    }
+    
+    /**
+     * Marks the transform as modified. The member functions of this class do it
+     * automatically ; call this after writing to `mat` or `pos` directly so that
+     * cached data derived from the transform gets updated.
+     */
+    Transform4 &touch()
+    {
+        ++_version;
+        return *this;
+    }
+    
+    /**
+     * Returns a counter that changes every time the transform is modified.
+     */
+    unsigned int version() const { return _version; }
     
     /**
      * Applies this transform to a vector.
@@ -33,6 +66,121 @@ struct Transform4
         return mat * v + pos;
     }
     
+    /**
+     * Classifies the linear part of the transform.
+     * @param   epsilon     relative tolerance for the orthogonality tests
+     */
+    Kind classify(float epsilon = 1e-5f) const
+    {
+        using namespace Empty::math;
+        const vec4 c[4] = { mat.column(0), mat.column(1), mat.column(2), mat.column(3) };
+        if(isOrthogonal(c, epsilon))
+        {
+            for(int k = 0; k < 4; ++k)
+                if(std::abs(dot(c[k], c[k]) - 1.f) > epsilon)
+                    return ScaledOrthogonal;
+            return Rigid;
+        }
+        const mat4 t = transpose(mat);
+        const vec4 r[4] = { t.column(0), t.column(1), t.column(2), t.column(3) };
+        return isOrthogonal(r, epsilon) ? ScaledOrthogonal : General;
+    }
+    
+    /**
+     * Computes the inverse of the linear part using the closed form that suits
+     * its class.
+     * @param   kind    class of the linear part, as returned by `classify`
+     */
+    Empty::math::mat4 inverseLinear(Kind kind) const
+    {
+        using namespace Empty::math;
+        switch(kind)
+        {
+        case Rigid:
+            return transpose(mat);
+        case ScaledOrthogonal:
+        {
+            // Orthogonal columns : M^-1 = diag(1 / |c_k|^2) M^T
+            // Orthogonal rows : M^-1 = M^T diag(1 / |r_k|^2)
+            const vec4 c[4] = { mat.column(0), mat.column(1), mat.column(2), mat.column(3) };
+            mat4 inv = transpose(mat);
+            if(isOrthogonal(c, 1e-5f))
+            {
+                for(int i = 0; i < 4; ++i)
+                {
+                    float s = 1.f / dot(c[i], c[i]);
+                    for(int j = 0; j < 4; ++j)
+                        inv(i, j) *= s;
+                }
+            }
+            else
+            {
+                for(int j = 0; j < 4; ++j)
+                    inv.column(j) /= dot(inv.column(j), inv.column(j));
+            }
+            return inv;
+        }
+        default:
+            return Empty::math::inverse(mat);
+        }
+    }
+    Empty::math::mat4 inverseLinear() const { return inverseLinear(classify()); }
+    
+    /**
+     * Computes the matrix that transforms normal vectors, ie the inverse transpose
+     * of the linear part.
+     * @param   kind    class of the linear part, as returned by `classify`
+     */
+    Empty::math::mat4 normalMatrix(Kind kind) const
+    {
+        return kind == Rigid ? mat : Empty::math::transpose(inverseLinear(kind));
+    }
+    Empty::math::mat4 normalMatrix() const { return normalMatrix(classify()); }
+    
+    /**
+     * Returns an upper bound of the factor by which the transform can stretch
+     * lengths, ie the largest singular value of the linear part. Exact for rigid
+     * and scaled-orthogonal transforms.
+     * @param   kind    class of the linear part, as returned by `classify`
+     */
+    float maxScale(Kind kind) const
+    {
+        if(kind == Rigid)
+            return 1.f;
+        float maxCol = 0, maxRow = 0;
+        for(int i = 0; i < 4; ++i)
+        {
+            float col = 0, row = 0;
+            for(int j = 0; j < 4; ++j)
+            {
+                if(kind == ScaledOrthogonal)
+                {
+                    col += mat(j, i) * mat(j, i);
+                    row += mat(i, j) * mat(i, j);
+                }
+                else
+                {
+                    col += std::abs(mat(j, i));
+                    row += std::abs(mat(i, j));
+                }
+            }
+            maxCol = std::max(maxCol, col);
+            maxRow = std::max(maxRow, row);
+        }
+        // For scaled-orthogonal transforms, the largest row or column norm is the
+        // largest scaling factor ; otherwise use ||M||_2 <= sqrt(||M||_1 ||M||_inf)
+        return kind == ScaledOrthogonal ? std::sqrt(std::max(maxCol, maxRow)) : std::sqrt(maxCol * maxRow);
+    }
+    
+    /**
+     * Computes the inverse of this transform.
+     */
+    Transform4 inverse() const
+    {
+        Empty::math::mat4 m = inverseLinear();
+        return Transform4(m, -(m * pos));
+    }
+    
     /**
      * Chains a transform to this one, resulting in a new transform that applies
      * this transform, then the other transform.
@@ -52,13 +200,13 @@ struct Transform4
         for(int k = 0; k < 4; ++k)
             s(k, k) = factor(k);
         mat = s * mat;
-        return *this;
+        return touch();
     }
     
     Transform4 &scale(float factor)
     {
         mat *= factor;
-        return *this;
+        return touch();
     }
     
     /**
@@ -68,14 +216,25 @@ struct Transform4
      */
     Transform4 &rotate(Planes4 p, float angle)
     {
-        Empty::math::mat4 r = Empty::math::mat4::Identity();
+        // Only rows i and j of the product with the rotation matrix change
         int i = p >> 4, j = p & 0xf;
         float c = cos(angle), s = sin(angle);
-        r(i, i) = r(j, j) = c;
-        r(i, j) = -s;
-        r(j, i) = s;
-        mat = r * mat;
-        return *this;
+        for(int k = 0; k < 4; ++k)
+        {
+            float mi = mat(i, k), mj = mat(j, k);
+            mat(i, k) = c * mi - s * mj;
+            mat(j, k) = s * mi + c * mj;
+        }
+        return touch();
+    }
+    
+    /**
+     * Appends a rotation described by a rotor to the current transform.
+     */
+    Transform4 &rotate(const Rotor4 &r)
+    {
+        mat = r.toMatrix() * mat;
+        return touch();
     }
     
     /**
@@ -95,18 +254,97 @@ struct Transform4
         r.column(3) = Empty::math::normalize(MathUtil::cross4(r.column(0), r.column(1), at));
         
         mat = r;
-        return *this;
+        return touch();
     }
     
     /**
      * Linear component of the transform.
      */
     Empty::math::mat4 mat;
-    // Rotor4 mat;
     /**
      * Translation component of the transform.
      */
     Empty::math::vec4 pos;
+    
+private:
+    // Tests whether 4 vectors are pairwise orthogonal up to a relative tolerance
+    static bool isOrthogonal(const Empty::math::vec4 *v, float epsilon)
+    {
+        for(int i = 0; i < 4; ++i)
+            for(int j = i + 1; j < 4; ++j)
+            {
+                float d = Empty::math::dot(v[i], v[j]);
+                if(d * d > epsilon * epsilon * Empty::math::dot(v[i], v[i]) * Empty::math::dot(v[j], v[j]))
+                    return false;
+            }
+        return true;
+    }
+    
+    unsigned int _version = 0;
+};
+
+/**
+ * Alternative representation of a transform as a rotor, a uniform scale and a
+ * translation, applied in that order. Composing and re-orthonormalizing such
+ * transforms is cheaper than with matrices, and renormalizing the rotor removes
+ * the drift that accumulates over long chains of incremental rotations. Applying
+ * them is not : transforms that are applied to many vectors should be converted
+ * with `toTransform4` first. Per-axis scaling is not representable since it does
+ * not commute with rotations.
+ */
+struct RotorTransform4
+{
+    RotorTransform4() : scale(1), pos(0, 0, 0, 0) { }
+    RotorTransform4(const Rotor4 &r, float s, const Empty::math::vec4 &t) : rotor(r), scale(s), pos(t) { }
+    
+    /**
+     * Applies this transform to a vector through the sandwich product.
+     */
+    Empty::math::vec4 apply(const Empty::math::vec4 &v) const
+    {
+        return rotor.apply(v) * scale + pos;
+    }
+    
+    /**
+     * Chains a transform to this one, resulting in a new transform that applies
+     * this transform, then the other transform.
+     */
+    RotorTransform4 chain(const RotorTransform4 &b) const
+    {
+        return RotorTransform4(b.rotor * rotor, b.scale * scale, b.apply(pos));
+    }
+    
+    /**
+     * Appends a rotation to the current transform.
+     * @param   p       plane of rotation
+     * @param   angle   angle of rotation
+     */
+    RotorTransform4 &rotate(Planes4 p, float angle)
+    {
+        rotor = Rotor4::rotation(p, angle) * rotor;
+        return *this;
+    }
+    
+    /**
+     * Removes numerical drift from the rotational part.
+     */
+    RotorTransform4 &renormalize()
+    {
+        rotor.normalize();
+        return *this;
+    }
+    
+    /**
+     * Converts to the matrix representation.
+     */
+    Transform4 toTransform4() const
+    {
+        return Transform4(rotor.toMatrix() * scale, pos);
+    }
+    
+    Rotor4 rotor;
+    float scale;
+    Empty::math::vec4 pos;
 };
 
 #endif
@@ -0,0 +1,355 @@
+#include "TransformKernels.hpp"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ESCHER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles intrinsics for any instruction set without extra flags
+#define ESCHER_TARGET_AVX2
+#else
+#define ESCHER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+using namespace Empty::math;
+
+static_assert(sizeof(vec4) == 4 * sizeof(float), "Kernels expect vec4 to be 4 packed floats");
+
+namespace TransformKernels
+{
+    namespace
+    {
+        // Matrix columns and translation copied to plain arrays, so that the
+        // kernels do not depend on the memory layout of mat4
+        struct Coefs
+        {
+            alignas(32) float c[4][4];
+            alignas(16) float t[4];
+
+            Coefs(const mat4 &m, const vec4 &pos)
+            {
+                for(int j = 0; j < 4; ++j)
+                {
+                    for(int i = 0; i < 4; ++i)
+                        c[j][i] = m(i, j);
+                    t[j] = pos(j);
+                }
+            }
+        };
+
+        Isa detect()
+        {
+#ifdef ESCHER_X86
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            if(info[0] >= 7)
+            {
+                __cpuid(info, 1);
+                bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+                __cpuidex(info, 7, 0);
+                bool avx2 = (info[1] & (1 << 5)) != 0;
+                // Also check that the OS saves YMM registers
+                if(fma && avx2 && osxsave && (_xgetbv(0) & 6) == 6)
+                    return Isa::AVX2;
+            }
+            return Isa::SSE;
+#else
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return Isa::AVX2;
+            return __builtin_cpu_supports("sse2") ? Isa::SSE : Isa::Scalar;
+#endif
+#else
+            return Isa::Scalar;
+#endif
+        }
+
+        const Isa supported = detect();
+        Isa active = supported;
+
+        /// Scalar kernels
+
+        void pointsScalar(const Coefs &k, const float *in, float *out, size_t n)
+        {
+            for(size_t v = 0; v < n; ++v, in += 4, out += 4)
+            {
+                float x = in[0], y = in[1], z = in[2], w = in[3];
+                for(int i = 0; i < 4; ++i)
+                    out[i] = k.c[0][i] * x + k.c[1][i] * y + k.c[2][i] * z + k.c[3][i] * w + k.t[i];
+            }
+        }
+
+        void normalsScalar(const Coefs &k, const float *in, float *out, size_t n, bool renormalize)
+        {
+            for(size_t v = 0; v < n; ++v, in += 4, out += 4)
+            {
+                float x = in[0], y = in[1], z = in[2], w = in[3], r[4];
+                for(int i = 0; i < 4; ++i)
+                    r[i] = k.c[0][i] * x + k.c[1][i] * y + k.c[2][i] * z + k.c[3][i] * w;
+                float s = renormalize ? 1.f / std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]) : 1.f;
+                for(int i = 0; i < 4; ++i)
+                    out[i] = r[i] * s;
+            }
+        }
+
+        void blocksScalar(const Coefs &k, const Vec4x8 *in, Vec4x8 *out, size_t blocks)
+        {
+            for(size_t b = 0; b < blocks; ++b)
+            {
+                Vec4x8 r;
+                for(int l = 0; l < 8; ++l)
+                {
+                    float x = in[b].x[l], y = in[b].y[l], z = in[b].z[l], w = in[b].w[l];
+                    r.x[l] = k.c[0][0] * x + k.c[1][0] * y + k.c[2][0] * z + k.c[3][0] * w + k.t[0];
+                    r.y[l] = k.c[0][1] * x + k.c[1][1] * y + k.c[2][1] * z + k.c[3][1] * w + k.t[1];
+                    r.z[l] = k.c[0][2] * x + k.c[1][2] * y + k.c[2][2] * z + k.c[3][2] * w + k.t[2];
+                    r.w[l] = k.c[0][3] * x + k.c[1][3] * y + k.c[2][3] * z + k.c[3][3] * w + k.t[3];
+                }
+                out[b] = r;
+            }
+        }
+
+#ifdef ESCHER_X86
+        /// SSE kernels : one vector per register, components broadcast by shuffling
+
+        inline __m128 mulSSE(const __m128 c[4], __m128 v)
+        {
+            __m128 r = _mm_mul_ps(c[0], _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+            r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+            r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+            return _mm_add_ps(r, _mm_mul_ps(c[3], _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+        }
+
+        void pointsSSE(const Coefs &k, const float *in, float *out, size_t n)
+        {
+            const __m128 c[4] = { _mm_load_ps(k.c[0]), _mm_load_ps(k.c[1]), _mm_load_ps(k.c[2]), _mm_load_ps(k.c[3]) },
+                t = _mm_load_ps(k.t);
+            for(size_t v = 0; v < n; ++v)
+                _mm_storeu_ps(out + 4 * v, _mm_add_ps(mulSSE(c, _mm_loadu_ps(in + 4 * v)), t));
+        }
+
+        void normalsSSE(const Coefs &k, const float *in, float *out, size_t n, bool renormalize)
+        {
+            const __m128 c[4] = { _mm_load_ps(k.c[0]), _mm_load_ps(k.c[1]), _mm_load_ps(k.c[2]), _mm_load_ps(k.c[3]) };
+            for(size_t v = 0; v < n; ++v)
+            {
+                __m128 r = mulSSE(c, _mm_loadu_ps(in + 4 * v));
+                if(renormalize)
+                {
+                    // Horizontal sum of squares, broadcast to all lanes
+                    __m128 sq = _mm_mul_ps(r, r);
+                    sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+                    sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+                    r = _mm_div_ps(r, _mm_sqrt_ps(sq));
+                }
+                _mm_storeu_ps(out + 4 * v, r);
+            }
+        }
+
+        void blocksSSE(const Coefs &k, const Vec4x8 *in, Vec4x8 *out, size_t blocks)
+        {
+            __m128 m[4][4], t[4];
+            for(int i = 0; i < 4; ++i)
+            {
+                for(int j = 0; j < 4; ++j)
+                    m[i][j] = _mm_set1_ps(k.c[j][i]);
+                t[i] = _mm_set1_ps(k.t[i]);
+            }
+            for(size_t b = 0; b < blocks; ++b)
+            {
+                const float *src[4] = { in[b].x, in[b].y, in[b].z, in[b].w };
+                for(int h = 0; h < 8; h += 4)
+                {
+                    __m128 x = _mm_load_ps(src[0] + h), y = _mm_load_ps(src[1] + h),
+                        z = _mm_load_ps(src[2] + h), w = _mm_load_ps(src[3] + h), r[4];
+                    for(int i = 0; i < 4; ++i)
+                        r[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[i][0], x), _mm_mul_ps(m[i][1], y)),
+                            _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[i][2], z), _mm_mul_ps(m[i][3], w)), t[i]));
+                    _mm_store_ps(out[b].x + h, r[0]);
+                    _mm_store_ps(out[b].y + h, r[1]);
+                    _mm_store_ps(out[b].z + h, r[2]);
+                    _mm_store_ps(out[b].w + h, r[3]);
+                }
+            }
+        }
+
+        /// AVX2 kernels : two vectors per register, components broadcast within lanes
+
+        ESCHER_TARGET_AVX2 inline __m256 mulAVX2(const __m256 c[4], __m256 v)
+        {
+            __m256 r = _mm256_mul_ps(c[0], _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0)));
+            r = _mm256_fmadd_ps(c[1], _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1)), r);
+            r = _mm256_fmadd_ps(c[2], _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)), r);
+            return _mm256_fmadd_ps(c[3], _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3)), r);
+        }
+
+        ESCHER_TARGET_AVX2 void pointsAVX2(const Coefs &k, const float *in, float *out, size_t n)
+        {
+            const __m256 c[4] = { _mm256_broadcast_ps((const __m128 *)k.c[0]), _mm256_broadcast_ps((const __m128 *)k.c[1]),
+                _mm256_broadcast_ps((const __m128 *)k.c[2]), _mm256_broadcast_ps((const __m128 *)k.c[3]) },
+                t = _mm256_broadcast_ps((const __m128 *)k.t);
+            size_t v = 0;
+            for(; v + 2 <= n; v += 2)
+                _mm256_storeu_ps(out + 4 * v, _mm256_add_ps(mulAVX2(c, _mm256_loadu_ps(in + 4 * v)), t));
+            if(v < n)
+                pointsSSE(k, in + 4 * v, out + 4 * v, n - v);
+        }
+
+        ESCHER_TARGET_AVX2 void normalsAVX2(const Coefs &k, const float *in, float *out, size_t n, bool renormalize)
+        {
+            const __m256 c[4] = { _mm256_broadcast_ps((const __m128 *)k.c[0]), _mm256_broadcast_ps((const __m128 *)k.c[1]),
+                _mm256_broadcast_ps((const __m128 *)k.c[2]), _mm256_broadcast_ps((const __m128 *)k.c[3]) };
+            size_t v = 0;
+            for(; v + 2 <= n; v += 2)
+            {
+                __m256 r = mulAVX2(c, _mm256_loadu_ps(in + 4 * v));
+                if(renormalize)
+                    r = _mm256_div_ps(r, _mm256_sqrt_ps(_mm256_dp_ps(r, r, 0xff)));
+                _mm256_storeu_ps(out + 4 * v, r);
+            }
+            if(v < n)
+                normalsSSE(k, in + 4 * v, out + 4 * v, n - v, renormalize);
+        }
+
+        ESCHER_TARGET_AVX2 void blocksAVX2(const Coefs &k, const Vec4x8 *in, Vec4x8 *out, size_t blocks)
+        {
+            __m256 m[4][4], t[4];
+            for(int i = 0; i < 4; ++i)
+            {
+                for(int j = 0; j < 4; ++j)
+                    m[i][j] = _mm256_set1_ps(k.c[j][i]);
+                t[i] = _mm256_set1_ps(k.t[i]);
+            }
+            for(size_t b = 0; b < blocks; ++b)
+            {
+                __m256 x = _mm256_load_ps(in[b].x), y = _mm256_load_ps(in[b].y),
+                    z = _mm256_load_ps(in[b].z), w = _mm256_load_ps(in[b].w), r[4];
+                for(int i = 0; i < 4; ++i)
+                    r[i] = _mm256_fmadd_ps(m[i][3], w, _mm256_fmadd_ps(m[i][2], z,
+                        _mm256_fmadd_ps(m[i][1], y, _mm256_fmadd_ps(m[i][0], x, t[i]))));
+                _mm256_store_ps(out[b].x, r[0]);
+                _mm256_store_ps(out[b].y, r[1]);
+                _mm256_store_ps(out[b].z, r[2]);
+                _mm256_store_ps(out[b].w, r[3]);
+            }
+        }
+#endif
+    }
+
+    Isa supportedIsa()
+    {
+        return supported;
+    }
+
+    Isa activeIsa()
+    {
+        return active;
+    }
+
+    Isa setIsa(Isa isa)
+    {
+        active = static_cast<int>(isa) > static_cast<int>(supported) ? supported : isa;
+        return active;
+    }
+
+    void transformPoints(const Transform4 &t, const vec4 *in, vec4 *out, size_t n)
+    {
+        Coefs k(t.mat, t.pos);
+        const float *src = &in[0].x;
+        float *dst = &out[0].x;
+        switch(active)
+        {
+#ifdef ESCHER_X86
+        case Isa::AVX2:
+            pointsAVX2(k, src, dst, n);
+            break;
+        case Isa::SSE:
+            pointsSSE(k, src, dst, n);
+            break;
+#endif
+        default:
+            pointsScalar(k, src, dst, n);
+        }
+    }
+
+    void transformPoints(const Transform4 &t, const std::vector<vec4> &in, std::vector<vec4> &out)
+    {
+        out.resize(in.size());
+        if(!in.empty())
+            transformPoints(t, in.data(), out.data(), in.size());
+    }
+
+    void transformPoints(const Transform4 &t, const Vec4x8 *in, Vec4x8 *out, size_t blocks)
+    {
+        Coefs k(t.mat, t.pos);
+        switch(active)
+        {
+#ifdef ESCHER_X86
+        case Isa::AVX2:
+            blocksAVX2(k, in, out, blocks);
+            break;
+        case Isa::SSE:
+            blocksSSE(k, in, out, blocks);
+            break;
+#endif
+        default:
+            blocksScalar(k, in, out, blocks);
+        }
+    }
+
+    void transformNormals(const mat4 &normalMat, const vec4 *in, vec4 *out, size_t n, bool renormalize)
+    {
+        Coefs k(normalMat, vec4::zero);
+        const float *src = &in[0].x;
+        float *dst = &out[0].x;
+        switch(active)
+        {
+#ifdef ESCHER_X86
+        case Isa::AVX2:
+            normalsAVX2(k, src, dst, n, renormalize);
+            break;
+        case Isa::SSE:
+            normalsSSE(k, src, dst, n, renormalize);
+            break;
+#endif
+        default:
+            normalsScalar(k, src, dst, n, renormalize);
+        }
+    }
+
+    void transformNormals(const mat4 &normalMat, const std::vector<vec4> &in, std::vector<vec4> &out, bool renormalize)
+    {
+        out.resize(in.size());
+        if(!in.empty())
+            transformNormals(normalMat, in.data(), out.data(), in.size(), renormalize);
+    }
+
+    void toAoSoA(const vec4 *in, size_t n, std::vector<Vec4x8> &out)
+    {
+        out.assign((n + 7) / 8, Vec4x8{});
+        for(size_t v = 0; v < n; ++v)
+        {
+            Vec4x8 &b = out[v / 8];
+            size_t l = v % 8;
+            b.x[l] = in[v].x;
+            b.y[l] = in[v].y;
+            b.z[l] = in[v].z;
+            b.w[l] = in[v].w;
+        }
+    }
+
+    void fromAoSoA(const Vec4x8 *in, size_t n, vec4 *out)
+    {
+        for(size_t v = 0; v < n; ++v)
+        {
+            const Vec4x8 &b = in[v / 8];
+            size_t l = v % 8;
+            out[v] = vec4(b.x[l], b.y[l], b.z[l], b.w[l]);
+        }
+    }
+}
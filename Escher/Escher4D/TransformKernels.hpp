@@ -0,0 +1,82 @@
+#ifndef INC_TRANSFORM_KERNELS
+#define INC_TRANSFORM_KERNELS
+
+#include <cstddef>
+#include <vector>
+
+#include <Empty/math/mat.h>
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Transform4.hpp"
+
+/**
+ * Batch kernels applying a transform to whole arrays of vectors at once. The
+ * instruction set is picked at runtime among plain C++, SSE and AVX2 + FMA.
+ */
+namespace TransformKernels
+{
+    enum class Isa
+    {
+        Scalar,
+        SSE,
+        AVX2
+    };
+
+    /**
+     * Returns the best instruction set supported by the running CPU.
+     */
+    Isa supportedIsa();
+    /**
+     * Returns the instruction set the kernels currently use.
+     */
+    Isa activeIsa();
+    /**
+     * Forces the kernels to use a given instruction set, capped to what the CPU
+     * supports. Mostly useful for benchmarking.
+     * @return  the instruction set that ends up being used
+     */
+    Isa setIsa(Isa isa);
+
+    /**
+     * Eight vectors stored component-wise, the "array of structures of arrays"
+     * layout. Converting a mesh to this layout once makes the kernels operate on
+     * full registers without any shuffling.
+     */
+    struct alignas(32) Vec4x8
+    {
+        float x[8], y[8], z[8], w[8];
+    };
+
+    /**
+     * Applies a transform to n points, ie computes `t.mat * v + t.pos` for each.
+     * `in` and `out` may be the same array.
+     */
+    void transformPoints(const Transform4 &t, const Empty::math::vec4 *in, Empty::math::vec4 *out, size_t n);
+    void transformPoints(const Transform4 &t, const std::vector<Empty::math::vec4> &in, std::vector<Empty::math::vec4> &out);
+    /**
+     * Applies a transform to points in the AoSoA layout.
+     * @param   blocks  amount of 8-vector blocks
+     */
+    void transformPoints(const Transform4 &t, const Vec4x8 *in, Vec4x8 *out, size_t blocks);
+
+    /**
+     * Transforms n normal vectors by a normal matrix, that is the inverse transpose
+     * of a transform's linear part (see `Transform4::normalMatrix`), and optionally
+     * renormalizes them.
+     */
+    void transformNormals(const Empty::math::mat4 &normalMat, const Empty::math::vec4 *in, Empty::math::vec4 *out,
+        size_t n, bool renormalize = true);
+    void transformNormals(const Empty::math::mat4 &normalMat, const std::vector<Empty::math::vec4> &in,
+        std::vector<Empty::math::vec4> &out, bool renormalize = true);
+
+    /**
+     * Converts n vectors to the AoSoA layout. The last block is padded with zeros.
+     */
+    void toAoSoA(const Empty::math::vec4 *in, size_t n, std::vector<Vec4x8> &out);
+    /**
+     * Converts n vectors back from the AoSoA layout.
+     */
+    void fromAoSoA(const Vec4x8 *in, size_t n, Empty::math::vec4 *out);
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "UploadRing.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Escher4D/Profiler.hpp"
+
+UploadRing::UploadRing(size_t frameSize, size_t frames) : _allocator(frames, 0), _fences(frames, nullptr)
+{
+    GLint alignment = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if(alignment > 0)
+        _alignment = static_cast<size_t>(alignment);
+    createStorage(frameSize);
+}
+
+UploadRing::~UploadRing()
+{
+    for(GLsync &f : _fences)
+        if(f)
+            glDeleteSync(f);
+    _retired.push_back(_buffer);
+    glDeleteBuffers(static_cast<GLsizei>(_retired.size()), _retired.data());
+}
+
+void UploadRing::createStorage(size_t frameSize)
+{
+    if(_buffer)
+        _retired.push_back(_buffer);
+    // Regions start on aligned offsets
+    frameSize = (frameSize + _alignment - 1) / _alignment * _alignment;
+    _allocator.resize(frameSize);
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &_buffer);
+    glNamedBufferStorage(_buffer, static_cast<GLsizeiptr>(_allocator.size()), nullptr, flags);
+    _mapping = static_cast<unsigned char*>(glMapNamedBufferRange(_buffer, 0, static_cast<GLsizeiptr>(_allocator.size()), flags));
+
+    // Fences refer to the previous storage
+    for(GLsync &f : _fences)
+        if(f)
+        {
+            glDeleteSync(f);
+            f = nullptr;
+        }
+}
+
+void UploadRing::beginFrame()
+{
+    if(!_retired.empty())
+    {
+        glDeleteBuffers(static_cast<GLsizei>(_retired.size()), _retired.data());
+        _retired.clear();
+    }
+
+    _allocator.beginFrame();
+    GLsync &fence = _fences[_allocator.frame()];
+    if(fence)
+    {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED)
+        {
+            stats.stalls++;
+            // Wait one millisecond at a time, flushing so the fence is reached
+            do
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            while(status == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void UploadRing::endFrame()
+{
+    GLsync &fence = _fences[_allocator.frame()];
+    if(fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+UploadRing::Allocation UploadRing::allocate(size_t size)
+{
+    size_t offset = _allocator.allocate(size, _alignment);
+    if(offset == FrameRingAllocator::npos)
+    {
+        createStorage(std::max(_allocator.frameSize() * 2, _allocator.used() + size));
+        offset = _allocator.allocate(size, _alignment);
+        stats.grows++;
+    }
+    else
+        stats.reallocationsAvoided++;
+
+    Allocation a;
+    a.data = _mapping + offset;
+    a.buffer = _buffer;
+    a.offset = offset;
+    a.size = size;
+    return a;
+}
+
+UploadRing::Allocation UploadRing::upload(const void *data, size_t size)
+{
+    PROFILE_ZONE("Ring upload");
+    Allocation a = allocate(size);
+    if(size)
+        std::memcpy(a.data, data, size);
+    stats.bytesUploaded += size;
+    return a;
+}
+
+void UploadRing::bind(const Allocation &a, unsigned int binding)
+{
+    // A zero size range is an invalid value
+    if(!a.size)
+        return;
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, a.buffer, static_cast<GLintptr>(a.offset), static_cast<GLsizeiptr>(a.size));
+}
@@ -0,0 +1,183 @@
+#ifndef INC_UPLOAD_RING
+#define INC_UPLOAD_RING
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+/**
+ * CPU side of a frame ring : a buffer split into as many regions as there are
+ * frames in flight, each handed out linearly during its frame. Only deals with
+ * offsets, so it can back any kind of per-frame storage.
+ */
+class FrameRingAllocator
+{
+public:
+    static constexpr size_t npos = ~size_t(0);
+
+    /**
+     * @param   frames      amount of regions, ie of frames that can be in flight
+     * @param   frameSize   size in bytes of each region
+     */
+    FrameRingAllocator(size_t frames = 3, size_t frameSize = 0) : _frames(frames), _frameSize(frameSize) { }
+
+    /**
+     * Moves on to the next region and empties it.
+     */
+    void beginFrame()
+    {
+        _frame = (_frame + 1) % _frames;
+        _used = 0;
+    }
+
+    /**
+     * Reserves memory in the current region.
+     * @return  offset of the memory from the start of the whole buffer, or `npos`
+     *          if the region cannot hold it
+     */
+    size_t allocate(size_t size, size_t alignment = 1)
+    {
+        size_t offset = (_used + alignment - 1) / alignment * alignment;
+        if(offset + size > _frameSize)
+            return npos;
+        _used = offset + size;
+        if(_used > _peak)
+            _peak = _used;
+        return _frame * _frameSize + offset;
+    }
+
+    /**
+     * Changes the size of the regions, emptying the current one.
+     */
+    void resize(size_t frameSize)
+    {
+        _frameSize = frameSize;
+        _used = 0;
+    }
+
+    size_t frames() const { return _frames; }
+    size_t frame() const { return _frame; }
+    size_t frameSize() const { return _frameSize; }
+    size_t size() const { return _frames * _frameSize; }
+    /**
+     * Bytes used in the current region.
+     */
+    size_t used() const { return _used; }
+    /**
+     * Largest amount of bytes ever used in a region.
+     */
+    size_t peak() const { return _peak; }
+
+private:
+    size_t _frames, _frameSize;
+    size_t _frame = 0, _used = 0, _peak = 0;
+};
+
+/**
+ * Ring of GPU storage for data uploaded every frame, such as transforms.
+ *
+ * The storage is allocated once, mapped persistently and coherently, and split
+ * into one region per frame in flight. A fence is inserted at the end of each
+ * frame, and a region is only reused once the GPU went past the fence of the
+ * frame that last used it, so writes never stall on a buffer reallocation nor
+ * race with the GPU. When a frame needs more than a region, the storage grows
+ * geometrically ; the previous storage is released at the next frame, letting
+ * GL keep it alive until pending commands are done with it.
+ *
+ * Needs OpenGL 4.5, for persistent mapping and direct state access.
+ */
+class UploadRing
+{
+public:
+    /**
+     * Memory reserved for the current frame.
+     */
+    struct Allocation
+    {
+        void *data = nullptr;
+        GLuint buffer = 0;
+        size_t offset = 0, size = 0;
+    };
+
+    struct Stats
+    {
+        /**
+         * Bytes copied to the ring.
+         */
+        size_t bytesUploaded = 0;
+        /**
+         * Allocations served from existing storage, each of which would have
+         * otherwise reallocated a buffer.
+         */
+        size_t reallocationsAvoided = 0;
+        /**
+         * Times the storage grew.
+         */
+        size_t grows = 0;
+        /**
+         * Times a region was still in use by the GPU and had to be waited for.
+         */
+        size_t stalls = 0;
+    };
+
+    /**
+     * @param   frameSize   initial size in bytes of each frame's region
+     * @param   frames      amount of frames in flight
+     */
+    UploadRing(size_t frameSize = 1 << 16, size_t frames = 3);
+    ~UploadRing();
+    UploadRing(const UploadRing&) = delete;
+    UploadRing &operator=(const UploadRing&) = delete;
+
+    /**
+     * Starts a new frame, waiting for the GPU to be done with the region it
+     * reuses if necessary.
+     */
+    void beginFrame();
+    /**
+     * Marks the end of the frame's commands using the ring.
+     */
+    void endFrame();
+
+    /**
+     * Reserves memory for the current frame, aligned for shader storage binding.
+     * The memory remains valid until the same region comes up again.
+     */
+    Allocation allocate(size_t size);
+    /**
+     * Reserves memory and copies data to it.
+     */
+    Allocation upload(const void *data, size_t size);
+    template <typename T>
+    Allocation upload(const std::vector<T> &data)
+    {
+        return upload(data.data(), data.size() * sizeof(T));
+    }
+
+    /**
+     * Binds an allocation to a shader storage binding point. Empty
+     * allocations cannot be bound and leave the binding point as it was, which
+     * is fine as long as shaders read no element from it.
+     */
+    static void bind(const Allocation &a, unsigned int binding);
+
+    const FrameRingAllocator &allocator() const { return _allocator; }
+
+    Stats stats;
+
+private:
+    // (Re)creates the storage and its mapping for a given region size
+    void createStorage(size_t frameSize);
+
+    FrameRingAllocator _allocator;
+    size_t _alignment = 256;
+    GLuint _buffer = 0;
+    unsigned char *_mapping = nullptr;
+    // Fence of the last frame that used each region
+    std::vector<GLsync> _fences;
+    // Storage replaced by a larger one, released at the next frame
+    std::vector<GLuint> _retired;
+};
+
+#endif
@@ -0,0 +1,557 @@
+#include "CellBVH4.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/MathUtil.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ESCHER_X86
+#include <immintrin.h>
+#endif
+
+using namespace Empty::math;
+
+namespace
+{
+    const int bins = 16;
+    // Depth from which nodes are split at the median, which halves the cells
+    // at every level so that no tree gets deeper than CellBVH4::maxDepth
+    const int medianDepth = CellBVH4::maxDepth - 32;
+    const uint32_t magic = 0x34564243; // "CBV4"
+    const uint32_t formatVersion = 1;
+
+    size_t cellCount(const Geometry4 &geometry)
+    {
+        return geometry.isIndexed() ? geometry.cells.size() : geometry.vertices.size() / 4;
+    }
+
+    void cellVertices(const Geometry4 &geometry, size_t k, vec4 v[4])
+    {
+        for(unsigned int i = 0; i < 4; ++i)
+            v[i] = geometry.vertices[geometry.isIndexed() ? geometry.cells[k][i] : 4 * k + i];
+    }
+
+    vec4 inverseDirection(const vec4 &d)
+    {
+        vec4 inv;
+        for(int i = 0; i < 4; ++i)
+            inv(i) = d(i) != 0 ? 1 / d(i) : 1e30f;
+        return inv;
+    }
+
+    // Intersects a ray with a cell ; on success, t and the barycentric
+    // coordinates relative to vertices 1 to 3 are returned through t and u
+    inline bool intersectCell(const CellBVH4::Cell &c, const vec4 &o, const vec4 &d, float tmax, float &t, vec4 &u)
+    {
+        float den = dot(c.n, d);
+        if(den == 0)
+            return false;
+        t = dot(c.n, c.v0 - o) / den;
+        if(!(t >= 0 && t <= tmax))
+            return false;
+        vec4 p = o + d * t - c.v0;
+        u.y = dot(p, c.a1);
+        u.z = dot(p, c.a2);
+        u.w = dot(p, c.a3);
+        u.x = 1 - u.y - u.z - u.w;
+        return u.x >= 0 && u.y >= 0 && u.z >= 0 && u.w >= 0;
+    }
+
+    /// 4-wide float vectors for packet traversal
+
+#ifdef ESCHER_X86
+    struct F4
+    {
+        __m128 v;
+        F4() { }
+        F4(__m128 v) : v(v) { }
+        F4(float f) : v(_mm_set1_ps(f)) { }
+        static F4 load(const float *p) { return _mm_loadu_ps(p); }
+        void store(float *p) const { _mm_storeu_ps(p, v); }
+    };
+    inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+    inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+    inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+    inline F4 operator/(F4 a, F4 b) { return _mm_div_ps(a.v, b.v); }
+    inline F4 min(F4 a, F4 b) { return _mm_min_ps(a.v, b.v); }
+    inline F4 max(F4 a, F4 b) { return _mm_max_ps(a.v, b.v); }
+    // Comparisons return a lane mask
+    inline int operator<=(F4 a, F4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+    inline int operator>=(F4 a, F4 b) { return _mm_movemask_ps(_mm_cmpge_ps(a.v, b.v)); }
+#else
+    struct F4
+    {
+        float v[4];
+        F4() { }
+        F4(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+        static F4 load(const float *p) { F4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+        void store(float *p) const { std::memcpy(p, v, sizeof(v)); }
+    };
+    template <typename Op>
+    inline F4 lanes(F4 a, F4 b, Op op)
+    {
+        F4 r;
+        for(int i = 0; i < 4; ++i)
+            r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+    inline F4 operator+(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x + y; }); }
+    inline F4 operator-(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x - y; }); }
+    inline F4 operator*(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x * y; }); }
+    inline F4 operator/(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return x / y; }); }
+    inline F4 min(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return std::min(x, y); }); }
+    inline F4 max(F4 a, F4 b) { return lanes(a, b, [](float x, float y) { return std::max(x, y); }); }
+    inline int operator<=(F4 a, F4 b)
+    {
+        int m = 0;
+        for(int i = 0; i < 4; ++i)
+            m |= (a.v[i] <= b.v[i]) << i;
+        return m;
+    }
+    inline int operator>=(F4 a, F4 b) { return b <= a; }
+#endif
+
+    // Structure of arrays view of a packet of 4 rays
+    struct Packet
+    {
+        F4 o[4], d[4], invd[4], tmax;
+    };
+
+    // Returns the mask of the rays of a packet that enter a box
+    inline int intersectBox4(const AABB4 &b, const Packet &p)
+    {
+        F4 t0(0.f), t1 = p.tmax;
+        for(int i = 0; i < 4; ++i)
+        {
+            F4 a = (F4(b.min(i)) - p.o[i]) * p.invd[i], c = (F4(b.max(i)) - p.o[i]) * p.invd[i];
+            t0 = max(t0, min(a, c));
+            t1 = min(t1, max(a, c));
+        }
+        return t0 <= t1;
+    }
+
+    // Intersects the rays of a packet with a cell ; returns the mask of rays hit
+    inline int intersectCell4(const CellBVH4::Cell &c, const Packet &p, F4 &t, F4 u[4])
+    {
+        F4 den = F4(c.n.x) * p.d[0] + F4(c.n.y) * p.d[1] + F4(c.n.z) * p.d[2] + F4(c.n.w) * p.d[3],
+            num = F4(dot(c.n, c.v0)) - (F4(c.n.x) * p.o[0] + F4(c.n.y) * p.o[1] + F4(c.n.z) * p.o[2] + F4(c.n.w) * p.o[3]);
+        // Lanes where den is 0 get an infinite or NaN t, which fails the tests below
+        t = num / den;
+        F4 q[4];
+        for(int i = 0; i < 4; ++i)
+            q[i] = p.o[i] + p.d[i] * t - F4(c.v0(i));
+        const vec4 *a[3] = { &c.a1, &c.a2, &c.a3 };
+        for(int k = 0; k < 3; ++k)
+            u[k + 1] = q[0] * F4(a[k]->x) + q[1] * F4(a[k]->y) + q[2] * F4(a[k]->z) + q[3] * F4(a[k]->w);
+        u[0] = F4(1.f) - u[1] - u[2] - u[3];
+        const F4 zero(0.f);
+        return (t >= zero) & (t <= p.tmax) & (u[0] >= zero) & (u[1] >= zero) & (u[2] >= zero) & (u[3] >= zero);
+    }
+
+    template <typename T>
+    void write(std::ostream &out, const T &value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    bool read(std::istream &in, T &value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+}
+
+/// Construction
+
+namespace
+{
+    struct Builder
+    {
+        std::vector<CellBVH4::Node> &nodes;
+        std::vector<uint32_t> &indices;
+        std::vector<AABB4> boxes;
+        std::vector<vec4> centroids;
+
+        int build(int first, int last, int depth)
+        {
+            int index = static_cast<int>(nodes.size());
+            nodes.push_back(CellBVH4::Node{ AABB4(), first, static_cast<int16_t>(last - first), 0 });
+
+            AABB4 bounds, centroidBounds;
+            for(int k = first; k < last; ++k)
+            {
+                bounds.expand(boxes[indices[k]]);
+                centroidBounds.expand(centroids[indices[k]]);
+            }
+            nodes[index].bounds = bounds;
+            if(last - first <= CellBVH4::leafSize)
+                return index;
+            if(depth >= medianDepth)
+                return splitMedian(index, first, last, centroidBounds, depth);
+
+            // Binned SAH along every axis, using the 4D boundary measure of the
+            // boxes as the probability of a ray hitting them
+            float bestCost = 1e30f;
+            int bestAxis = -1, bestBin = 0;
+            for(int axis = 0; axis < 4; ++axis)
+            {
+                float lo = centroidBounds.min(axis), extent = centroidBounds.max(axis) - lo;
+                if(extent <= 0)
+                    continue;
+                AABB4 binBounds[bins];
+                int binCounts[bins] = { };
+                for(int k = first; k < last; ++k)
+                {
+                    int b = std::min(bins - 1, static_cast<int>((centroids[indices[k]](axis) - lo) / extent * bins));
+                    binBounds[b].expand(boxes[indices[k]]);
+                    binCounts[b]++;
+                }
+
+                // Sweep from the right, then from the left
+                float rightCost[bins];
+                AABB4 acc;
+                int count = 0;
+                for(int b = bins - 1; b > 0; --b)
+                {
+                    acc.expand(binBounds[b]);
+                    count += binCounts[b];
+                    rightCost[b] = count * acc.boundary();
+                }
+                acc = AABB4();
+                count = 0;
+                for(int b = 0; b < bins - 1; ++b)
+                {
+                    acc.expand(binBounds[b]);
+                    count += binCounts[b];
+                    float cost = count * acc.boundary() + rightCost[b + 1];
+                    if(count > 0 && count < last - first && cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            int split;
+            if(bestAxis < 0)
+            {
+                // All centroids coincide
+                split = (first + last) / 2;
+                bestAxis = 0;
+            }
+            else
+            {
+                float lo = centroidBounds.min(bestAxis), extent = centroidBounds.max(bestAxis) - lo;
+                split = static_cast<int>(std::partition(indices.begin() + first, indices.begin() + last,
+                    [&](uint32_t c)
+                    {
+                        return std::min(bins - 1, static_cast<int>((centroids[c](bestAxis) - lo) / extent * bins)) <= bestBin;
+                    }) - indices.begin());
+            }
+
+            return finish(index, first, split, last, bestAxis, depth);
+        }
+
+        // Splits the cells in two halves along the axis where their centroids
+        // spread the most, whatever their distribution. SAH splits can peel
+        // one cell off at a time when centroids are skewed
+        int splitMedian(int index, int first, int last, const AABB4 &centroidBounds, int depth)
+        {
+            int axis = 0;
+            for(int i = 1; i < 4; ++i)
+                if(centroidBounds.max(i) - centroidBounds.min(i) > centroidBounds.max(axis) - centroidBounds.min(axis))
+                    axis = i;
+            const int split = (first + last) / 2;
+            std::nth_element(indices.begin() + first, indices.begin() + split, indices.begin() + last,
+                [&](uint32_t a, uint32_t b) { return centroids[a](axis) < centroids[b](axis); });
+            return finish(index, first, split, last, axis, depth);
+        }
+
+        // Builds both children of a node
+        int finish(int index, int first, int split, int last, int axis, int depth)
+        {
+            build(first, split, depth + 1);
+            int right = build(split, last, depth + 1);
+            nodes[index].offset = right;
+            nodes[index].count = 0;
+            nodes[index].axis = static_cast<int16_t>(axis);
+            return index;
+        }
+    };
+}
+
+void CellBVH4::build(const Geometry4 &geometry)
+{
+    nodes.clear();
+    const size_t n = cellCount(geometry);
+    cellIndices.resize(n);
+    if(n == 0)
+    {
+        _cells.clear();
+        return;
+    }
+
+    Builder builder{ nodes, cellIndices, std::vector<AABB4>(n), std::vector<vec4>(n) };
+    for(size_t k = 0; k < n; ++k)
+    {
+        vec4 v[4];
+        cellVertices(geometry, k, v);
+        AABB4 &box = builder.boxes[k];
+        for(const vec4 &x : v)
+            box.expand(x);
+        builder.centroids[k] = box.center();
+        cellIndices[k] = static_cast<uint32_t>(k);
+    }
+    nodes.reserve(2 * n / leafSize + 1);
+    builder.build(0, static_cast<int>(n), 0);
+    prepareCells(geometry);
+}
+
+void CellBVH4::prepareCells(const Geometry4 &geometry)
+{
+    _cells.resize(cellIndices.size());
+    for(size_t k = 0; k < cellIndices.size(); ++k)
+    {
+        vec4 v[4];
+        cellVertices(geometry, cellIndices[k], v);
+        vec4 e1 = v[1] - v[0], e2 = v[2] - v[0], e3 = v[3] - v[0];
+        Cell &c = _cells[k];
+        c.v0 = v[0];
+        c.n = MathUtil::cross4(e1, e2, e3);
+        if(dot(c.n, c.n) == 0)
+        {
+            // Degenerate cell, never hit
+            c.a1 = c.a2 = c.a3 = vec4::zero;
+            continue;
+        }
+        // Each dual vector is orthogonal to the normal and the two other edges
+        vec4 c1 = MathUtil::cross4(c.n, e2, e3), c2 = MathUtil::cross4(e1, c.n, e3), c3 = MathUtil::cross4(e1, e2, c.n);
+        c.a1 = c1 / dot(c1, e1);
+        c.a2 = c2 / dot(c2, e2);
+        c.a3 = c3 / dot(c3, e3);
+    }
+}
+
+/// Queries
+
+bool CellBVH4::intersect(const vec4 &o, const vec4 &d, float tmax, Hit &hit) const
+{
+    hit.cell = -1;
+    if(nodes.empty())
+        return false;
+    const vec4 invd = inverseDirection(d);
+
+    int stack[maxDepth + 1], top = 0;
+    stack[top++] = 0;
+    float tnear;
+    while(top > 0)
+    {
+        const Node &node = nodes[stack[--top]];
+        if(!node.bounds.intersectRay(o, invd, tmax, tnear))
+            continue;
+        if(node.isLeaf())
+        {
+            for(int k = node.offset; k < node.offset + node.count; ++k)
+            {
+                float t;
+                vec4 u;
+                if(intersectCell(_cells[k], o, d, tmax, t, u))
+                {
+                    tmax = t;
+                    hit.cell = static_cast<int>(cellIndices[k]);
+                    hit.t = t;
+                    hit.barycentric = u;
+                }
+            }
+            continue;
+        }
+        // Visit the child on the side the ray comes from first
+        int left = static_cast<int>(&node - nodes.data()) + 1, right = node.offset;
+        if(d(node.axis) >= 0)
+            std::swap(left, right);
+        stack[top++] = left;
+        stack[top++] = right;
+    }
+    return hit.cell >= 0;
+}
+
+bool CellBVH4::occluded(const vec4 &o, const vec4 &d, float tmax) const
+{
+    if(nodes.empty())
+        return false;
+    const vec4 invd = inverseDirection(d);
+
+    int stack[maxDepth + 1], top = 0;
+    stack[top++] = 0;
+    float tnear;
+    while(top > 0)
+    {
+        int k = stack[--top];
+        const Node &node = nodes[k];
+        if(!node.bounds.intersectRay(o, invd, tmax, tnear))
+            continue;
+        if(node.isLeaf())
+        {
+            float t;
+            vec4 u;
+            for(int c = node.offset; c < node.offset + node.count; ++c)
+                if(intersectCell(_cells[c], o, d, tmax, t, u))
+                    return true;
+            continue;
+        }
+        stack[top++] = node.offset;
+        stack[top++] = k + 1;
+    }
+    return false;
+}
+
+int CellBVH4::intersect4(const vec4 o[4], const vec4 d[4], const float tmax[4], Hit hits[4]) const
+{
+    for(int r = 0; r < 4; ++r)
+        hits[r].cell = -1;
+    if(nodes.empty())
+        return 0;
+
+    Packet p;
+    alignas(16) float tm[4], lane[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        float oi[4], di[4], ii[4];
+        for(int r = 0; r < 4; ++r)
+        {
+            oi[r] = o[r](i);
+            di[r] = d[r](i);
+            ii[r] = d[r](i) != 0 ? 1 / d[r](i) : 1e30f;
+        }
+        p.o[i] = F4::load(oi);
+        p.d[i] = F4::load(di);
+        p.invd[i] = F4::load(ii);
+    }
+    std::memcpy(tm, tmax, sizeof(tm));
+    p.tmax = F4::load(tm);
+
+    int stack[maxDepth + 1], top = 0, hitMask = 0;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        int k = stack[--top];
+        const Node &node = nodes[k];
+        if(!intersectBox4(node.bounds, p))
+            continue;
+        if(node.isLeaf())
+        {
+            for(int c = node.offset; c < node.offset + node.count; ++c)
+            {
+                F4 t, u[4];
+                int mask = intersectCell4(_cells[c], p, t, u);
+                if(!mask)
+                    continue;
+                t.store(lane);
+                for(int r = 0; r < 4; ++r)
+                    if(mask & (1 << r))
+                    {
+                        tm[r] = lane[r];
+                        hits[r].cell = static_cast<int>(cellIndices[c]);
+                        hits[r].t = lane[r];
+                        for(int i = 0; i < 4; ++i)
+                        {
+                            float ui[4];
+                            u[i].store(ui);
+                            hits[r].barycentric(i) = ui[r];
+                        }
+                    }
+                hitMask |= mask;
+                p.tmax = F4::load(tm);
+            }
+            continue;
+        }
+        // Order children by the direction of the first ray, rays in a packet
+        // being assumed coherent
+        int left = k + 1, right = node.offset;
+        if(d[0](node.axis) >= 0)
+            std::swap(left, right);
+        stack[top++] = left;
+        stack[top++] = right;
+    }
+    return hitMask;
+}
+
+/// Serialization
+
+void CellBVH4::save(std::ostream &out) const
+{
+    write(out, magic);
+    write(out, formatVersion);
+    write(out, static_cast<uint32_t>(nodes.size()));
+    write(out, static_cast<uint32_t>(cellIndices.size()));
+    for(const Node &node : nodes)
+    {
+        for(int i = 0; i < 4; ++i)
+            write(out, node.bounds.min(i));
+        for(int i = 0; i < 4; ++i)
+            write(out, node.bounds.max(i));
+        write(out, node.offset);
+        write(out, node.count);
+        write(out, node.axis);
+    }
+    out.write(reinterpret_cast<const char*>(cellIndices.data()), cellIndices.size() * sizeof(uint32_t));
+}
+
+bool CellBVH4::load(std::istream &in, const Geometry4 &geometry)
+{
+    nodes.clear();
+    cellIndices.clear();
+    _cells.clear();
+
+    uint32_t m, version, nodeCount, cells;
+    if(!read(in, m) || m != magic || !read(in, version) || version != formatVersion
+        || !read(in, nodeCount) || !read(in, cells) || cells != cellCount(geometry))
+        return false;
+
+    // Children come after their parent, so that traversal always terminates,
+    // and no deeper than the traversal stacks allow
+    nodes.resize(nodeCount);
+    std::vector<int> depths(nodeCount, 0);
+    for(uint32_t k = 0; k < nodeCount; ++k)
+    {
+        Node &node = nodes[k];
+        bool ok = true;
+        for(int i = 0; i < 4; ++i)
+            ok = ok && read(in, node.bounds.min(i));
+        for(int i = 0; i < 4; ++i)
+            ok = ok && read(in, node.bounds.max(i));
+        ok = ok && read(in, node.offset) && read(in, node.count) && read(in, node.axis);
+        bool valid = node.isLeaf() ? node.offset >= 0 && static_cast<uint32_t>(node.offset + node.count) <= cells
+            : k + 1 < nodeCount && node.offset > 0 && static_cast<uint32_t>(node.offset) > k + 1
+                && static_cast<uint32_t>(node.offset) < nodeCount && node.axis >= 0 && node.axis < 4
+                && depths[k] < maxDepth;
+        if(!ok || !valid)
+        {
+            nodes.clear();
+            return false;
+        }
+        if(!node.isLeaf())
+        {
+            // Longest path to the children, in case several nodes share them
+            depths[k + 1] = std::max(depths[k + 1], depths[k] + 1);
+            depths[node.offset] = std::max(depths[node.offset], depths[k] + 1);
+        }
+    }
+
+    cellIndices.resize(cells);
+    if(!in.read(reinterpret_cast<char*>(cellIndices.data()), cells * sizeof(uint32_t))
+        || std::any_of(cellIndices.begin(), cellIndices.end(), [cells](uint32_t c) { return c >= cells; }))
+    {
+        nodes.clear();
+        cellIndices.clear();
+        return false;
+    }
+
+    prepareCells(geometry);
+    return true;
+}
@@ -0,0 +1,139 @@
+#ifndef INC_CELL_BVH4
+#define INC_CELL_BVH4
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <Empty/math/vec.h>
+
+#include "Escher4D/Bounds4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+/**
+ * Bounding volume hierarchy over the tetrahedral cells of a `Geometry4`, used to
+ * cast exact 4D rays against the mesh.
+ *
+ * The tree is built with a binned surface area heuristic, using the boundary
+ * measure of 4D boxes, falling back to median splits deep in the tree. Nodes
+ * are stored in a flat depth-first array that can be serialized next to the
+ * mesh. Rays are expressed in the local space of the geometry : to cast a
+ * world-space ray against an object, transform its origin and direction by the
+ * inverse of the object's world transform, which leaves hit distances
+ * unchanged.
+ */
+class CellBVH4
+{
+public:
+    struct Node
+    {
+        AABB4 bounds;
+        /**
+         * For leaves, index of the first cell in `cellIndices`. For internal
+         * nodes, index of the right child, the left child being the next node.
+         */
+        int32_t offset;
+        /**
+         * Amount of cells under a leaf, 0 for internal nodes.
+         */
+        int16_t count;
+        /**
+         * Axis the node was split along, used to visit children front to back.
+         */
+        int16_t axis;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    struct Hit
+    {
+        /**
+         * Index of the cell hit in the geometry, or -1 if the ray missed.
+         */
+        int cell = -1;
+        /**
+         * Distance along the ray, in units of the direction's length.
+         */
+        float t = 0;
+        /**
+         * Barycentric coordinates of the hit point relative to the cell's
+         * vertices, in the order they are stored in the geometry.
+         */
+        Empty::math::vec4 barycentric;
+    };
+
+    CellBVH4() { }
+    CellBVH4(const Geometry4 &geometry) { build(geometry); }
+
+    /**
+     * Builds the hierarchy over the cells of a geometry, indexed or not. The
+     * geometry must be rebuilt if its vertices change.
+     */
+    void build(const Geometry4 &geometry);
+
+    /**
+     * Casts the ray o + t d, t in [0, tmax], and finds the closest cell hit.
+     * @return  whether a cell was hit
+     */
+    bool intersect(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float tmax, Hit &hit) const;
+    /**
+     * Tests whether the ray o + t d hits any cell for t in [0, tmax], which is
+     * cheaper than finding the closest one. Meant for visibility queries.
+     */
+    bool occluded(const Empty::math::vec4 &o, const Empty::math::vec4 &d, float tmax) const;
+    /**
+     * Casts 4 rays at once, traversing the hierarchy with the whole packet. This
+     * pays off for coherent rays, eg neighbouring pixels or shadow rays towards
+     * the same light.
+     * @return  a mask of the rays that hit a cell
+     */
+    int intersect4(const Empty::math::vec4 o[4], const Empty::math::vec4 d[4], const float tmax[4], Hit hits[4]) const;
+
+    /**
+     * Writes the hierarchy to a binary stream.
+     */
+    void save(std::ostream &out) const;
+    /**
+     * Reads a hierarchy written by `save` for a given geometry.
+     * @return  whether the operation succeeded ; the hierarchy is left empty otherwise
+     */
+    bool load(std::istream &in, const Geometry4 &geometry);
+
+    /**
+     * Maximum amount of cells per leaf.
+     */
+    static const int leafSize = 4;
+    /**
+     * Maximum amount of edges between the root and a leaf, which bounds the
+     * traversal stacks.
+     */
+    static const int maxDepth = 63;
+
+    /**
+     * Nodes in depth-first order, the root being the first node.
+     */
+    std::vector<Node> nodes;
+    /**
+     * Cell indices sorted such that each leaf refers to a contiguous range.
+     */
+    std::vector<uint32_t> cellIndices;
+
+    /**
+     * Cell data laid out for the intersection kernel : the first vertex, the
+     * normal of the cell's hyperplane, and the dual basis of its edges, ie the
+     * vectors giving the barycentric coordinates of a point of the hyperplane by
+     * dot products. Stored in the same order as `cellIndices`.
+     */
+    struct Cell
+    {
+        Empty::math::vec4 v0, n, a1, a2, a3;
+    };
+
+private:
+    // Computes the kernel data of the cells listed in cellIndices
+    void prepareCells(const Geometry4 &geometry);
+
+    std::vector<Cell> _cells;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <memory>
 #include <numeric>
 #include <vector>
 
@@ -14,6 +15,8 @@
 
 #include "Escher4D/Context.h"
 #include "Escher4D/MathUtil.hpp"
+#include "Escher4D/RenderStats.hpp"
+#include "Escher4D/ThreadPool.hpp"
 #include "Escher4D/utils.hpp"
 
 /**
@@ -78,34 +81,45 @@ struct Geometry4
     
     /**
      * Recomputes the geometry's normal vectors, using solid angle weighting if
-     * the mesh is indexed.
+     * the mesh is indexed. Cells are processed in parallel, and the weighted
+     * normals are then summed in cell order so that results do not depend on
+     * the amount of workers.
      * @param   inwards     whether the normal vectors should face inwards or outwards
+     * @param   pool        pool to process the cells on
      */
-    void recomputeNormals(bool inwards = false)
+    void recomputeNormals(bool inwards = false, ThreadPool &pool = ThreadPool::get())
     {
-        Empty::math::vec4 checker = Empty::math::vec4::zero;
         normals.clear();
         
+        // Orients a cell, swapping two vertices if needed, and returns its normal
+        auto orient = [&](const Empty::math::vec4 &a, Empty::math::vec4 n, auto swap)
+        {
+            // Skeleton checking for normal std::vector orientation
+            Empty::math::vec4 checker = Empty::math::vec4::zero;
+            if(skeleton.size() > 0)
+                checker = *MathUtil::nearestPoint(a, skeleton);
+            if((Empty::math::dot(n, a - checker) < 0) != inwards)
+            {
+                swap();
+                n *= -1;
+            }
+            return n;
+        };
+        
         // If the mesh is indexed, use solid angle weighting
         if(cells.size() > 0)
         {
-            normals.resize(vertices.size(), Empty::math::vec4::zero);
-            for(auto &cell : cells)
+            // Contribution of each cell to each of its vertices
+            std::vector<Empty::math::vec4> weighted(cells.size() * 4);
+            pool.parallelFor(cells.size(), [&](size_t c, unsigned int)
             {
+                Empty::math::uvec4 &cell = cells[c];
                 auto cellN = MathUtil::cross4(vertices[cell[1]] - vertices[cell[0]], vertices[cell[2]] - vertices[cell[0]],
                     vertices[cell[3]] - vertices[cell[0]]);
                 float paraVolume = Empty::math::length(cellN);
+                cellN = orient(vertices[cell[0]], cellN, [&]() { std::swap(cell[2], cell[3]); });
                 auto sdist = [&](int i, int j) { auto r = (vertices[cell[i % 4]] - vertices[cell[j % 4]]); return Empty::math::dot(r, r); };
                 
-                // Skeleton checking for normal std::vector orientation
-                if(skeleton.size() > 0)
-                    checker = *MathUtil::nearestPoint(vertices[cell[0]], skeleton);
-                if((Empty::math::dot(cellN, vertices[cell[0]] - checker) < 0) != inwards)
-                {
-                    std::swap(cell[2], cell[3]);
-                    cellN *= -1;
-                }
-                
                 for(unsigned int i = 0; i < 4; ++i)
                 {
                     // Use solid angle as weight
@@ -116,35 +130,33 @@ struct Geometry4
                         Ni = (eij + eik) * (eik + eil) * (eil + eij) - (eij * sekl + eik * sejl + eil * sejk),
                         phi = atan(paraVolume * 2 / Ni);
                     
-                    normals[cell[i]] += cellN * phi;
+                    weighted[4 * c + i] = cellN * phi;
                 }
-            }
+            });
+            
+            normals.resize(vertices.size(), Empty::math::vec4::zero);
+            for(size_t c = 0; c < cells.size(); ++c)
+                for(unsigned int i = 0; i < 4; ++i)
+                    normals[cells[c][i]] += weighted[4 * c + i];
         }
         else
         {
-            for(size_t i = 0; i < vertices.size(); i += 4)
+            normals.resize(vertices.size());
+            pool.parallelFor(vertices.size() / 4, [&](size_t c, unsigned int)
             {
+                const size_t i = 4 * c;
                 Empty::math::vec4 n = MathUtil::cross4(vertices[i + 1] - vertices[i], vertices[i + 2] - vertices[i],
                     vertices[i + 3] - vertices[i]);
+                n = orient(vertices[i], n, [&]() { std::swap(vertices[i + 2], vertices[i + 3]); });
                 
-                // Skeleton checking for normal std::vector orientation
-                if(skeleton.size() > 0)
-                    checker = *MathUtil::nearestPoint(vertices[i], skeleton);
-                if((Empty::math::dot(n, vertices[i] - checker) < 0) != inwards)
-                {
-                    std::swap(vertices[i + 2], vertices[i + 3]);
-                    n *= -1;
-                }
-                
-                normals.push_back(n);
-                normals.push_back(n);
-                normals.push_back(n);
-                normals.push_back(n);
-            }
+                normals[i] = normals[i + 1] = normals[i + 2] = normals[i + 3] = n;
+            });
         }
         
-        for(Empty::math::vec4 &v : normals)
-            v = Empty::math::normalize(v);
+        pool.parallelFor(normals.size(), [&](size_t i, unsigned int)
+        {
+            normals[i] = Empty::math::normalize(normals[i]);
+        });
     }
     
     /**
@@ -203,23 +215,47 @@ struct Geometry4
         _vbo.uploadData(v, v, normals[0]);
         if(e > 0)
             _ebo.setStorage(e, Empty::gl::BufferUsage::StaticDraw, cells[0]);
+        // The normals offset may have changed
+        _bindings.clear();
     }
     
     /**
-     * Exposes the geometry to the GPU through a shader program.
+     * Exposes the geometry to the GPU through a shader program. Attributes are
+     * located and the vertex array is specified the first time a program is
+     * used, later calls with the same program only bind that vertex array.
      */
     void exposeGPU(Empty::gl::ShaderProgram &program)
     {
-        Empty::gl::VertexStructure vs(vertices.size());
-        vs.add("aPosition", Empty::gl::VertexAttribType::Float, 4);
-        vs.add("aNormal", Empty::gl::VertexAttribType::Float, 4);
-        program.locateAttributes(vs);
-        _vao.attachVertexBuffer(_vbo, vs);
-        if (isIndexed())
-            _vao.attachElementBuffer(_ebo);
-        Context::get().bind(_vao);
+        RenderStats &stats = RenderStats::get();
+        Empty::gl::VertexArray *vao = nullptr;
+        for(const Binding &b : _bindings)
+            if(b.program == &program)
+                vao = b.vao.get();
+        if(!vao)
+        {
+            _bindings.push_back({ &program, std::make_unique<Empty::gl::VertexArray>() });
+            vao = _bindings.back().vao.get();
+            
+            Empty::gl::VertexStructure vs(vertices.size());
+            vs.add("aPosition", Empty::gl::VertexAttribType::Float, 4);
+            vs.add("aNormal", Empty::gl::VertexAttribType::Float, 4);
+            program.locateAttributes(vs);
+            vao->attachVertexBuffer(_vbo, vs);
+            if (isIndexed())
+                vao->attachElementBuffer(_ebo);
+            stats.attributeLookups++;
+            stats.vertexArraySetups++;
+        }
+        Context::get().bind(*vao);
+        stats.vertexArrayBinds++;
     }
     
+    /**
+     * Forgets the vertex arrays set up for every program. Call this when a
+     * program the geometry was exposed through is rebuilt or destroyed.
+     */
+    void resetBindings() { _bindings.clear(); }
+    
     /**
      * Tells whether the geometry is indexed or has vertex duplication.
      */
@@ -242,7 +278,14 @@ struct Geometry4
      */
     std::vector<Empty::math::vec4> normals;
 private:
-    Empty::gl::VertexArray _vao;
+    // Vertex array set up for a given program
+    struct Binding
+    {
+        const Empty::gl::ShaderProgram *program;
+        std::unique_ptr<Empty::gl::VertexArray> vao;
+    };
+    
+    std::vector<Binding> _bindings;
     Empty::gl::Buffer _vbo, _ebo;
 };
 
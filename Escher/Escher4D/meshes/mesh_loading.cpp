@@ -1,13 +1,16 @@
 #ifndef INC_OFF_LOADER
 #define INC_OFF_LOADER
 
+#include <atomic>
 #include <exception>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include <Empty/math/vec.h>
 
 #include "Escher4D/meshes/Geometry4.hpp"
+#include "Escher4D/ThreadPool.hpp"
 #include "Escher4D/utils.hpp"
 
 namespace OFFLoader
@@ -17,7 +20,7 @@ namespace OFFLoader
 /**
  * Loads a 3D model from a base file name. Fills arrays with "basename.off",
  * "basename.face" and "basename.ele" for vertices, triangles and tetrahedra
- * respectively.
+ * respectively. Lines are parsed in parallel.
  * @return  whether or not the operation succeeded
  */
 bool loadModel(const string &baseName, std::vector<Empty::math::vec3> &v,
@@ -29,42 +32,60 @@ bool loadModel(const string &baseName, std::vector<Empty::math::vec3> &v,
             faceFile = split(getFileContents(baseName + ".face"), "\r\n"),
             tetraFile = split(getFileContents(baseName + ".ele"), "\r\n");
         
-        // Read vertices
         if(offFile[0] != "OFF")
             return false;
-        size_t nb = stoi(offFile[1]); // grab the first integer
-        v.resize(nb);
-
-        for(size_t i = 0; i < nb; i++)
+        size_t nv = stoi(offFile[1]), // grab the first integer
+            nt = stoi(faceFile[0]),
+            ne = stoi(tetraFile[0]);
+        if(offFile.size() < nv + 2 || faceFile.size() < nt + 1 || tetraFile.size() < ne + 1)
+            return false;
+        v.resize(nv);
+        tris.resize(nt);
+        tetras.resize(ne);
+        
+        // Jobs must not throw, parse errors are reported afterwards
+        std::atomic<bool> ok{true};
+        auto parse = [&](size_t count, const std::function<void(size_t)> &line)
+        {
+            ThreadPool::get().parallelFor(count, [&](size_t i, unsigned int)
+            {
+                try
+                {
+                    line(i);
+                }
+                catch(std::exception&)
+                {
+                    ok = false;
+                }
+            });
+        };
+        // Read vertices
+        parse(nv, [&](size_t i)
         {
             std::vector<string> vertex = split(offFile[i + 2], " \t");
             v[i].x = stof(vertex[0]);
             v[i].y = stof(vertex[1]);
             v[i].z = stof(vertex[2]);
-        }
+        });
         // Read triangles
-        nb = stoi(faceFile[0]);
-        tris.resize(nb);
-        for(size_t i = 0; i < nb; i++)
+        parse(nt, [&](size_t i)
         {
             std::vector<string> tri = split(faceFile[i + 1], " \t");
             tris[i].x = stoi(tri[1]);
             tris[i].y = stoi(tri[2]);
             tris[i].z = stoi(tri[3]);
-        }
+        });
         // Read tetrahedra
-        nb = stoi(tetraFile[0]);
-        tetras.resize(nb);
-        for(size_t i = 0; i < nb; i++)
+        parse(ne, [&](size_t i)
         {
             std::vector<string> tetra = split(tetraFile[i + 1], " \t");
             tetras[i].x = stoi(tetra[1]);
             tetras[i].y = stoi(tetra[2]);
             tetras[i].z = stoi(tetra[3]);
             tetras[i].w = stoi(tetra[4]);
-        }
+        });
         
-        return true;
+        return ok;
     }
     catch(std::exception&)
     {
@@ -1,6 +1,7 @@
 #include "utils.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -42,6 +43,32 @@ std::vector<std::string> split(const std::string &s, const std::string &delim)
     return r;
 }
 
+std::vector<std::string> tokenize(const std::string &line)
+{
+    std::vector<std::string> words = split(line, " \t");
+    // split may leave empty fields behind
+    words.erase(std::remove(words.begin(), words.end(), std::string()), words.end());
+    return words;
+}
+
+void writeJSONEscaped(std::ostream &out, const char *s)
+{
+    for(; *s; ++s)
+    {
+        const char c = *s;
+        if(c == '"' || c == '\\')
+            out << '\\' << c;
+        else if(static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+            out << escaped;
+        }
+        else
+            out << c;
+    }
+}
+
 GLuint createShaderFromSource(GLenum type, const std::string &path)
 {
     GLuint shader = glCreateShader(type);
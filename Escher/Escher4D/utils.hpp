@@ -32,6 +32,15 @@ std::string getFileContents(const std::string &path);
  * meaning either of the characters in the delimiter string is to split the string.
  */
 std::vector<std::string> split(const std::string &s, const std::string &delim);
+/**
+ * Splits a line of a text file into its blank-separated words, without empty words.
+ */
+std::vector<std::string> tokenize(const std::string &line);
+/**
+ * Writes a string as the contents of a JSON string literal, escaping quotes,
+ * backslashes and control characters.
+ */
+void writeJSONEscaped(std::ostream &out, const char *s);
 /**
  * Creates an OpenGL shader from the path of its source file.
  * @param   type    the OpenGL type of the shader (eg vertex, fragment ...)
@@ -0,0 +1,129 @@
+#ifndef INC_BENCH
+#define INC_BENCH
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <Empty/gl/ShaderProgram.hpp>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/Object4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+/**
+ * Minimal timing helpers shared by the benchmarks.
+ */
+namespace bench
+{
+    /**
+     * Keeps the compiler from optimizing a computation away.
+     */
+    template <typename T>
+    inline void keep(const T &value)
+    {
+#ifdef _MSC_VER
+        static const void *volatile sink;
+        sink = &value;
+        _ReadWriteBarrier();
+#else
+        asm volatile("" : : "r"(&value) : "memory");
+#endif
+    }
+    
+    /**
+     * Runs a function a given amount of times, repeats the measure a few times
+     * and returns the best time per call in nanoseconds.
+     */
+    template <typename F>
+    double measure(F &&f, long iterations, int runs = 5)
+    {
+        double best = 1e300;
+        for(int r = 0; r < runs; ++r)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(long k = 0; k < iterations; ++k)
+                f();
+            std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+            best = std::min(best, d.count() / iterations);
+        }
+        return best;
+    }
+    
+    /**
+     * Amount of failed checks so far.
+     */
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+    
+    /**
+     * Checks that a result is right, which benchmarks do along the way so that
+     * they never time wrong code. Failures are printed and make the benchmarks
+     * exit with an error.
+     */
+    inline bool check(bool ok, const char *what)
+    {
+        if(!ok)
+        {
+            std::printf("    FAILED : %s\n", what);
+            ++failures();
+        }
+        return ok;
+    }
+    
+    /**
+     * Prints one result line.
+     */
+    inline void report(const char *name, double ns, const char *unit = "call")
+    {
+        std::printf("%-48s %12.2f ns/%s\n", name, ns, unit);
+    }
+    
+    /**
+     * Complex of 4096 rooms laid out on a 16x16x16 grid under Object4::scene,
+     * each made like the rooms of the eightrooms complex of 5 cubes followed by
+     * 3 holed cubes. The geometries are unindexed and of the size of the
+     * eightrooms ones, and every wall is white. The complex is removed from the
+     * scene when destroyed.
+     */
+    struct Rooms
+    {
+        static const int count = 4096, cubes = 5, walls = 8;
+        
+        Rooms() : cubeRC(makeGeometry(cube, 120), program), holedRC(makeGeometry(holed, 360), program), complex(Object4::scene.addChild())
+        {
+            for(int k = 0; k < count; ++k)
+            {
+                Object4 &room = complex.addChild();
+                room.pos = Empty::math::vec4(static_cast<float>(k % 16), 0, static_cast<float>(k / 16 % 16), static_cast<float>(k / 256));
+                for(int c = 0; c < walls; ++c)
+                    room.addChild(c < cubes ? cubeRC : holedRC).color = Empty::math::vec4(1, 1, 1, 1);
+            }
+        }
+        Rooms(const Rooms&) = delete;
+        Rooms &operator=(const Rooms&) = delete;
+        ~Rooms() { Object4::scene.removeChildUnordered(Object4::scene.childCount() - 1); }
+        
+        Geometry4 cube, holed;
+        Empty::gl::ShaderProgram program;
+        Model4RenderContext cubeRC, holedRC;
+        Object4 &complex;
+        
+    private:
+        static Geometry4 &makeGeometry(Geometry4 &g, int cells)
+        {
+            for(int c = 0; c < cells; ++c)
+                for(int v = 0; v < 4; ++v)
+                    g.vertices.push_back(Empty::math::vec4(static_cast<float>(v == 0), static_cast<float>(v == 1), static_cast<float>(v == 2), static_cast<float>(c)));
+            return g;
+        }
+    };
+}
+
+#endif
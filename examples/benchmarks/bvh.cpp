@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/BVH4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    void linearSphereQuery(const std::vector<AABB4> &boxes, const vec4 &c, float radius, std::vector<int> &out)
+    {
+        for(size_t k = 0; k < boxes.size(); ++k)
+        {
+            vec4 d = c - min(max(c, boxes[k].min), boxes[k].max);
+            if(dot(d, d) <= radius * radius)
+                out.push_back(static_cast<int>(k));
+        }
+    }
+
+    float linearClosestHit(const std::vector<AABB4> &boxes, const vec4 &o, const vec4 &invd)
+    {
+        float best = 1e30f, t;
+        for(const AABB4 &b : boxes)
+            if(BVH4::intersectRay(b, o, invd, best, t) && t < best)
+                best = t;
+        return best;
+    }
+
+    float bvhClosestHit(const BVH4 &bvh, const std::vector<AABB4> &boxes, const vec4 &o, const vec4 &d, const vec4 &invd)
+    {
+        float tmax = 1e30f;
+        bvh.raycast(o, d, tmax, [&](int item)
+        {
+            float t;
+            return BVH4::intersectRay(boxes[item], o, invd, tmax, t) ? t : -1.f;
+        });
+        return tmax;
+    }
+}
+
+/**
+ * Lays out a 16x16x16 grid of rooms, each made of 8 walls like the rooms of the
+ * eightrooms complex, and compares BVH4 queries with linear scans after checking
+ * that both find the same items.
+ */
+void bvhBenchmark()
+{
+    const int rooms = 16;
+    std::vector<AABB4> boxes;
+    for(int x = 0; x < rooms; ++x)
+        for(int z = 0; z < rooms; ++z)
+            for(int w = 0; w < rooms; ++w)
+            {
+                vec4 corner(static_cast<float>(x), 0, static_cast<float>(z), static_cast<float>(w));
+                // One thin wall on each side along X, Z and W, plus floor and ceiling
+                for(int axis : { 0, 2, 3 })
+                    for(float side : { 0.f, 1.f })
+                    {
+                        vec4 lo = corner, hi = corner + vec4(1, 1, 1, 1);
+                        lo(axis) = hi(axis) = corner(axis) + side;
+                        hi(axis) += 0.01f;
+                        boxes.push_back(AABB4(lo, hi));
+                    }
+                boxes.push_back(AABB4(corner, corner + vec4(1, 0.01f, 1, 1)));
+                boxes.push_back(AABB4(corner + vec4(0, 1, 0, 0), corner + vec4(1, 1.01f, 1, 1)));
+            }
+    std::printf("%zu boxes\n", boxes.size());
+
+    BVH4 bvh;
+    bench::report("build", bench::measure([&]() { bvh.build(boxes); bench::keep(bvh.nodes[0]); }, 5, 3));
+    bench::report("refit", bench::measure([&]() { bvh.refit(boxes); bench::keep(bvh.nodes[0]); }, 20, 3));
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(0, static_cast<float>(rooms));
+    const int Q = 1024;
+    std::vector<vec4> points(Q), dirs(Q);
+    for(int q = 0; q < Q; ++q)
+    {
+        points[q] = vec4(u(rng), 0.5f, u(rng), u(rng));
+        dirs[q] = normalize(vec4(u(rng) - rooms / 2.f, u(rng) - rooms / 2.f, u(rng) - rooms / 2.f, u(rng) - rooms / 2.f));
+    }
+
+    // Both paths find the same boxes and the same closest hits
+    std::vector<int> out, expected;
+    auto checkQueries = [&](const char *items, const char *hits)
+    {
+        bool sameItems = true, sameHits = true;
+        for(int q = 0; q < 64; ++q)
+        {
+            const vec4 &o = points[q], &d = dirs[q];
+            expected.clear();
+            linearSphereQuery(boxes, o, 0.5f, expected);
+            out.clear();
+            bvh.querySphere(o, 0.5f, out);
+            std::sort(out.begin(), out.end());
+            sameItems = sameItems && out == expected;
+            vec4 invd(1 / d.x, 1 / d.y, 1 / d.z, 1 / d.w);
+            float linear = linearClosestHit(boxes, o, invd), tree = bvhClosestHit(bvh, boxes, o, d, invd);
+            sameHits = sameHits && std::abs(linear - tree) <= 1e-5f * (1.f + linear);
+        }
+        bench::check(sameItems, items);
+        bench::check(sameHits, hits);
+    };
+    checkQueries("BVH4 sphere queries find the boxes a linear scan finds",
+        "BVH4 raycasts find the closest hit a linear scan finds");
+
+    int q = 0;
+    bench::report("sphere query : linear", bench::measure([&]()
+    {
+        out.clear();
+        linearSphereQuery(boxes, points[q++ % Q], 0.5f, out);
+        bench::keep(out.size());
+    }, Q));
+    bench::report("sphere query : BVH4", bench::measure([&]()
+    {
+        out.clear();
+        bvh.querySphere(points[q++ % Q], 0.5f, out);
+        bench::keep(out.size());
+    }, Q));
+
+    bench::report("closest ray hit : linear", bench::measure([&]()
+    {
+        const vec4 &o = points[q % Q], &d = dirs[q % Q];
+        ++q;
+        vec4 invd(1 / d.x, 1 / d.y, 1 / d.z, 1 / d.w);
+        bench::keep(linearClosestHit(boxes, o, invd));
+    }, Q));
+    bench::report("closest ray hit : BVH4", bench::measure([&]()
+    {
+        const vec4 &o = points[q % Q], &d = dirs[q % Q];
+        ++q;
+        vec4 invd(1 / d.x, 1 / d.y, 1 / d.z, 1 / d.w);
+        bench::keep(bvhClosestHit(bvh, boxes, o, d, invd));
+    }, Q));
+
+    // Walls moving across rooms only stay found if refitting grows the nodes
+    for(size_t k = 0; k < boxes.size(); k += 3)
+        boxes[k] = AABB4(boxes[k].min + vec4(0.7f, 0, 0.4f, 0), boxes[k].max + vec4(0.7f, 0, 0.4f, 0));
+    bvh.refit(boxes);
+    checkQueries("BVH4 sphere queries find moved boxes after a refit",
+        "BVH4 raycasts find moved boxes after a refit");
+}
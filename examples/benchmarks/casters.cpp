@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <vector>
+
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/ShadowCasterRegistry.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    /**
+     * Checks that casters whose geometry has no cells are not mistaken for the
+     * holes left by removed casters when the registry is compacted.
+     */
+    void checkEmptyCasters(const Geometry4 &prop)
+    {
+        ShadowCasterRegistry casters;
+        Geometry4 empty;
+        ShadowCasterRegistry::CasterId first = casters.addCaster(prop, 1),
+            hollow = casters.addCaster(empty, 2),
+            last = casters.addCaster(prop, 3);
+        casters.removeCaster(first);
+        casters.defragment();
+        bench::check(casters.instances.size() == 2, "defragmentation keeps empty casters");
+        casters.setTransform(hollow, 4);
+        bench::check(casters.instances.size() == 2 && casters.instances[0].transform == 4 && casters.instances[1].transform == 3,
+            "empty casters follow their instance through defragmentation");
+        casters.removeCaster(hollow);
+        casters.setTransform(last, 5);
+        casters.defragment();
+        bench::check(casters.casterCount() == 1 && casters.instances.size() == 1 && casters.instances[0].transform == 5,
+            "removing a defragmented empty caster leaves the others alone");
+    }
+}
+
+/**
+ * Registers the walls of 4096 rooms as shadow casters and compares the memory
+ * they take with copying every caster's cells and vertices, then measures the
+ * cost of spawning and despawning props against rebuilding the registry.
+ */
+void castersBenchmark()
+{
+    bench::Rooms rooms;
+    SceneGraph4 graph(rooms.complex);
+
+    ShadowCasterRegistry casters;
+    bench::report("build", bench::measure([&]() { casters.build(graph); }, 5));
+
+    // Copying gives every cell its own 4 vertices, plus an object index
+    size_t copied = casters.instancedCells() * (sizeof(uvec4) + sizeof(unsigned int) + 4 * sizeof(vec4));
+    std::printf("%u cells : %zu KiB, %zu KiB when copied per instance\n", casters.instancedCells(), casters.memory() / 1024, copied / 1024);
+
+    uint32_t cell = 0;
+    bench::report("find instance", bench::measure([&]()
+    {
+        bench::keep(casters.findInstance(cell));
+        cell = (cell + 7919) % casters.instancedCells();
+    }, 1 << 16));
+
+    // Props come and go one at a time, touching only their own entries
+    Geometry4 prop;
+    for(int v = 0; v < 4 * 48; ++v)
+        prop.vertices.push_back(vec4(0.f, 0.f, 0.f, static_cast<float>(v)));
+    std::vector<ShadowCasterRegistry::CasterId> props;
+    bench::report("spawn prop", bench::measure([&]()
+    {
+        props.push_back(casters.addCaster(prop, 0));
+    }, 1024));
+    size_t uploaded = 0;
+    bench::report("despawn prop", bench::measure([&]()
+    {
+        casters.clearDirty();
+        if(props.empty())
+            return;
+        casters.removeCaster(props.back());
+        props.pop_back();
+        uploaded += (casters.dirtyInstances.end - casters.dirtyInstances.begin) * sizeof(ShadowCasterRegistry::Instance);
+    }, 1024));
+    std::printf("%zu bytes to upload per despawn, %zu when rebuilt\n", uploaded / (5 * 1024), casters.memory());
+    std::printf("fragmentation %.3f\n", casters.fragmentation());
+    bench::report("defragment", bench::measure([&]() { casters.defragment(); }, 5));
+
+    checkEmptyCasters(prop);
+}
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/meshes/CellBVH4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    int depth(const CellBVH4 &bvh)
+    {
+        std::vector<int> depths(bvh.nodes.size(), 0);
+        int deepest = 0;
+        for(size_t k = 0; k < bvh.nodes.size(); ++k)
+        {
+            deepest = std::max(deepest, depths[k]);
+            if(!bvh.nodes[k].isLeaf())
+                depths[k + 1] = depths[bvh.nodes[k].offset] = depths[k] + 1;
+        }
+        return deepest;
+    }
+
+    bool reloads(const CellBVH4 &bvh, const Geometry4 &geometry)
+    {
+        std::stringstream file;
+        bvh.save(file);
+        CellBVH4 loaded;
+        return loaded.load(file, geometry);
+    }
+
+    /**
+     * Checks that skewed cell distributions stay within the traversal stacks,
+     * and that corrupt files that would make traversal loop or read past the
+     * nodes are rejected.
+     */
+    void checkRobustness()
+    {
+        // Along each axis, one cell 32 times further than all the others, and
+        // so on, which binned SAH can only split one cell at a time
+        Geometry4 geometry;
+        const unsigned int peeled = 28, cells = 4 * peeled + 16;
+        for(unsigned int c = 0; c < cells; ++c)
+        {
+            vec4 centroid = vec4::zero;
+            if(c < 4 * peeled)
+                centroid(c / peeled) = std::ldexp(1.f, -5 * static_cast<int>(c % peeled));
+            // Flat cells, any extent would round the smallest offsets away
+            for(int i = 0; i < 4; ++i)
+                geometry.vertices.push_back(centroid);
+            geometry.pushCell(4 * c, 4 * c + 1, 4 * c + 2, 4 * c + 3);
+        }
+        CellBVH4 bvh;
+        bvh.build(geometry);
+        bench::check(depth(bvh) <= CellBVH4::maxDepth, "skewed cells stay within CellBVH4::maxDepth");
+        bench::check(reloads(bvh, geometry), "CellBVH4 reloads what it saved");
+
+        CellBVH4 corrupt = bvh;
+        size_t internal = 1;
+        while(corrupt.nodes[internal].isLeaf())
+            ++internal;
+        corrupt.nodes[internal].offset = static_cast<int32_t>(internal);
+        bench::check(!reloads(corrupt, geometry), "CellBVH4::load rejects nodes pointing to themselves");
+        corrupt = bvh;
+        corrupt.nodes[internal].offset = 0;
+        bench::check(!reloads(corrupt, geometry), "CellBVH4::load rejects nodes pointing to an ancestor");
+        corrupt = bvh;
+        corrupt.nodes.back().count = 0;
+        corrupt.nodes.back().offset = static_cast<int32_t>(corrupt.nodes.size() - 1);
+        bench::check(!reloads(corrupt, geometry), "CellBVH4::load rejects an internal last node");
+    }
+}
+
+/**
+ * Casts rays against a soup of 64k random tetrahedra, one at a time and in
+ * packets of 4 coherent rays.
+ */
+void cellBvhBenchmark()
+{
+    const int cells = 1 << 16;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(-20, 20), s(-0.5f, 0.5f);
+
+    Geometry4 geometry;
+    for(unsigned int c = 0; c < cells; ++c)
+    {
+        vec4 base(u(rng), u(rng), u(rng), u(rng));
+        for(int i = 0; i < 4; ++i)
+            geometry.vertices.push_back(base + vec4(s(rng), s(rng), s(rng), s(rng)));
+        geometry.pushCell(4 * c, 4 * c + 1, 4 * c + 2, 4 * c + 3);
+    }
+
+    checkRobustness();
+
+    CellBVH4 bvh;
+    bench::report("build", bench::measure([&]() { bvh.build(geometry); bench::keep(bvh.nodes[0]); }, 1, 3));
+
+    // Packets of 4 rays from the same origin with close directions
+    const int Q = 4096;
+    std::vector<vec4> origins(Q), dirs(4 * Q);
+    for(int q = 0; q < Q; ++q)
+    {
+        origins[q] = vec4(u(rng), u(rng), u(rng), u(rng));
+        vec4 d = normalize(vec4(s(rng), s(rng), s(rng), s(rng)));
+        for(int r = 0; r < 4; ++r)
+            dirs[4 * q + r] = normalize(d + vec4(s(rng), s(rng), s(rng), s(rng)) * 0.02f);
+    }
+
+    int q = 0;
+    CellBVH4::Hit hits[4];
+    bench::report("intersect", bench::measure([&]()
+    {
+        int k = q++ % (4 * Q);
+        bench::keep(bvh.intersect(origins[k / 4], dirs[k], 100, hits[0]));
+    }, 4 * Q), "ray");
+    bench::report("occluded", bench::measure([&]()
+    {
+        int k = q++ % (4 * Q);
+        bench::keep(bvh.occluded(origins[k / 4], dirs[k], 100));
+    }, 4 * Q), "ray");
+    const float tmax[4] = { 100, 100, 100, 100 };
+    bench::report("intersect4", bench::measure([&]()
+    {
+        int k = q++ % Q;
+        const vec4 o[4] = { origins[k], origins[k], origins[k], origins[k] };
+        bench::keep(bvh.intersect4(o, &dirs[4 * k], tmax, hits));
+    }, Q) / 4, "ray");
+}
@@ -0,0 +1,61 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/CollisionWorld4.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+/**
+ * Moves a camera-sized sphere through 100k random world-space cells.
+ */
+void collisionBenchmark()
+{
+    const unsigned int cells = 100000;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> u(-20, 20), s(-0.6f, 0.6f);
+
+    Geometry4 geometry;
+    for(unsigned int c = 0; c < cells; ++c)
+    {
+        vec4 base(u(rng), u(rng), u(rng), u(rng));
+        for(int i = 0; i < 4; ++i)
+            geometry.vertices.push_back(base + vec4(s(rng), s(rng), s(rng), s(rng)));
+        geometry.pushCell(4 * c, 4 * c + 1, 4 * c + 2, 4 * c + 3);
+    }
+
+    CollisionWorld4 world;
+    world.addGeometry(geometry, Transform4());
+    bench::report("build", bench::measure([&]() { world.build(); bench::keep(world.size()); }, 1, 3));
+
+    const int Q = 4096;
+    std::vector<vec4> starts(Q), moves(Q);
+    for(int q = 0; q < Q; ++q)
+    {
+        starts[q] = vec4(u(rng), u(rng), u(rng), u(rng));
+        moves[q] = vec4(s(rng), 0, s(rng), s(rng)) * 0.1f;
+    }
+
+    // Degenerate spheres must not divide by their radius
+    const vec4 moved = world.move(starts[0], 0, moves[0]).position, expected = starts[0] + moves[0];
+    bench::check(moved.x == expected.x && moved.y == expected.y && moved.z == expected.z && moved.w == expected.w,
+        "points move freely");
+    bench::check(std::isfinite(world.move(starts[0], 1e-30f, moves[0]).position.x), "tiny spheres move");
+
+    int q = 0;
+    std::vector<CollisionWorld4::Contact> contacts;
+    bench::report("overlap", bench::measure([&]()
+    {
+        bench::keep(world.overlap(starts[q++ % Q], 0.25f, contacts));
+    }, Q));
+    bench::report("move", bench::measure([&]()
+    {
+        int k = q++ % Q;
+        bench::keep(world.move(starts[k], 0.25f, moves[k]));
+    }, Q));
+}
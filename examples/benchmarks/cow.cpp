@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <unordered_set>
+
+#include "Escher4D/Object4.hpp"
+
+#include "bench.hpp"
+
+namespace
+{
+    // Counts the nodes of a hierarchy, and how many of them are distinct objects
+    void countNodes(const Object4 &root, size_t &total, size_t &unique)
+    {
+        std::unordered_set<const Object4*> seen;
+        total = 0;
+        root.visit([&](const Object4 &obj)
+        {
+            ++total;
+            seen.insert(&obj);
+        });
+        unique = seen.size();
+    }
+}
+
+/**
+ * Tiles 10k copies of a room made of 8 walls of 4 pieces each, as a large level
+ * would, and checks that node storage stays near the amount of unique rooms
+ * until some copies get edited.
+ */
+void cowBenchmark()
+{
+    Object4 &level = Object4::scene.addChild();
+    Object4 &room = level.addChild();
+    for(int w = 0; w < 8; ++w)
+    {
+        Object4 &wall = room.addChild();
+        for(int p = 0; p < 4; ++p)
+            wall.addChild().pos(3) = static_cast<float>(p);
+    }
+
+    const int copies = 10000;
+    bench::report("copy room", bench::measure([&]()
+    {
+        while(level.childCount() > 1)
+            level.removeChildUnordered(level.childCount() - 1);
+        for(int k = 0; k < copies; ++k)
+            level.addChild(level[0]).pos(0) = static_cast<float>(k);
+    }, 5) / copies, "room");
+
+    size_t total, unique;
+    countNodes(level, total, unique);
+    std::printf("%zu nodes, %zu stored\n", total, unique);
+
+    // Reading through a const reference leaves everything shared
+    const Object4 &view = level;
+    const unsigned int structureVersion = Object4::structureVersion();
+    float red = 0;
+    for(int k = 1; k <= copies; k += 100)
+        red += view[k][3][2].color.x;
+    bench::keep(red);
+    size_t readTotal, readUnique;
+    countNodes(level, readTotal, readUnique);
+    bench::check(readUnique == unique && Object4::structureVersion() == structureVersion && view[1].isShared(3),
+        "reading through const operator[] leaves storage shared");
+
+    // Recolor one wall piece in 1% of the rooms ; only the path to it is cloned
+    for(int k = 1; k <= copies; k += 100)
+        level[k][3][2].color = Empty::math::vec4(1, 0, 0, 1);
+    countNodes(level, total, unique);
+    std::printf("after editing 1%% of the rooms : %zu nodes, %zu stored\n", total, unique);
+    bench::check(view[1][3][2].color.x == 1 && view[0][3][2].color.x == 0 && view[2][3][2].color.x == 0,
+        "edits through operator[] only change their own copy");
+    // Copies of the room are never shared, only their walls and pieces
+    bench::check(unique == readUnique + 2 * (copies / 100), "edits clone the access path only");
+
+    Object4::scene.removeChildUnordered(Object4::scene.childCount() - 1);
+}
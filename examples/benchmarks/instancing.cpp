@@ -0,0 +1,44 @@
+#include <cstdio>
+
+#include <Empty/math/mat.h>
+
+#include "Escher4D/InstanceBatcher4.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+/**
+ * Gathers the instances of 4096 rooms built like the rooms of the eightrooms
+ * complex, out of two geometries, and reports how many draw calls remain.
+ */
+void instancingBenchmark()
+{
+    bench::Rooms rooms;
+
+    SceneGraph4 graph(rooms.complex);
+    graph.culling = false;
+    graph.updateWorldTransforms();
+    Transform4 vt;
+    mat4 p = mat4::Identity();
+
+    InstanceBatcher4 batcher;
+    bench::report("gather", bench::measure([&]()
+    {
+        batcher.gather(graph, vt, p);
+        bench::keep(batcher.instances[0]);
+    }, 20) / batcher.instances.size(), "instance");
+    std::printf("%zu instances in %zu draw calls\n", batcher.instances.size(), batcher.batches.size());
+
+    // One batch per render context, in order of appearance, covering the
+    // instances in contiguous ranges
+    bench::check(batcher.instances.size() == static_cast<size_t>(bench::Rooms::count * bench::Rooms::walls), "one instance per wall");
+    bool grouped = batcher.batches.size() == 2 && batcher.batches[0].rc == &rooms.cubeRC && batcher.batches[1].rc == &rooms.holedRC;
+    bench::check(grouped, "one batch per render context");
+    if(grouped)
+    {
+        bench::check(batcher.batches[0].first == 0 && batcher.batches[0].count == bench::Rooms::count * bench::Rooms::cubes, "cube range");
+        bench::check(batcher.batches[1].first == batcher.batches[0].count && batcher.batches[1].first + batcher.batches[1].count == batcher.instances.size(), "holed cube range");
+    }
+}
@@ -0,0 +1,96 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Escher4D/ThreadPool.hpp"
+#include "Escher4D/meshes/Geometry4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+/**
+ * Overhead of the job system : parallel loops of tiny and uneven items, and
+ * task graphs, for increasing amounts of threads ; then normal computation on
+ * the shared pool.
+ */
+void jobsBenchmark()
+{
+    std::vector<unsigned int> threadCounts;
+    for(unsigned int t = 1; t < std::thread::hardware_concurrency(); t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(std::max(1u, std::thread::hardware_concurrency()));
+
+    const size_t items = 1 << 20;
+    std::vector<float> data(items, 1.f);
+    for(unsigned int threads : threadCounts)
+    {
+        ThreadPool pool(threads);
+        char name[64];
+
+        std::snprintf(name, sizeof(name), "parallelFor, %u threads", threads);
+        double ns = bench::measure([&]()
+        {
+            pool.parallelFor(items, [&](size_t k, unsigned int) { data[k] = data[k] * 0.5f + 1.f; });
+        }, 10);
+        bench::report(name, ns / items, "item");
+
+        // Item k costs k, so that static splits would leave workers idle
+        std::snprintf(name, sizeof(name), "parallelFor uneven, %u threads", threads);
+        const size_t uneven = 2048;
+        ns = bench::measure([&]()
+        {
+            pool.parallelFor(uneven, [&](size_t k, unsigned int)
+            {
+                float x = 0;
+                for(size_t i = 0; i < k; ++i)
+                    x += std::sqrt(static_cast<float>(i));
+                bench::keep(x);
+            });
+        }, 5);
+        bench::report(name, ns, "loop");
+
+        // Binary tree of tasks, each waiting for its parent
+        TaskGraph graph;
+        const size_t tasks = 4095;
+        std::atomic<size_t> done{0};
+        for(size_t k = 0; k < tasks; ++k)
+        {
+            graph.add([&](unsigned int) { done.fetch_add(1, std::memory_order_relaxed); });
+            if(k > 0)
+                graph.precede((k - 1) / 2, k);
+        }
+        std::snprintf(name, sizeof(name), "task graph, %u threads", threads);
+        ns = bench::measure([&]() { pool.run(graph); }, 20);
+        bench::report(name, ns / tasks, "task");
+        bench::check(done == tasks * 20 * 5, "task graphs run every task once");
+    }
+
+    // Random tetrahedra sharing vertices
+    Geometry4 geometry;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(-1, 1);
+    const unsigned int vertices = 50000, cells = 200000;
+    for(unsigned int k = 0; k < vertices; ++k)
+        geometry.vertices.push_back(vec4(coord(rng), coord(rng), coord(rng), coord(rng)));
+    std::uniform_int_distribution<unsigned int> vertex(0, vertices - 1);
+    for(unsigned int k = 0; k < cells; ++k)
+        geometry.pushCell(vertex(rng), vertex(rng), vertex(rng), vertex(rng));
+    char name[64];
+    std::snprintf(name, sizeof(name), "recomputeNormals, %u threads", ThreadPool::get().size());
+    bench::report(name, bench::measure([&]() { geometry.recomputeNormals(); }, 3) / cells, "cell");
+
+    // Cells are summed in order whatever the amount of workers
+    Geometry4 serial = geometry;
+    ThreadPool single(1);
+    geometry.recomputeNormals();
+    serial.recomputeNormals(false, single);
+    bool same = serial.normals.size() == geometry.normals.size();
+    for(size_t k = 0; same && k < serial.normals.size(); ++k)
+        for(int i = 0; i < 4; ++i)
+            same = same && serial.normals[k](i) == geometry.normals[k](i);
+    bench::check(same, "parallel recomputeNormals matches a serial run");
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/Transform4.hpp"
+#include "Escher4D/TransformKernels.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    float maxDifference(const std::vector<vec4> &a, const std::vector<vec4> &b, size_t n)
+    {
+        float d = 0;
+        for(size_t k = 0; k < n; ++k)
+            d = std::max(d, std::max(std::max(std::abs(a[k].x - b[k].x), std::abs(a[k].y - b[k].y)),
+                std::max(std::abs(a[k].z - b[k].z), std::abs(a[k].w - b[k].w))));
+        return d;
+    }
+}
+
+/**
+ * Transforms 1M-vertex spans with every instruction set available, in both the
+ * AoS and AoSoA layouts, and compares with a loop of Transform4::apply. Every
+ * kernel is first checked against Transform4::apply and the normal matrix,
+ * on an odd amount of vectors so that the tails are covered too.
+ */
+void transformKernelsBenchmark()
+{
+    const size_t N = 1 << 20;
+    std::vector<vec4> in(N), out(N);
+    for(size_t k = 0; k < N; ++k)
+        in[k] = normalize(vec4(static_cast<float>(k % 7) - 3, static_cast<float>(k % 13) + 1, static_cast<float>(k % 5), 1.f));
+    
+    Transform4 t;
+    t.rotate(XY, 0.3f).rotate(ZW, 1.2f).scale(vec4(10, 6, 10, 10)).pos = vec4(1, 2, 3, 4);
+    mat4 n = t.normalMatrix();
+    
+    std::vector<TransformKernels::Vec4x8> blocksIn, blocksOut(N / 8);
+    TransformKernels::toAoSoA(in.data(), N, blocksIn);
+    
+    // References, the odd count leaving a tail after the wide loops
+    const size_t odd = N - 3;
+    std::vector<vec4> points(N), normals(N), result(N);
+    for(size_t k = 0; k < N; ++k)
+    {
+        points[k] = t.apply(in[k]);
+        normals[k] = normalize(n * in[k]);
+    }
+    
+    bench::report("Transform4::apply", bench::measure([&]()
+    {
+        for(size_t k = 0; k < N; ++k)
+            out[k] = t.apply(in[k]);
+        bench::keep(out[0]);
+    }, 5) / N, "vertex");
+    
+    const struct
+    {
+        const char *name;
+        TransformKernels::Isa isa;
+    } isas[] = {
+        { "scalar", TransformKernels::Isa::Scalar },
+        { "SSE", TransformKernels::Isa::SSE },
+        { "AVX2", TransformKernels::Isa::AVX2 }
+    };
+    
+    for(const auto &isa : isas)
+    {
+        if(TransformKernels::setIsa(isa.isa) != isa.isa)
+            continue;
+        std::string name(isa.name);
+        std::fill(result.begin(), result.end(), vec4(0, 0, 0, 0));
+        TransformKernels::transformPoints(t, in.data(), result.data(), odd);
+        bench::check(maxDifference(result, points, odd) < 1e-4f && result[odd].x == 0, (name + " : points AoS match Transform4::apply").c_str());
+        TransformKernels::transformPoints(t, blocksIn.data(), blocksOut.data(), N / 8);
+        TransformKernels::fromAoSoA(blocksOut.data(), N, result.data());
+        bench::check(maxDifference(result, points, N) < 1e-4f, (name + " : points AoSoA match Transform4::apply").c_str());
+        std::fill(result.begin(), result.end(), vec4(0, 0, 0, 0));
+        TransformKernels::transformNormals(n, in.data(), result.data(), odd);
+        bench::check(maxDifference(result, normals, odd) < 1e-5f && result[odd].x == 0, (name + " : normals match the normal matrix").c_str());
+        
+        bench::report((name + " : points AoS").c_str(), bench::measure([&]()
+        {
+            TransformKernels::transformPoints(t, in.data(), out.data(), N);
+            bench::keep(out[0]);
+        }, 5) / N, "vertex");
+        bench::report((name + " : points AoSoA").c_str(), bench::measure([&]()
+        {
+            TransformKernels::transformPoints(t, blocksIn.data(), blocksOut.data(), N / 8);
+            bench::keep(blocksOut[0]);
+        }, 5) / N, "vertex");
+        bench::report((name + " : normals").c_str(), bench::measure([&]()
+        {
+            TransformKernels::transformNormals(n, in.data(), out.data(), N);
+            bench::keep(out[0]);
+        }, 5) / N, "vertex");
+    }
+    TransformKernels::setIsa(TransformKernels::supportedIsa());
+}
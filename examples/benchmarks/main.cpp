@@ -0,0 +1,78 @@
+#include <cstring>
+#include <iostream>
+
+#include "Escher4D/Context.h"
+#include "Escher4D/Object4.hpp"
+
+#include "bench.hpp"
+
+// Only referenced, no window is ever created
+Context Context::_instance;
+// Root of the hierarchies built by the benchmarks
+Object4 Object4::scene;
+
+// bvh.cpp
+void bvhBenchmark();
+// casters.cpp
+void castersBenchmark();
+// cells.cpp
+void cellBvhBenchmark();
+// collision.cpp
+void collisionBenchmark();
+// cow.cpp
+void cowBenchmark();
+// instancing.cpp
+void instancingBenchmark();
+// jobs.cpp
+void jobsBenchmark();
+// kernels.cpp
+void transformKernelsBenchmark();
+// pool.cpp
+void poolBenchmark();
+// queue.cpp
+void renderQueueBenchmark();
+// raster.cpp
+void rasterBenchmark();
+// rotors.cpp
+void rotorBenchmark();
+// transforms.cpp
+void transformInverseBenchmark();
+
+/**
+ * Runs every benchmark, or only those whose name is given on the command line.
+ */
+int main(int argc, char *argv[])
+{
+    const struct
+    {
+        const char *name;
+        void (*run)();
+    } benchmarks[] = {
+        { "bvh", bvhBenchmark },
+        { "casters", castersBenchmark },
+        { "cells", cellBvhBenchmark },
+        { "collision", collisionBenchmark },
+        { "cow", cowBenchmark },
+        { "instancing", instancingBenchmark },
+        { "inverse", transformInverseBenchmark },
+        { "jobs", jobsBenchmark },
+        { "kernels", transformKernelsBenchmark },
+        { "pool", poolBenchmark },
+        { "queue", renderQueueBenchmark },
+        { "raster", rasterBenchmark },
+        { "rotors", rotorBenchmark },
+    };
+    
+    for(const auto &b : benchmarks)
+    {
+        bool selected = argc < 2;
+        for(int k = 1; k < argc; ++k)
+            selected = selected || !strcmp(argv[k], b.name);
+        if(selected)
+        {
+            std::cout << "### " << b.name << std::endl;
+            b.run();
+        }
+    }
+    return bench::failures() ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "Escher4D/Object4.hpp"
+#include "Escher4D/Pool.hpp"
+
+#include "bench.hpp"
+
+namespace
+{
+    // Builds a hierarchy of 10 * 100 * 100 nodes under the scene
+    void buildScene()
+    {
+        for(int i = 0; i < 10; ++i)
+        {
+            Object4 &a = Object4::scene.addChild();
+            for(int j = 0; j < 100; ++j)
+            {
+                Object4 &b = a.addChild();
+                for(int k = 0; k < 99; ++k)
+                    b.addChild().pos(0) = static_cast<float>(k);
+            }
+        }
+    }
+
+    void clearScene()
+    {
+        while(Object4::scene.childCount())
+            Object4::scene.removeChildUnordered(0);
+    }
+
+    float sumScene()
+    {
+        float sum = 0;
+        Object4::scene.visit([&sum](const Object4 &obj) { sum += obj.pos(0); });
+        return sum;
+    }
+}
+
+/**
+ * Builds and destroys 100k-node hierarchies through the node pool, then
+ * compares walking a pooled hierarchy with walking a contiguous copy of it.
+ */
+void poolBenchmark()
+{
+    bench::report("build + destroy 100k nodes", bench::measure([]()
+    {
+        buildScene();
+        clearScene();
+    }, 5) / 1e5, "node");
+
+    // Same pattern without pooling, for reference
+    struct Node
+    {
+        float data[sizeof(Object4) / sizeof(float)];
+        std::vector<std::shared_ptr<Node>> children;
+    };
+    bench::report("build + destroy 100k nodes, new + shared_ptr", bench::measure([]()
+    {
+        std::vector<std::shared_ptr<Node>> roots;
+        for(int i = 0; i < 10; ++i)
+        {
+            roots.push_back(std::shared_ptr<Node>(new Node));
+            for(int j = 0; j < 100; ++j)
+            {
+                roots.back()->children.push_back(std::shared_ptr<Node>(new Node));
+                for(int k = 0; k < 99; ++k)
+                    roots.back()->children.back()->children.push_back(std::shared_ptr<Node>(new Node));
+            }
+        }
+        bench::keep(roots);
+    }, 5) / 1e5, "node");
+
+    buildScene();
+    bench::report("visit pooled hierarchy", bench::measure([]() { bench::keep(sumScene()); }, 20) / 1e5, "node");
+
+    // Replace each top-level subtree by a contiguous copy
+    std::vector<Object4*> scattered;
+    for(unsigned int k = 0; k < Object4::scene.childCount(); ++k)
+        scattered.push_back(&Object4::scene[k]);
+    bool contiguous = true;
+    for(Object4 *obj : scattered)
+    {
+        // Nodes of a single block follow each other at a constant stride
+        std::vector<const Object4*> nodes;
+        Object4::scene.addSubtree(*obj).visit([&nodes](const Object4 &o) { nodes.push_back(&o); });
+        const ptrdiff_t stride = reinterpret_cast<const char*>(nodes[1]) - reinterpret_cast<const char*>(nodes[0]);
+        for(size_t k = 1; k < nodes.size(); ++k)
+            contiguous = contiguous && stride > 0
+                && reinterpret_cast<const char*>(nodes[k]) - reinterpret_cast<const char*>(nodes[k - 1]) == stride;
+    }
+    bench::check(contiguous, "addSubtree lays out each copy in a single block");
+    for(size_t k = 0; k < scattered.size(); ++k)
+        Object4::scene.removeChild(0);
+    bench::report("visit contiguous hierarchy", bench::measure([]() { bench::keep(sumScene()); }, 20) / 1e5, "node");
+    clearScene();
+
+    Pool<Node> pool;
+    std::vector<Pool<Node>::Handle> handles(1 << 16);
+    bench::report("Pool<T> create + destroy", bench::measure([&]()
+    {
+        for(auto &h : handles)
+            h = pool.create();
+        for(auto &h : handles)
+            pool.destroy(h);
+    }, 20) / handles.size(), "object");
+}
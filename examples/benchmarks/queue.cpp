@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#include <Empty/math/mat.h>
+
+#include "Escher4D/RenderQueue4.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+/**
+ * Queues the walls of 4096 rooms, alternating between two geometries and four
+ * colors, and reports how much state submission forwards once sorted.
+ */
+void renderQueueBenchmark()
+{
+    bench::Rooms rooms;
+    const vec4 colors[] = { vec4(1, 0, 0, 1), vec4(0, 1, 0, 1), vec4(0, 0, 1, 1) };
+    for(int k = 0; k < bench::Rooms::count; ++k)
+        for(int c = bench::Rooms::cubes; c < bench::Rooms::walls; ++c)
+            rooms.complex[k][c].color = colors[c - bench::Rooms::cubes];
+
+    SceneGraph4 graph(rooms.complex);
+    graph.culling = false;
+    graph.updateWorldTransforms();
+    Transform4 vt;
+    vt.pos = vec4(-8, -1, -8, -8);
+    mat4 p = mat4::Identity();
+
+    RenderQueue4 queue;
+    RecordingRenderBackend4 backend;
+    const double n = static_cast<double>(graph.size());
+    bench::report("gather", bench::measure([&]() { queue.gather(graph, vt, p); }, 20) / n, "node");
+
+    queue.submit(backend);
+    std::printf("unsorted : %u geometry binds, %u color uploads for %u draws\n", queue.stats.geometries, queue.stats.colors, queue.stats.draws);
+
+    std::vector<RenderQueue4::Packet> packets = queue.packets, scratch;
+    bench::report("radix sort", bench::measure([&]()
+    {
+        packets = queue.packets;
+        RenderQueue4::radixSort(packets, scratch);
+    }, 20) / n, "packet");
+    bench::report("std::sort", bench::measure([&]()
+    {
+        packets = queue.packets;
+        std::sort(packets.begin(), packets.end(), [](const RenderQueue4::Packet &a, const RenderQueue4::Packet &b) { return a.key < b.key; });
+    }, 20) / n, "packet");
+
+    queue.sort();
+    bench::report("submit", bench::measure([&]()
+    {
+        backend.commands.clear();
+        queue.submit(backend);
+    }, 20) / n, "packet");
+    std::printf("sorted : %u geometry binds, %u color uploads for %u draws\n", queue.stats.geometries, queue.stats.colors, queue.stats.draws);
+
+    // Replays the recorded stream: every state change must be needed by the
+    // draw that follows it, and every draw must use the state it expects
+    typedef RecordingRenderBackend4::CommandType Type;
+    const void *program = nullptr, *rc = nullptr;
+    vec4 color = vec4::zero;
+    bool colorSet = false, redundant = false, wrong = false;
+    unsigned int draws = 0, binds = 0;
+    for(const RecordingRenderBackend4::Command &c : backend.commands)
+    {
+        switch(c.type)
+        {
+        case Type::Program:
+            redundant |= c.object == program;
+            program = c.object;
+            rc = nullptr;
+            colorSet = false;
+            break;
+        case Type::Geometry:
+            redundant |= c.object == rc;
+            rc = c.object;
+            binds++;
+            break;
+        case Type::Color:
+            redundant |= colorSet && c.value.x == color.x && c.value.y == color.y && c.value.z == color.z && c.value.w == color.w;
+            color = c.value;
+            colorSet = true;
+            break;
+        case Type::Draw:
+        {
+            const RenderQueue4::Draw &d = queue.draws[queue.packets[draws].payload];
+            wrong |= program != &rooms.program || c.object != rc || !colorSet || d.color.x != color.x || d.color.y != color.y || d.color.z != color.z || d.color.w != color.w;
+            draws++;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    bench::check(draws == queue.packets.size() && draws == static_cast<unsigned int>(bench::Rooms::count * bench::Rooms::walls), "one draw per wall");
+    bench::check(binds == 2, "one geometry bind per render context once sorted");
+    bench::check(!redundant, "no redundant program, geometry or color changes");
+    bench::check(!wrong, "draws use the state of their own packet");
+}
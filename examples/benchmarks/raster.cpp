@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <Empty/gl/ShaderProgram.hpp>
+
+#include "Escher4D/Model4RenderContext.hpp"
+#include "Escher4D/Object4.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/SoftwareRenderer4.hpp"
+#include "Escher4D/ThreadPool.hpp"
+#include "Escher4D/utils.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    /**
+     * Boundary of the [-1, 1]^4 tesseract : 8 cubes of 6 tetrahedra each, with
+     * flat normals.
+     */
+    Geometry4 tesseract()
+    {
+        Geometry4 g;
+        const int perms[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+        for(int axis = 0; axis < 4; ++axis)
+            for(float side : { -1.f, 1.f })
+            {
+                int free[3], f = 0;
+                for(int i = 0; i < 4; ++i)
+                    if(i != axis)
+                        free[f++] = i;
+                vec4 n = vec4::zero;
+                n(axis) = side;
+                // Kuhn triangulation : walk from (-1, -1, -1) to (1, 1, 1) one axis at a time
+                for(const auto &perm : perms)
+                {
+                    vec4 v = vec4(-1, -1, -1, -1);
+                    v(axis) = side;
+                    for(int k = 0; k < 4; ++k)
+                    {
+                        if(k > 0)
+                            v(free[perm[k - 1]]) = 1;
+                        g.vertices.push_back(v);
+                        g.normals.push_back(n);
+                    }
+                }
+            }
+        return g;
+    }
+}
+
+/**
+ * Renders a field of sliced tesseracts with the software renderer, with and
+ * without shadows, for increasing amounts of threads.
+ */
+void rasterBenchmark()
+{
+    Geometry4 geometry = tesseract();
+    Empty::gl::ShaderProgram program;
+    Model4RenderContext rc(geometry, program);
+
+    // Tesseracts at various depths along W, so that they all slice differently
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> w(-0.9f, 0.9f), angle(0, 3.14f);
+    Object4 &field = Object4::scene.addChild();
+    Object4 &floor = field.addChild(rc);
+    floor.scale(vec4(20, 0.1f, 20, 20)).pos(1) = -1.1f;
+    floor.color = vec4(0.8f, 0.8f, 0.8f, 1);
+    for(int i = 0; i < 16; ++i)
+        for(int j = 0; j < 16; ++j)
+        {
+            Object4 &o = field.addChild(rc);
+            o.rotate(XW, angle(rng)).rotate(YZ, angle(rng));
+            o.scale(vec4(0.4f, 0.4f, 0.4f, 0.4f));
+            o.pos = vec4(i - 7.5f, 0, j - 12.f, w(rng) * 0.4f);
+            o.color = vec4((i & 3) / 3.f, (j & 3) / 3.f, 0.5f, 1);
+        }
+    SceneGraph4 graph(field);
+    graph.updateWorldTransforms();
+
+    const int width = 640, height = 360;
+    mat4 p = mat4::Identity();
+    perspective(p, 90, static_cast<float>(width) / height, 0.01f, 40.f);
+    Transform4 camera;
+    camera.pos = vec4(0, 1.5f, 4, 0);
+    const Transform4 vt = camera.inverse();
+    SoftwareRenderer4::Light light;
+    light.position = vec4(0, 4, -4, 0);
+
+    std::vector<unsigned int> threadCounts;
+    for(unsigned int t = 1; t < std::thread::hardware_concurrency(); t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<uint32_t> reference;
+    for(bool shadows : { false, true })
+        for(unsigned int threads : threadCounts)
+        {
+            ThreadPool pool(threads);
+            SoftwareRenderer4 renderer(pool, width, height);
+            renderer.shadows = shadows;
+            double ns = bench::measure([&]() { renderer.render(graph, vt, p, light); }, 4, 3);
+            char name[64];
+            std::snprintf(name, sizeof(name), "%s, %u threads", shadows ? "shadows" : "no shadows", threads);
+            bench::report(name, ns, "frame");
+            std::printf("    %.1f FPS, %.1f Mpixels/s, %u triangles, %u shadow rays\n", 1e9 / ns,
+                width * height * 1e3 / ns, renderer.stats.triangles, renderer.stats.shadowRays);
+
+            // Tiles do not depend on the amount of threads
+            if(threads == 1)
+                reference = renderer.image;
+            else
+                bench::check(renderer.image == reference, "images do not depend on the amount of threads");
+        }
+
+    Object4::scene.removeChildUnordered(Object4::scene.childCount() - 1);
+}
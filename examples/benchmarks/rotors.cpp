@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/Transform4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+namespace
+{
+    float maxDifference(const vec4 &a, const vec4 &b)
+    {
+        return std::max(std::max(std::abs(a.x - b.x), std::abs(a.y - b.y)), std::max(std::abs(a.z - b.z), std::abs(a.w - b.w)));
+    }
+}
+
+/**
+ * Checks rotors against the matrices of the same rotations, then compares the
+ * cost of applying and composing both representations.
+ */
+void rotorBenchmark()
+{
+    const Planes4 planes[] = { XY, XZ, XW, YZ, YW, ZW };
+    std::mt19937 rng(29);
+    std::uniform_real_distribution<float> angle(-3.f, 3.f), coord(-1.f, 1.f);
+    std::uniform_int_distribution<int> plane(0, 5);
+    
+    // Random sequences of rotations, built both ways
+    float sandwichError = 0, matrixError = 0;
+    for(int k = 0; k < 1000; ++k)
+    {
+        Rotor4 r;
+        Transform4 t;
+        for(int i = 0; i < 8; ++i)
+        {
+            const Planes4 p = planes[plane(rng)];
+            const float a = angle(rng);
+            r = Rotor4::rotation(p, a) * r;
+            t.rotate(p, a);
+        }
+        const mat4 m = r.toMatrix();
+        const vec4 v(coord(rng), coord(rng), coord(rng), coord(rng));
+        sandwichError = std::max(sandwichError, maxDifference(r.apply(v), t.apply(v)));
+        matrixError = std::max(matrixError, maxDifference(m * v, t.apply(v)));
+    }
+    bench::check(sandwichError < 1e-4f, "Rotor4::apply matches Transform4::rotate");
+    bench::check(matrixError < 1e-4f, "Rotor4::toMatrix matches Transform4::rotate");
+    
+    // Long chains of small rotations, renormalized as a camera would
+    RotorTransform4 chained;
+    for(int k = 0; k < 1000000; ++k)
+    {
+        chained.rotate(planes[k % 6], 0.001f * (k % 7 + 1));
+        if(k % 1000 == 0)
+            chained.renormalize();
+    }
+    chained.renormalize();
+    const mat4 m = chained.rotor.toMatrix(), mtm = transpose(m) * m;
+    float drift = 0;
+    for(int i = 0; i < 4; ++i)
+        for(int j = 0; j < 4; ++j)
+            drift = std::max(drift, std::abs(mtm(i, j) - (i == j ? 1.f : 0.f)));
+    bench::check(drift < 1e-5f, "renormalized rotors stay orthonormal");
+    std::printf("    max error %g (sandwich), %g (matrix), drift after 1M rotations %g\n", sandwichError, matrixError, drift);
+    
+    const size_t N = 1 << 16;
+    std::vector<vec4> in(N), out(N);
+    for(vec4 &v : in)
+        v = vec4(coord(rng), coord(rng), coord(rng), coord(rng));
+    Rotor4 r = Rotor4::rotation(XY, 0.3f) * Rotor4::rotation(ZW, 1.2f) * Rotor4::rotation(XW, -0.4f);
+    const Transform4 t(r.toMatrix(), vec4(0, 0, 0, 0));
+    
+    bench::report("Rotor4::apply", bench::measure([&]()
+    {
+        for(size_t k = 0; k < N; ++k)
+            out[k] = r.apply(in[k]);
+        bench::keep(out[0]);
+    }, 20) / N, "vector");
+    bench::report("Rotor4::toMatrix, then multiply", bench::measure([&]()
+    {
+        for(size_t k = 0; k < N; ++k)
+            out[k] = r.toMatrix() * in[k];
+        bench::keep(out[0]);
+    }, 20) / N, "vector");
+    bench::report("Transform4::apply", bench::measure([&]()
+    {
+        for(size_t k = 0; k < N; ++k)
+            out[k] = t.apply(in[k]);
+        bench::keep(out[0]);
+    }, 20) / N, "vector");
+    
+    const long compositions = 1 << 20;
+    Rotor4 step = Rotor4::rotation(YW, 0.001f), acc;
+    bench::report("Rotor4 product", bench::measure([&]() { acc = step * acc; bench::keep(acc); }, compositions));
+    Transform4 stepT(step.toMatrix(), vec4(0, 0, 0, 0)), accT;
+    bench::report("Transform4::chain", bench::measure([&]() { accT = accT.chain(stepT); bench::keep(accT); }, compositions));
+    bench::report("Rotor4::normalize", bench::measure([&]() { acc.normalize(); bench::keep(acc); }, compositions));
+}
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <Empty/math/funcs.h>
+
+#include "Escher4D/Transform4.hpp"
+
+#include "bench.hpp"
+
+using namespace Empty::math;
+
+/**
+ * Compares the closed-form inverses picked by Transform4::classify to the general
+ * 4x4 inverse for each class of transform, after checking that they agree.
+ */
+void transformInverseBenchmark()
+{
+    const long N = 1 << 20;
+    
+    Transform4 rigid, scaled, general;
+    rigid.rotate(XY, 0.3f).rotate(ZW, 1.2f).rotate(XW, -0.4f);
+    scaled = rigid;
+    scaled.scale(vec4(10, 6, 10, 10));
+    general = scaled;
+    general.mat(0, 1) += 0.5f;
+    
+    const struct
+    {
+        const char *name;
+        const Transform4 &t;
+        Transform4::Kind kind;
+    } cases[] = {
+        { "rigid", rigid, Transform4::Rigid },
+        { "scaled-orthogonal", scaled, Transform4::ScaledOrthogonal },
+        { "general", general, Transform4::General }
+    };
+    
+    for(const auto &c : cases)
+    {
+        std::string name(c.name);
+        const Transform4 &t = c.t;
+        Transform4::Kind kind = t.classify();
+        bench::check(kind == c.kind, (name + " : classify returns the expected kind").c_str());
+        const mat4 closed = t.normalMatrix(), reference = transpose(inverse(t.mat));
+        float error = 0;
+        for(int i = 0; i < 4; ++i)
+            for(int j = 0; j < 4; ++j)
+                error = std::max(error, std::abs(closed(i, j) - reference(i, j)));
+        bench::check(error < 1e-4f, (name + " : normal matrix matches the general inverse").c_str());
+        bench::report((name + " : classify").c_str(), bench::measure([&]() { bench::keep(t.classify()); }, N));
+        bench::report((name + " : general inverse").c_str(),
+            bench::measure([&]() { bench::keep(transpose(inverse(t.mat))); }, N));
+        bench::report((name + " : classified normal matrix").c_str(),
+            bench::measure([&]() { bench::keep(t.normalMatrix(kind)); }, N));
+        bench::report((name + " : classify + normal matrix").c_str(),
+            bench::measure([&]() { bench::keep(t.normalMatrix()); }, N));
+    }
+}
@@ -4,7 +4,14 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -17,14 +24,30 @@
 #include <Empty/gl/ShaderProgram.hpp>
 #include <Empty/math/vec.h>
 #include <Empty/math/mat.h>
+#include <stb_image_write.h>
 
 #include "Escher4D/Camera4.hpp"
+#include "Escher4D/CameraPath4.hpp"
+#include "Escher4D/CollisionWorld4.hpp"
 #include "Escher4D/Context.h"
+#include "Escher4D/FramePipeline.hpp"
+#include "Escher4D/FrameRecorder.hpp"
+#include "Escher4D/FrameTimings.hpp"
 #include "Escher4D/FSQuadRenderContext.hpp"
+#include "Escher4D/GPUTimer.hpp"
 #include "Escher4D/HierarchicalBuffer.hpp"
+#include "Escher4D/InputSource.hpp"
+#include "Escher4D/InstanceBatcher4.hpp"
 #include "Escher4D/meshes/mesh_loading.hpp"
 #include "Escher4D/Object4.hpp"
+#include "Escher4D/Profiler.hpp"
+#include "Escher4D/RenderQueue4.hpp"
+#include "Escher4D/RenderStats.hpp"
+#include "Escher4D/SceneGraph4.hpp"
+#include "Escher4D/ShadowCasterRegistry.hpp"
 #include "Escher4D/ShadowHypervolumes.hpp"
+#include "Escher4D/ThreadPool.hpp"
+#include "Escher4D/UploadRing.hpp"
 #include "Escher4D/utils.hpp"
 
 Context Context::_instance;
@@ -41,10 +64,82 @@ static void printGLerror(Empty::gl::DebugMessageSource, Empty::gl::DebugMessageT
         << message << std::endl;
 }
 
-int _main(int, char *argv[])
+int _main(int argc, char *argv[])
 {
+    // --headless [frames] renders a given amount of frames offscreen, then exits
+    // --render path dir [fps] renders a camera path offscreen to dir/frame_NNNNN.png, then exits
+    // --record file saves the camera input to an input script
+    // --benchmark script [dt] [json] replays an input script at a fixed time step, then writes frame timings
+    // --pipelined simulates the next frame on a thread of its own while the current one renders
+    int headlessFrames = -1;
+    const char *renderPath = nullptr, *renderDir = nullptr;
+    float renderFPS = 30;
+    const char *recordPath = nullptr, *benchmarkPath = nullptr, *benchmarkOutput = nullptr;
+    float benchmarkDt = 1.f / 60.f;
+    bool pipelined = false;
+    for(int k = 1; k < argc; ++k)
+        if(!std::strcmp(argv[k], "--headless"))
+            headlessFrames = k + 1 < argc && argv[k + 1][0] != '-' ? std::atoi(argv[k + 1]) : 60;
+        else if(!std::strcmp(argv[k], "--render") && k + 2 < argc)
+        {
+            renderPath = argv[k + 1];
+            renderDir = argv[k + 2];
+            if(k + 3 < argc && argv[k + 3][0] != '-')
+                renderFPS = static_cast<float>(std::atof(argv[k + 3]));
+        }
+        else if(!std::strcmp(argv[k], "--record") && k + 1 < argc)
+            recordPath = argv[k + 1];
+        else if(!std::strcmp(argv[k], "--benchmark") && k + 1 < argc)
+        {
+            benchmarkPath = argv[k + 1];
+            if(k + 2 < argc && argv[k + 2][0] != '-')
+                benchmarkDt = static_cast<float>(std::atof(argv[k + 2]));
+            if(k + 3 < argc && argv[k + 3][0] != '-')
+                benchmarkOutput = argv[k + 3];
+        }
+        else if(!std::strcmp(argv[k], "--pipelined"))
+            pipelined = true;
+    
+    CameraPath4 cameraPath;
+    if(renderPath)
+    {
+        if(!cameraPath.load(renderPath) || cameraPath.keys.empty() || renderFPS <= 0)
+        {
+            trace("Can't load camera path " << renderPath);
+            return 1;
+        }
+        headlessFrames = static_cast<int>(cameraPath.duration() * renderFPS) + 1;
+    }
+    
+    InputScript benchmarkScript;
+    if(benchmarkPath)
+    {
+        if(!benchmarkScript.load(benchmarkPath) || benchmarkDt <= 0)
+        {
+            trace("Can't load input script " << benchmarkPath);
+            return 1;
+        }
+        headlessFrames = static_cast<int>(benchmarkScript.frames());
+    }
+    
     Context& context = Context::get();
-    context.init("Escher4D demo", 1920, 1080);
+    bool initialized;
+#ifdef ESCHER_HEADLESS
+    if(headlessFrames >= 0)
+        initialized = context.initHeadless(1920, 1080);
+    else
+#else
+    if(headlessFrames >= 0)
+    {
+        trace("Headless mode needs ESCHER_HEADLESS, opening a window instead");
+        // Camera paths and benchmarks can run in the window all the same
+        if(!renderPath && !benchmarkPath)
+            headlessFrames = -1;
+    }
+#endif
+    initialized = context.init("Escher4D demo", 1920, 1080);
+    if(!initialized)
+        return 1;
 
     {
         using namespace Empty::gl;
@@ -58,10 +153,22 @@ int _main(int, char *argv[])
     }
 
     context.setViewport(context.frameWidth, context.frameHeight);
+    Profiler::get().setThreadName("main");
     
     context.enable(Empty::gl::ContextCapability::DepthTest);
     
-    Camera4 camera(context.window);
+    // Cameras of headless runs stay put, unless replaying a script
+    Camera4 camera;
+    GLFWInputSource liveInput(context.headless() ? nullptr : context.window);
+    InputSource *input = &liveInput;
+    if(benchmarkPath)
+        input = &benchmarkScript;
+    std::unique_ptr<InputRecorder> inputRecorder;
+    if(recordPath)
+    {
+        inputRecorder = std::make_unique<InputRecorder>(*input, recordPath);
+        input = inputRecorder.get();
+    }
     camera.pos = Empty::math::vec4(0.f, 1.5f, 0.f, 0.f);
     
     Empty::math::mat4 p = Empty::math::mat4::Identity();
@@ -70,6 +177,12 @@ int _main(int, char *argv[])
     program.attachFile(Empty::gl::ShaderType::Geometry, "shaders/geometry.glsl");
     program.attachFile(Empty::gl::ShaderType::Fragment, "shaders/fragment.glsl");
     program.build();
+    // Same pipeline, reading transforms and colors from the instance buffer
+    Empty::gl::ShaderProgram instancedProgram;
+    instancedProgram.attachFile(Empty::gl::ShaderType::Vertex, "shaders/vertex_instanced.glsl");
+    instancedProgram.attachFile(Empty::gl::ShaderType::Geometry, "shaders/geometry.glsl");
+    instancedProgram.attachFile(Empty::gl::ShaderType::Fragment, "shaders/fragment.glsl");
+    instancedProgram.build();
     
     // Load geometry
     Geometry4 cubeGeometry, holedGeometry;
@@ -166,9 +279,10 @@ int _main(int, char *argv[])
     
     float lightIntensity = 10.f, lightRadius = 20;
     
-    float timeBase = static_cast<float>(glfwGetTime());
+    float timeBase = static_cast<float>(context.time());
     
-    glfwSetInputMode(context.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if(!context.headless())
+        glfwSetInputMode(context.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     
     complex.scale(Empty::math::vec4(10, 6, 10, 10)).pos(1) = 3;
     
@@ -186,46 +300,64 @@ int _main(int, char *argv[])
     /// Setup shadow hypervolumes computations
     ShadowHypervolumes svComputer;
     
-    std::vector<Empty::math::uvec4> cellsCompBuffer; // uvec4
-    std::vector<unsigned int> objIndexCompBuffer; // uint
-    std::vector<Empty::math::vec4> vertexCompBuffer; // vec4
-    std::vector<Empty::math::mat4> MCompBuffer; // mat4
-    std::vector<Empty::math::vec4> MtCompBuffer; // vec4
+    // Flatten the scene ; node indices double as transform indices for the shadow pass
+    SceneGraph4 sceneGraph(Object4::scene);
     
-    int objectIndex = 0;
-    Object4::scene.visit([&](const Object4 &obj)
+    // Shadow casters share the cells of their geometry
+    ShadowCasterRegistry casters;
+    casters.build(sceneGraph);
+    trace("Shadow casters : " << casters.instances.size() << " instances of " << casters.geometries.size() << " geometries, "
+        << casters.memory() / 1024 << " KiB");
+    
+    // Keep the camera from walking through walls
+    CollisionWorld4 collisionWorld;
+    collisionWorld.build(sceneGraph);
+    camera.collider = &collisionWorld;
+    
+    // The UI edits a copy of the camera settings, applied between simulation steps
+    struct
+    {
+        float speed, rotationDivisorX, rotationDivisorY, xwzwSpeed;
+        bool collisions;
+    } controls = { camera.speed, camera.rotationDivisorX, camera.rotationDivisorY, camera.xwzwSpeed, true };
+    auto applyControls = [&]()
+    {
+        camera.speed = controls.speed;
+        camera.rotationDivisorX = controls.rotationDivisorX;
+        camera.rotationDivisorY = controls.rotationDivisorY;
+        camera.xwzwSpeed = controls.xwzwSpeed;
+        camera.collider = controls.collisions ? &collisionWorld : nullptr;
+    };
+    
+    // The simulation moves the camera and the objects, then hands their state
+    // over to rendering. Offline renders stay sequential, so that every frame
+    // samples the camera path at its own time
+    FramePipeline framePipeline([&](const InputFrame &in, FrameSnapshot &out)
     {
-        if(obj.castShadows)
+        if(renderPath)
         {
-            const Model4RenderContext *rc = obj.getRenderContext();
-            if(rc)
-            {
-                const Geometry4 &geom = rc->geometry;
-                const int vertexCount = static_cast<int>(vertexCompBuffer.size());
-                if(geom.isIndexed())
-                {
-                    for(const auto& cell : geom.cells)
-                    {
-                        cellsCompBuffer.push_back(cell + vertexCount);
-                        objIndexCompBuffer.push_back(objectIndex);
-                    }
-                }
-                else
-                {
-                    for(unsigned int k = 0; k < geom.vertices.size(); k += 4)
-                    {
-                        unsigned int v = k + vertexCount;
-                        cellsCompBuffer.push_back({ v, v + 1, v + 2, v + 3 });
-                        objIndexCompBuffer.push_back(objectIndex);
-                    }
-                }
-                vertexCompBuffer.insert(vertexCompBuffer.end(), geom.vertices.begin(), geom.vertices.end());
-            }
+            CameraPath4::Key key = cameraPath.sample(out.time);
+            camera.setPose(key.position, key.xz, key.yz, key.xwzw);
         }
-        objectIndex++;
-    });
+        else
+            camera.update(in, out.dt);
+        out.camera = camera;
+        out.capture(sceneGraph);
+    }, pipelined && !renderPath);
+    trace((framePipeline.pipelined() ? "Pipelined" : "Sequential") << " simulation");
+    float latencyMs = 0;
+    
+    // Per-frame GPU data, such as the transforms used by the shadow pass
+    UploadRing uploadRing;
+    
+    // Draw repeated geometry with one call per render context
+    InstanceBatcher4 batcher;
+    bool instancing = true;
+    // Otherwise sort draws by state and depth
+    RenderQueue4 renderQueue;
+    GLRenderBackend4 renderBackend;
     
-    svComputer.reinit(context.frameWidth, context.frameHeight, *context.texPos, cellsCompBuffer, objIndexCompBuffer, vertexCompBuffer);
+    svComputer.reinit(context.frameWidth, context.frameHeight, *context.texPos, casters);
     
     /// Start draw loop
     {
@@ -244,66 +376,164 @@ int _main(int, char *argv[])
     
     setAspectRatio(p, (float)context.frameWidth / context.frameHeight);
     
-    while (!glfwWindowShouldClose(context.window))
+    // Offline rendering : frames are read back and encoded to PNG in parallel
+    // while the GPU renders the following ones
+    std::unique_ptr<FrameRecorder> recorder;
+    double renderSeconds = 0;
+    std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    if(renderPath)
     {
+        std::filesystem::create_directories(renderDir);
+        // OpenGL rows go bottom-up
+        stbi_flip_vertically_on_write(1);
+        std::string dir = renderDir;
+        recorder = std::make_unique<FrameRecorder>(ThreadPool::get(), context.frameWidth, context.frameHeight,
+            [dir](const unsigned char *pixels, int w, int h, unsigned int frame)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "/frame_%05u.png", frame);
+            return stbi_write_png((dir + name).c_str(), w, h, 3, pixels, w * 3) != 0;
+        });
+        trace("Rendering " << headlessFrames << " frames of " << renderPath << " to " << renderDir << " with "
+            << ThreadPool::get().size() << " encoding workers");
+    }
+    
+    // Benchmarks time every stage, waiting for the GPU in between so that its
+    // work is accounted for where it is issued. The first frames compile
+    // shaders and fill caches, so they are left out
+    FrameTimings timings;
+    timings.synchronize = true;
+    const int warmupFrames = std::min(10, headlessFrames / 10);
+    auto mark = [&](const char *stage)
+    {
+        if(benchmarkPath)
+            timings.mark(stage);
+    };
+    // GPU time of the passes, read a few frames late ; benchmarks keep it
+    // as "gpu <pass>" stages
+    GPUTimer gpuTimer;
+    if(benchmarkPath)
+        gpuTimer.onResults = [&](size_t frame, const std::vector<GPUTimer::Pass> &passes)
+        {
+            if(frame < static_cast<size_t>(warmupFrames))
+                return;
+            for(const GPUTimer::Pass &pass : passes)
+                timings.record(std::string("gpu ") + pass.name, pass.milliseconds);
+        };
+    // Scripted runs go at a fixed pace, whatever the time frames take
+    const float fixedStep = renderPath ? 1.f / renderFPS : benchmarkPath ? benchmarkDt : 0.f;
+    
+    for(int frame = 0; !context.shouldClose() && (headlessFrames < 0 || frame < headlessFrames); ++frame)
+    {
+        if(benchmarkPath)
+        {
+            if(frame == warmupFrames)
+                timings.reset();
+            timings.beginFrame();
+        }
+        Profiler::get().markFrame();
         context.newFrame();
+        RenderStats::get().reset();
+        uploadRing.beginFrame();
+        gpuTimer.beginFrame();
+        
+        // GLFW only reports input to the main thread
+        InputFrame inputFrame;
+        if(!context.freezeCamera && !renderPath)
+            input->next(inputFrame);
+        float now = fixedStep > 0 ? frame * fixedStep : static_cast<float>(context.time()),
+            dt = fixedStep > 0 ? fixedStep : now - timeBase;
+        timeBase = now;
+        const FrameSnapshot &snapshot = framePipeline.advance(inputFrame, now, dt, applyControls);
+        mark("simulation");
 
         /// Render scene on framebuffer for deferred shading
+        gpuTimer.begin("G-buffer");
         context.setFramebuffer(*context.gBuffer, Empty::gl::FramebufferTarget::DrawRead, context.frameWidth, context.frameHeight);
         context.gBuffer->clearAttachment<Empty::gl::FramebufferAttachment::Color>(0, Empty::math::vec4::zero);
         context.gBuffer->clearAttachment<Empty::gl::FramebufferAttachment::Depth>(1.f);
         
-        float now = static_cast<float>(glfwGetTime()), dt = now - timeBase;
-        timeBase = now;
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
         
-        Empty::math::vec4 lightPos(sin(now) * 2.f, sin(now * 1.5f) * 1.5f + 2.f, 0.f, cos(now) * 2.f);
-        Transform4 vt = camera.computeViewTransform();
+        const float t = snapshot.time;
+        Empty::math::vec4 lightPos(sin(t) * 2.f, sin(t * 1.5f) * 1.5f + 2.f, 0.f, cos(t) * 2.f);
+        Transform4 vt = snapshot.camera.computeViewTransform();
         lightPos = vt.apply(lightPos);
         
-        context.setShaderProgram(program);
-        
-        program.uniform("P", p);
-        
-        Object4::scene.render(camera);
-        
-        /// GPGPU fun
-        // Generate AABB hierarchy and bind test program
-        Empty::gl::ShaderProgram &computeProgram = svComputer.precompute();
-        
-        // Compute M transforms (matrix + translation) for all meshes
-        MCompBuffer.clear();
-        MtCompBuffer.clear();
+        sceneGraph.updateWorldTransforms(snapshot.localMats, snapshot.localPos, snapshot.versions);
+        mark("update");
         {
-            Transform4 dummy;
-            Object4::scene.visit<Transform4>([&](const Object4 &obj, Transform4 &pm)
+            PROFILE_ZONE("Geometry pass");
+            if(instancing)
+            {
+                batcher.gather(sceneGraph, vt, p);
+                context.setShaderProgram(instancedProgram);
+                instancedProgram.uniform("P", p);
+                batcher.render(instancedProgram);
+            }
+            else
             {
-                Transform4 m = obj.chain(pm);
-                MCompBuffer.push_back(m.mat);
-                MtCompBuffer.push_back(m.pos);
-                return m;
-            }, dummy);
+                context.setShaderProgram(program);
+                program.uniform("P", p);
+                renderQueue.gather(sceneGraph, vt, p);
+                renderQueue.sort();
+                renderQueue.submit(renderBackend);
+            }
         }
+        gpuTimer.end();
+        mark("geometry");
         
-        // Bind textures and whatnot
-        context.bind(context.texPos->getLevel(0), 0, Empty::gl::AccessPolicy::ReadOnly, Empty::gl::TextureFormat::RGBA16f);
-        computeProgram.uniform("uLightPos", lightPos);
-        computeProgram.uniform("uTexSize", Empty::math::ivec2(context.frameWidth, context.frameHeight));
-        computeProgram.uniform("V", vt.mat);
-        computeProgram.uniform("Vt", vt.pos);
-        // Perform the actual computation
-        svComputer.compute(MCompBuffer, MtCompBuffer);
+        /// GPGPU fun
+        if(svComputer.available())
+        {
+            // Only the casters changed since the last frame are uploaded
+            gpuTimer.begin("AABB reduction");
+            if(casters.fragmentation() > 0.5f)
+                casters.defragment();
+            svComputer.updateCasters(casters);
+            
+            // Generate AABB hierarchy and bind test program
+            Empty::gl::ShaderProgram &computeProgram = svComputer.precompute();
+            
+            // Bind textures and whatnot
+            context.bind(context.texPos->getLevel(0), 0, Empty::gl::AccessPolicy::ReadOnly, Empty::gl::TextureFormat::RGBA16f);
+            computeProgram.uniform("uLightPos", lightPos);
+            computeProgram.uniform("uTexSize", Empty::math::ivec2(context.frameWidth, context.frameHeight));
+            computeProgram.uniform("V", vt.mat);
+            computeProgram.uniform("Vt", vt.pos);
+            // Perform the actual computation
+            gpuTimer.begin("Shadow traversal");
+            svComputer.compute(sceneGraph.worldMats, sceneGraph.worldPos, uploadRing);
+            gpuTimer.end();
+        }
+        else
+            svComputer.clear();
+        mark("shadows");
         
         /// Deferred rendering
-        context.setFramebuffer(Empty::gl::Framebuffer::dflt, Empty::gl::FramebufferTarget::DrawRead, context.frameWidth, context.frameHeight);
-        Empty::gl::Framebuffer::dflt.clearAttachment<Empty::gl::FramebufferAttachment::Color>(0, Empty::math::vec4::zero);
-        Empty::gl::Framebuffer::dflt.clearAttachment<Empty::gl::FramebufferAttachment::Depth>(1.f);
-        context.setShaderProgram(quadProgram);
-        quadProgram.uniform("uLightIntensity", lightIntensity);
-        quadProgram.uniform("uLightRadius", lightRadius);
-        quadProgram.uniform("uLightPos", lightPos);
-        quadProgram.uniform("uTexSize", Empty::math::ivec2(context.frameWidth, context.frameHeight));
-        context.memoryBarrier(Empty::gl::MemoryBarrierType::ShaderStorage);
-        quadRC.render();
+        {
+            PROFILE_ZONE("Deferred shading");
+            gpuTimer.begin("Shading");
+            Empty::gl::Framebuffer &output = context.output();
+            context.setFramebuffer(output, Empty::gl::FramebufferTarget::DrawRead, context.frameWidth, context.frameHeight);
+            output.clearAttachment<Empty::gl::FramebufferAttachment::Color>(0, Empty::math::vec4::zero);
+            output.clearAttachment<Empty::gl::FramebufferAttachment::Depth>(1.f);
+            context.setShaderProgram(quadProgram);
+            quadProgram.uniform("uLightIntensity", lightIntensity);
+            quadProgram.uniform("uLightRadius", lightRadius);
+            quadProgram.uniform("uLightPos", lightPos);
+            quadProgram.uniform("uTexSize", Empty::math::ivec2(context.frameWidth, context.frameHeight));
+            context.memoryBarrier(Empty::gl::MemoryBarrierType::ShaderStorage);
+            quadRC.render();
+            gpuTimer.end();
+        }
+        uploadRing.endFrame();
+        mark("shading");
+        if(recorder)
+        {
+            renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+            recorder->capture();
+        }
         
         ImGui::Begin("Test parameters", NULL, ImGuiWindowFlags_AlwaysAutoResize);
             if(ImGui::TreeNode("Lighting parameters"))
@@ -314,28 +544,95 @@ int _main(int, char *argv[])
             }
             if(ImGui::TreeNode("Camera control"))
             {
-                ImGui::SliderFloat("Movement speed", &camera.speed, 1, 10);
-                ImGui::SliderFloat("Rotation divisor X", &camera.rotationDivisorX, 1, (float)context.frameWidth);
-                ImGui::SliderFloat("Rotation divisor Y", &camera.rotationDivisorY, 1, (float)context.frameHeight);
-                ImGui::SliderFloat("XW+ZW rotation speed", &camera.xwzwSpeed, 0.1f, (float)M_PI * 2.f);
+                ImGui::SliderFloat("Movement speed", &controls.speed, 1, 10);
+                ImGui::SliderFloat("Rotation divisor X", &controls.rotationDivisorX, 1, (float)context.frameWidth);
+                ImGui::SliderFloat("Rotation divisor Y", &controls.rotationDivisorY, 1, (float)context.frameHeight);
+                ImGui::SliderFloat("XW+ZW rotation speed", &controls.xwzwSpeed, 0.1f, (float)M_PI * 2.f);
+                ImGui::Checkbox("Collisions", &controls.collisions);
                 ImGui::TreePop();
             }
         ImGui::End();
         
         ImGui::Begin("Debug info", NULL, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::Text("Rendering %d tetrahedra at %.1f FPS", tetrahedra, ImGui::GetIO().Framerate);
-            ImGui::Text("Camera position : %lf, %lf, %lf, %lf",
-                camera.pos(0), camera.pos(1), camera.pos(2), camera.pos(3));
-            ImGui::Text("Camera rotation : %lf, %lf, %lf", camera._xz, camera._yz, camera._xwzw);
+            {
+                const Camera4 &shown = snapshot.camera;
+                ImGui::Text("Camera position : %lf, %lf, %lf, %lf", shown.pos(0), shown.pos(1), shown.pos(2), shown.pos(3));
+                ImGui::Text("Camera rotation : %lf, %lf, %lf", shown._xz, shown._yz, shown._xwzw);
+            }
+            ImGui::Text("Input latency : %.1f ms, %s simulation", latencyMs, framePipeline.pipelined() ? "pipelined" : "sequential");
+            ImGui::Text("Waited %.2f ms per frame for the simulation", framePipeline.stats.waitSeconds * 1000. / (frame + 1));
+            ImGui::Text("Drawn %u objects, culled %u", sceneGraph.cullingStats.drawn, sceneGraph.cullingStats.culled);
+            ImGui::Checkbox("Culling", &sceneGraph.culling);
+            ImGui::Checkbox("Instancing", &instancing);
+            {
+                const RenderStats &stats = RenderStats::get();
+                ImGui::Text("%u draw calls, %u VAO binds", stats.drawCalls, stats.vertexArrayBinds);
+                ImGui::Text("%u attribute lookups, %u VAO setups", stats.attributeLookups, stats.vertexArraySetups);
+            }
+            ImGui::Text("Uploaded %zu KiB, avoided %zu reallocations, %zu stalls", uploadRing.stats.bytesUploaded / 1024,
+                uploadRing.stats.reallocationsAvoided, uploadRing.stats.stalls);
+            if(ImGui::TreeNode("GPU passes"))
+            {
+                ImGui::Text("Frame %zu, %zu dropped", gpuTimer.resultsFrame(), gpuTimer.stats.dropped);
+                for(const GPUTimer::Pass &pass : gpuTimer.results())
+                    ImGui::Text("%s : %.3f ms, %llu primitives, %u draws, %u dispatches (%llu groups)", pass.name,
+                        pass.milliseconds, static_cast<unsigned long long>(pass.primitives), pass.drawCalls,
+                        pass.dispatches, pass.workGroups);
+                ImGui::TreePop();
+            }
         ImGui::End();
+        
+        Profiler::get().drawWindow();
                 
-        context.swap();
-
-        if(!context.freezeCamera)
-            camera.update(dt);
+        {
+            PROFILE_ZONE("Swap");
+            context.swap();
+        }
+        mark("present");
+        
+        // From input sampling to the frame that shows it being presented
+        latencyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - snapshot.inputTime).count();
+        if(benchmarkPath)
+        {
+            timings.record("latency", latencyMs);
+            timings.endFrame();
+        }
     }
     
     trace("Exiting drawing loop");
+    gpuTimer.finish();
+    
+    if(recorder)
+    {
+        recorder->finish();
+        const FrameRecorder::Stats &stats = recorder->stats;
+        const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count(),
+            ms = 1000. / std::max(stats.frames, 1u);
+        trace("Rendered " << stats.frames << " frames in " << total << " s, " << stats.frames / total << " FPS, "
+            << stats.failures << " failed to save");
+        trace("Per frame : " << renderSeconds * ms << " ms submitting draws, " << stats.readSeconds * ms << " ms issuing readbacks, "
+            << stats.waitSeconds * ms << " ms waiting for them, " << stats.encodeWallSeconds * ms << " ms encoding ("
+            << stats.encodeSeconds * ms << " ms over all workers)");
+        recorder.reset();
+    }
+    
+    if(benchmarkPath)
+    {
+        std::ofstream file;
+        if(benchmarkOutput)
+            file.open(benchmarkOutput);
+        std::ostream &out = benchmarkOutput ? file : std::cout;
+        out << "{\n\"script\": \"";
+        writeJSONEscaped(out, std::filesystem::path(benchmarkPath).generic_string().c_str());
+        out << "\",\n\"warmupFrames\": " << warmupFrames
+            << ",\n\"dt\": " << benchmarkDt << ",\n\"width\": " << context.frameWidth << ",\n\"height\": "
+            << context.frameHeight << ",\n\"headless\": " << (context.headless() ? "true" : "false")
+            << ",\n\"pipelined\": " << (framePipeline.pipelined() ? "true" : "false")
+            << ",\n\"stagesMs\": ";
+        timings.writeJSON(out);
+        out << "\n}" << std::endl;
+    }
     
     // Cleanup
     context.terminate();
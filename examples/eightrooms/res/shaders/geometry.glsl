@@ -59,6 +59,8 @@ void buildVertex(int i)
 {
     gPosition = r[i].pos;
     gNormal = r[i].normal;
+    // Colors are flat per object
+    gColor = vColor[0];
 }
 
 void main()
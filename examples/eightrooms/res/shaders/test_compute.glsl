@@ -17,10 +17,15 @@ layout(std430, binding = 0) buffer cellBuffer
 {
     ivec4 cells[];
 };
-layout(std430, binding = 1) buffer objBuffer
+// Caster instances : index of the first cell among all instances' cells, first
+// cell of the geometry in cellBuffer, amount of cells (0 for holes) and
+// transform index.
+// See ShadowCasterRegistry.
+layout(std430, binding = 1) buffer instanceBuffer
 {
-    int objIndex[];
+    uvec4 instances[];
 };
+uniform int uInstanceCount;
 layout(std430, binding = 2) buffer vertexBuffer
 {
     vec4 vertices[];
@@ -282,16 +287,34 @@ void exchange(inout vec4 v1, inout vec4 v2)
     v2 = temp;
 }
 
+// Finds the instance a cell belongs to, ie the last one starting at or before it
+uvec4 findInstance(uint cellIndex)
+{
+    int lo = 0, hi = uInstanceCount;
+    while(hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if(instances[mid].x <= cellIndex)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return instances[lo];
+}
+
 void main()
 {
-    uint cellIndex = gl_WorkGroupID.x;
+    uvec4 instance = findInstance(gl_WorkGroupID.x);
+    // Cells of removed casters are left as holes
+    if(gl_WorkGroupID.x - instance.x >= instance.z)
+        return;
     
     // Build shadow volume
     ShadowVolume sv;
     // Fetch cell-related data
-    ivec4 cell = cells[cellIndex];
-    mat4 objM = M[objIndex[cellIndex]];
-    vec4 objMt = Mt[objIndex[cellIndex]];
+    ivec4 cell = cells[instance.y + gl_WorkGroupID.x - instance.x];
+    mat4 objM = M[instance.w];
+    vec4 objMt = Mt[instance.w];
     vec4 v[4], center = vec4(0.);
     for(int k = 0; k < 4; k++)
         v[k] = objM * vertices[cell[k]] + objMt;
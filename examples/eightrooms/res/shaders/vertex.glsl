@@ -4,14 +4,17 @@ uniform mat4 MV;
 uniform mat4 tinvMV;
 uniform vec4 MVt;
 uniform bool uInsideOut;
+uniform vec4 uColor;
 
 in vec4 aPosition;
 in vec4 aNormal;
 
 out vec4 vNormal;
+out vec4 vColor;
 
 void main()
 {
     gl_Position = MV * aPosition + MVt;
     vNormal = normalize(tinvMV * (uInsideOut ? -aNormal : aNormal));
+    vColor = uColor;
 }
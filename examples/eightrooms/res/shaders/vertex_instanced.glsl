@@ -0,0 +1,35 @@
+#version 430
+
+// Instanced counterpart of vertex.glsl : per-object uniforms are replaced by
+// an array of instances, see InstanceBatcher4.
+
+struct Instance
+{
+    mat4 MV;
+    mat4 tinvMV;
+    vec4 MVt;
+    vec4 color;
+    int insideOut;
+};
+
+layout(std430, binding = 7) readonly buffer instanceBuffer
+{
+    Instance instances[];
+};
+
+// Index of the first instance of the current draw
+uniform int uInstanceBase;
+
+in vec4 aPosition;
+in vec4 aNormal;
+
+out vec4 vNormal;
+out vec4 vColor;
+
+void main()
+{
+    Instance inst = instances[uInstanceBase + gl_InstanceID];
+    gl_Position = inst.MV * aPosition + inst.MVt;
+    vNormal = normalize(inst.tinvMV * (inst.insideOut != 0 ? -aNormal : aNormal));
+    vColor = inst.color;
+}